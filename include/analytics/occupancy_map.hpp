@@ -0,0 +1,73 @@
+#ifndef occupancy_map_h
+#define occupancy_map_h
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "tracker/kalman_tracker.hpp"
+
+namespace OT {
+    /**
+     * Accumulates a spatial heatmap of the tracked objects online. The (rectified) frame is
+     * divided into square cells, and for every cell we count how many times a track entered
+     * it (visits) and how many frames tracks spent in it (dwell). The counts live in flat
+     * row-major integer arrays and are periodically snapshotted to a JSON file, so the
+     * analytics are ready as soon as a recording ends. Frames that were never added (when
+     * the analytics skip frames to keep up) are counted as if the tracks stayed where they
+     * were on the next frame that was added.
+     */
+    class OccupancyMap {
+    private:
+        // The size of a cell, in pixels.
+        int cellSize;
+        
+        // The number of cells across and down the frame.
+        int cols;
+        int rows;
+        
+        // The frame dimensions.
+        cv::Size frameSize;
+        
+        // The number of times a track entered each cell.
+        std::vector<uint32_t> visits;
+        
+        // The number of frames that tracks spent in each cell.
+        std::vector<uint32_t> dwellFrames;
+        
+        // The cell each tracker was in last frame. Trackers that disappear are dropped.
+        std::unordered_map<int, int> cellForTrackerId;
+        std::unordered_map<int, int> nextCellForTrackerId;
+        
+        // The number of frames covered so far, and how many of them were never added.
+        long numFrames;
+        long droppedFrames;
+        
+        // The number of the last frame added, or -1 before the first.
+        long lastFrameNumber;
+        
+        // The value of numFrames at the last snapshot.
+        long snapshotFrames;
+        
+        // Where to write snapshots, and how many frames to wait between them.
+        std::string snapshotPath;
+        long snapshotInterval;
+    public:
+        OccupancyMap(cv::Size frameSize,
+                     int cellSize = 10,
+                     const std::string& snapshotPath = "",
+                     long snapshotInterval = 300);
+        
+        // Add the tracking outputs of one frame, which also stand for the frames skipped
+        // since the previous frame number added.
+        void update(const std::vector<OT::TrackingOutput>& trackingOutputs, long frameNumber);
+        
+        // Write the current counts to the snapshot file.
+        void snapshot();
+    };
+}
+
+#endif /* occupancy_map_h */
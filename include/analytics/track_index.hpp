@@ -0,0 +1,101 @@
+#ifndef track_index_h
+#define track_index_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace OT {
+    /**
+     * A packed R-tree over the segments of recorded trajectories, for finding the tracks
+     * that passed through a region (optionally within a range of frames) without reading
+     * the logs. It is built once from tracker JSON logs with Sort-Tile-Recursive packing
+     * and written to a single file that is memory-mapped for queries, so opening an index
+     * costs nothing no matter how many days of logs it covers.
+     */
+    class TrackIndex {
+    public:
+        // The segment between two consecutive points of a tracker.
+        struct Entry {
+            int32_t x0;
+            int32_t y0;
+            int32_t x1;
+            int32_t y1;
+            int64_t frame0;
+            int64_t frame1;
+            int32_t trackerId;
+            
+            // The index of the log the segment came from.
+            uint32_t logIndex;
+        };
+        
+        // The bounds of everything below a node. Leaves point at entries, and the other
+        // nodes point at their children nodes.
+        struct Node {
+            int32_t minX;
+            int32_t minY;
+            int32_t maxX;
+            int32_t maxY;
+            int64_t minFrame;
+            int64_t maxFrame;
+            uint32_t first;
+            uint32_t count;
+        };
+        
+        // A track that passed through the query region, and when it was in it.
+        struct Hit {
+            uint32_t logIndex;
+            int32_t trackerId;
+            int64_t firstFrame;
+            int64_t lastFrame;
+        };
+    private:
+        // The mapped file.
+        void* mapping;
+        size_t mappingBytes;
+        
+        // Views into the mapped file.
+        const Node* nodes;
+        const Entry* entries;
+        uint32_t numNodes;
+        uint32_t numLeaves;
+        uint32_t entryCount;
+        
+        // The logs the index was built from.
+        std::vector<std::string> logPaths;
+    public:
+        TrackIndex();
+        ~TrackIndex();
+        
+        TrackIndex(const TrackIndex&) = delete;
+        TrackIndex& operator=(const TrackIndex&) = delete;
+        
+        // Build an index of the given tracker logs and write it to indexPath. Returns false
+        // if a log can't be read or the index can't be written.
+        static bool build(const std::vector<std::string>& logPaths,
+                          const std::string& indexPath,
+                          size_t nodeCapacity = 16);
+        
+        // Map an index file. Returns false if it isn't a valid index.
+        bool open(const std::string& indexPath);
+        
+        // Find the tracks with a segment that passes through the rectangle [x1, x2] x [y1, y2]
+        // between frames fromFrame and toFrame (inclusive). Hits are sorted by log, then
+        // tracker.
+        void query(int x1, int y1, int x2, int y2,
+                   long fromFrame,
+                   long toFrame,
+                   std::vector<Hit>& hits) const;
+        
+        // The path of the log with the given index.
+        const std::string& logPath(uint32_t logIndex) const;
+        
+        size_t numEntries() const;
+        
+        // Unmap the index.
+        void close();
+    };
+}
+
+#endif /* track_index_h */
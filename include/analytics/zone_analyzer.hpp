@@ -0,0 +1,113 @@
+#ifndef zone_analyzer_h
+#define zone_analyzer_h
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "tracker/kalman_tracker.hpp"
+#include "utils/async_io.hpp"
+
+namespace OT {
+    // Something that happened to a track with respect to a zone or a line.
+    struct ZoneEvent {
+        enum Type { Enter, Exit, Cross };
+        Type type;
+        int trackerId;
+        long frame;
+        
+        // The index of the zone or line.
+        int index;
+        
+        // For crossings, +1 if the track crossed from the left of the line to its right
+        // (looking from "from" to "to"), and -1 for the other way.
+        int direction;
+    };
+    
+    /**
+     * Counts tracks entering and leaving zones and crossing tripwires. The zones and lines
+     * come from a JSON config:
+     *
+     *   {"zones": [{"name": "door", "polygon": [[x, y], ...]}, ...],
+     *    "lines": [{"name": "entrance", "from": [x, y], "to": [x, y]}, ...]}
+     *
+     * in the coordinates of the processed frame. Zones are rasterized once into a label image,
+     * so finding the zone of a track is a single lookup, and lines are binned into a coarse
+     * grid so that each movement is only intersected with the lines near it.
+     */
+    class ZoneAnalyzer {
+    private:
+        // The names of the zones and lines.
+        std::vector<std::string> zoneNames;
+        std::vector<std::string> lineNames;
+        
+        // The endpoints of the lines.
+        std::vector<cv::Point2f> lineFrom;
+        std::vector<cv::Point2f> lineTo;
+        
+        // The zone label (index + 1, or 0 for no zone) of every pixel.
+        cv::Mat labels;
+        
+        // The size of the line bins, in pixels, and the number of bins across and down.
+        int binSize;
+        int binCols;
+        int binRows;
+        
+        // The lines overlapping bin b are binLines[binStart[b]] ... binLines[binStart[b + 1] - 1].
+        std::vector<int> binStart;
+        std::vector<int> binLines;
+        
+        // The stamp of the last movement that tested each line, to test each line once.
+        std::vector<long> lineStamp;
+        long stamp;
+        
+        // The position and zone of each tracker in the last frame.
+        struct TrackState {
+            cv::Point position;
+            int zone;
+        };
+        std::unordered_map<int, TrackState> stateForTrackerId;
+        std::unordered_map<int, TrackState> nextStateForTrackerId;
+        
+        // The event counts.
+        std::vector<long> entersForZone;
+        std::vector<long> exitsForZone;
+        std::vector<long> forwardCrossingsForLine;
+        std::vector<long> backwardCrossingsForLine;
+        
+        // Where the events are written, if anywhere.
+        AsyncIO::Sink eventFile;
+        
+        // The zone label at a point, or 0 if it is outside the frame.
+        int zoneAt(cv::Point pt) const;
+        
+        // Find the lines crossed moving from a to b.
+        void findCrossings(cv::Point a, cv::Point b, int trackerId, long frame, std::vector<ZoneEvent>& events);
+        
+        // Count an event and write it out.
+        void record(const ZoneEvent& event);
+    public:
+        ZoneAnalyzer(cv::Size frameSize, int binSize = 32);
+        
+        // Load the zones and lines from a JSON config. Returns false if it can't be read.
+        bool load(const std::string& configPath);
+        
+        // Write every event as a line of JSON to this file.
+        bool openEventFile(const std::string& path);
+        
+        // Classify the movement of every track since the last frame, and return the events.
+        void update(const std::vector<OT::TrackingOutput>& trackingOutputs,
+                    long frameNumber,
+                    std::vector<ZoneEvent>& events);
+        
+        // Print the counts for each zone and line.
+        void printSummary(std::ostream& output) const;
+        
+        // Close the event file.
+        void close();
+    };
+}
+
+#endif /* zone_analyzer_h */
@@ -0,0 +1,125 @@
+#ifndef ot_tracker_h
+#define ot_tracker_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A C API for embedding the tracker (background subtraction and multi-object tracking) in
+ * another process, one handle per stream. Calls on one handle are serialized by the handle,
+ * and handles are independent, so streams can be processed on different threads.
+ *
+ * Once the first frame has been processed, this layer itself doesn't allocate: frames in BGR
+ * are read in place, other formats are converted into a buffer that is reused, and the tracks
+ * are copied into buffers owned by the caller. The multi-object tracker reuses its cost
+ * matrix, assignment and solver buffers, and skips the trajectories, so it only allocates
+ * when more objects are in view than before or a new object appears. The background
+ * subtraction still allocates on every frame (the contours found by OpenCV), so processing
+ * a frame is not allocation free as a whole.
+ *
+ * The ABI is kept stable: the handle is opaque, and the configuration starts with its own
+ * size so that fields can be appended in later versions.
+ */
+
+#if defined(_WIN32)
+#  define OT_API __declspec(dllexport)
+#else
+#  define OT_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The version of this API, bumped when something is added. */
+#define OT_API_VERSION 1
+
+typedef struct ot_tracker ot_tracker;
+
+typedef enum {
+    OT_OK = 0,
+    OT_ERROR_INVALID_ARGUMENT = -1,
+    OT_ERROR_FRAME_SIZE = -2,
+    OT_ERROR_INTERNAL = -3
+} ot_status;
+
+/* The layout of the pixels of a frame. Each row may be padded (see the stride). */
+typedef enum {
+    OT_PIXEL_BGR24 = 0,
+    OT_PIXEL_RGB24 = 1,
+    OT_PIXEL_BGRA32 = 2,
+    OT_PIXEL_RGBA32 = 3,
+    OT_PIXEL_GRAY8 = 4
+} ot_pixel_format;
+
+typedef struct {
+    /* Set by ot_tracker_config_init() to sizeof(ot_tracker_config). */
+    uint32_t struct_size;
+    
+    /* The background model: the number of frames it remembers and of Gaussians per pixel. */
+    int32_t history;
+    int32_t mixtures;
+    
+    /* Model the background in square tiles of this many pixels (0 for the whole frame). */
+    int32_t tile_size;
+    
+    /* Only update the background model every this many frames (1 for every frame). */
+    int32_t update_interval;
+    
+    /* Find the blobs on frames downscaled by this factor (1 turns this off). */
+    int32_t coarse_scale;
+    
+    /* Label runs of foreground pixels instead of tracing contours (non-zero to enable). */
+    int32_t run_labeling;
+    
+    /* Trackers are only reported once they have lived this many frames, and are dropped
+       after this many frames without a detection. */
+    int32_t lifetime_threshold;
+    int32_t missed_frames_threshold;
+    
+    /* Detections further than this fraction of the frame diagonal from a track aren't
+       associated with it. */
+    float distance_threshold;
+} ot_tracker_config;
+
+/* A track on the last frame processed, in pixels of that frame. */
+typedef struct {
+    int32_t id;
+    int32_t x;
+    int32_t y;
+} ot_track;
+
+/* The version of the library, which may be newer than the header the caller was built with. */
+OT_API uint32_t ot_api_version(void);
+
+/* Fill the configuration with the defaults of the tracker. */
+OT_API void ot_tracker_config_init(ot_tracker_config* config);
+
+/* Create a tracker, or return NULL if the configuration is invalid. A NULL configuration
+   uses the defaults. */
+OT_API ot_tracker* ot_tracker_create(const ot_tracker_config* config);
+
+/* Find the objects in the next frame of the stream and update the tracks. stride is the
+   number of bytes from the start of one row to the next. Every frame of a stream must have
+   the same size. The pixels are only read during the call. */
+OT_API ot_status ot_tracker_process_frame(ot_tracker* tracker,
+                                          const uint8_t* pixels,
+                                          int32_t width,
+                                          int32_t height,
+                                          size_t stride,
+                                          ot_pixel_format format);
+
+/* Copy up to capacity tracks of the last frame into tracks, and set count to the number of
+   tracks there are, which may be more than capacity. */
+OT_API ot_status ot_tracker_get_tracks(ot_tracker* tracker, ot_track* tracks, size_t capacity, size_t* count);
+
+OT_API void ot_tracker_destroy(ot_tracker* tracker);
+
+/* A description of a status, which is never freed. */
+OT_API const char* ot_status_string(ot_status status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ot_tracker_h */
@@ -3,6 +3,11 @@
 
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <string>
+
+#include "utils/async_io.hpp"
+#include "utils/log_segment.hpp"
 
 namespace OT {
     namespace GroundTruth {
@@ -16,14 +21,34 @@ namespace OT {
         private:
             // The array of log entries.
             std::vector<Annotation> log;
+            
+            // Writes annotations that fall out of the retention window to segment files.
+            // This is null unless a retention policy has been set.
+            std::unique_ptr<LogSegment::Writer> spill;
+            
+            // Keep at most this many annotations in memory.
+            size_t maxAnnotationsInMemory;
+            
+            // Spill the oldest count annotations.
+            void spillOldest(size_t count);
         public:
             Log();
             
             // Add an annotation to this log.
             void addAnnotation(Annotation annotation);
             
-            // Write the annotations to a stream.
-            void writeToStream(std::ofstream& outputStream);
+            // Write the annotations to a file as CSV.
+            void writeToStream(OT::AsyncIO::Sink& outputFile);
+            
+            // Keep only the last maxAnnotations annotations in memory. Older annotations are
+            // written to rolling segment files starting with segmentPrefix. Use the merger
+            // mode to turn the segments back into CSV.
+            void setRetention(size_t maxAnnotations,
+                              const std::string& segmentPrefix,
+                              size_t maxSegmentBytes = 64 * 1024 * 1024);
+            
+            // Write every annotation still in memory to the segment files.
+            void flushToSegments();
         };
     }
 }
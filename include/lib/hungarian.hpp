@@ -4,12 +4,25 @@
 #include <vector>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <time.h>
 // http://community.topcoder.com/tc?module=Static&d1=tutorials&d2=hungarianAlgorithm
 using namespace std;
 class AssignmentProblemSolver
 {
+public:
+    enum TMethod { optimal, many_forbidden_assignments, without_forbidden_assignments };
 private:
+    // --------------------------------------------------------------------------
+    // Work space kept between calls, so that once it has grown to the largest
+    // problem seen, solving doesn't allocate.
+    // --------------------------------------------------------------------------
+    vector<int> assignmentBuffer;
+    vector<double> distInBuffer;
+    vector<double> distMatrixBuffer;
+    unique_ptr<bool[]> flagBuffer;
+    size_t flagBufferSize;
+    double solveBuffered(int N, int M, vector<int>& Assignment, TMethod Method);
     // --------------------------------------------------------------------------
     // Computes the optimal assignment (minimum overall costs) using Munkres algorithm.
     // --------------------------------------------------------------------------
@@ -30,10 +43,13 @@ private:
     // --------------------------------------------------------------------------
     void assignmentsuboptimal2(int *assignment, double *cost, double *distMatrixIn, int nOfRows, int nOfColumns);
 public:
-    enum TMethod { optimal, many_forbidden_assignments, without_forbidden_assignments };
     AssignmentProblemSolver();
     ~AssignmentProblemSolver();
     double Solve(vector<vector<double> >& DistMatrix,vector<int>& Assignment,TMethod Method=optimal);
+    // --------------------------------------------------------------------------
+    // Solves for an N x M cost matrix stored row by row in DistMatrix.
+    // --------------------------------------------------------------------------
+    double Solve(const vector<double>& DistMatrix,int N,int M,vector<int>& Assignment,TMethod Method=optimal);
 };
 
 #endif /* hungarian_h */
@@ -0,0 +1,20 @@
+#ifndef indexing_mode_h
+#define indexing_mode_h
+
+#include "lib/cmdparser.hpp"
+
+/**
+ * Builds and queries a spatial index over tracker logs. With -b (a comma-separated list
+ * of tracker JSON logs), it builds the index and writes it to the -i path. With -q
+ * (x1 y1 x2 y2), it lists the tracks in the -i index that passed through that rectangle,
+ * optionally only between the two frames given with -fr.
+ */
+namespace OT {
+    namespace Mode {
+        namespace Indexing {
+            void run(const cli::Parser& parser);
+        }
+    }
+}
+
+#endif /* indexing_mode_h */
@@ -0,0 +1,20 @@
+#ifndef merging_mode_h
+#define merging_mode_h
+
+#include "lib/cmdparser.hpp"
+
+/**
+ * Reassembles the segment files spilled by a bounded-retention log (see the -rf and -rm
+ * options) into the standard output format: JSON for tracker logs and CSV for ground truth.
+ * The -i argument is the segment prefix, and -s is the output file. The -i argument can
+ * also be a track journal (see the -j option), which is converted to tracker JSON.
+ */
+namespace OT {
+    namespace Mode {
+        namespace Merging {
+            void run(const cli::Parser& parser);
+        }
+    }
+}
+
+#endif /* merging_mode_h */
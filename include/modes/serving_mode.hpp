@@ -0,0 +1,33 @@
+#ifndef serving_mode_h
+#define serving_mode_h
+
+#include "lib/cmdparser.hpp"
+
+/**
+ * Runs the tracker as a daemon that tracks any number of streams at once, controlled over
+ * a Unix socket at the -i path. Each stream has its own background model and tracks, but
+ * the streams share one pool of -sw worker threads (each with its own frame buffer, reused
+ * for every stream it processes) and the async I/O service that writes their outputs, so
+ * adding a camera starts no new process and opens no windows.
+ *
+ * A command is a line of JSON, and is answered with a line of JSON with "ok" set to true
+ * or false (with an "error"):
+ * {"command": "open", "stream": "door", "input": "rtsp://...", "journal": "door.journal", "output": "door.json", ...}
+ * {"command": "reconfigure", "stream": "door", "max_dimension": 500, ...}
+ * {"command": "close", "stream": "door"}
+ * {"command": "stats"} (or with a "stream")
+ * {"command": "shutdown"}
+ * The settings that open and reconfigure take are max_dimension, tile_size,
+ * update_interval, coarse_scale and run_labeling, like the options of tracker mode, and
+ * fps, latency_ms and weight, which schedule the frames of the stream by their deadlines
+ * (see DeadlineScheduler).
+ */
+namespace OT {
+    namespace Mode {
+        namespace Serving {
+            void run(const cli::Parser& parser);
+        }
+    }
+}
+
+#endif /* serving_mode_h */
@@ -0,0 +1,68 @@
+#ifndef activity_map_h
+#define activity_map_h
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace OT {
+    /**
+     * A long-term record of which tiles of a camera's frame ever contain foreground. For
+     * every tile we count the frames it was processed on and the frames it had foreground
+     * on. After a warmup, tiles whose share of foreground frames is at most minActivity
+     * are dropped from processing, and all of the dropped tiles are probed together every
+     * probeInterval frames so that they come back if something starts happening there.
+     * The counts are saved to a file per camera every saveInterval frames and loaded when
+     * the tiles are laid out, so a camera only warms up once.
+     */
+    class ActivityMap {
+    private:
+        // The tile layout the counts belong to.
+        int tileSize;
+        cv::Size frameSize;
+        
+        // The number of frames seen, and per tile, the number of frames it was processed
+        // on and the number of those that had foreground.
+        long numFrames;
+        std::vector<long> observedFrames;
+        std::vector<long> activeFrames;
+        
+        long warmupFrames;
+        long probeInterval;
+        double minActivity;
+        
+        // Where the counts are saved (nowhere if empty), and how often.
+        std::string path;
+        long saveInterval;
+        
+        // Load the counts saved for the same tile layout. Returns false if there are none.
+        bool load();
+    public:
+        ActivityMap(const std::string& path = "",
+                    long warmupFrames = 500,
+                    long probeInterval = 100,
+                    double minActivity = 0.001,
+                    long saveInterval = 1000);
+        
+        // Start counting for the given tile layout, from the saved counts if there are any.
+        void reset(int tileSize, cv::Size frameSize, int numTiles);
+        
+        // Whether the tile has been dropped from processing, apart from probes.
+        bool isDormant(int tile) const;
+        
+        // Whether the tile should be processed on the current frame.
+        bool shouldProcess(int tile) const;
+        
+        // Record whether a tile that was processed had foreground on the current frame.
+        void record(int tile, bool hadForeground);
+        
+        // Move on to the next frame.
+        void nextFrame();
+        
+        // Save the counts as JSON.
+        void save() const;
+    };
+}
+
+#endif /* activity_map_h */
@@ -0,0 +1,69 @@
+#ifndef bit_mask_h
+#define bit_mask_h
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace OT {
+    /**
+     * A binary image with one bit per pixel, packed into 64-bit words (pixel x of a row is
+     * bit x % 64 of word x / 64). The foreground masks are only ever 0 or 255, so keeping
+     * them as bits cuts the memory traffic of the morphology by eight and lets each
+     * operation handle 64 pixels at a time. Bits past the last column are always zero.
+     */
+    class BitMask {
+    private:
+        int rows;
+        int cols;
+        
+        // The number of words in each row.
+        int stride;
+        
+        std::vector<uint64_t> words;
+        
+        // Clear the bits past the last column of every row.
+        void clearPadding();
+    public:
+        BitMask(int rows = 0, int cols = 0);
+        
+        int getRows() const;
+        int getCols() const;
+        cv::Size size() const;
+        
+        const uint64_t* row(int y) const;
+        uint64_t* row(int y);
+        int wordsPerRow() const;
+        
+        // Set the pixels of src (8-bit, single channel) that are greater than thresh.
+        void threshold(const cv::Mat& src, int thresh);
+        
+        // Dilate (or erode) with a 3x3 square, like cv::dilate (cv::erode) with the default
+        // kernel and border: pixels outside the image never change the result.
+        void dilate(BitMask& dst) const;
+        void erode(BitMask& dst) const;
+        
+        // Keep the pixels where at least half of the size x size window around them is set.
+        // On a binary image this is exactly cv::medianBlur, including its replicated border.
+        // The size must be odd and less than 64.
+        void majority(BitMask& dst, int size) const;
+        
+        // Clear the pixels that are not set in other, which must have the same size.
+        void andWith(const BitMask& other);
+        
+        // Clear the pixels inside the rectangle.
+        void clearRect(cv::Rect rect);
+        
+        // The number of set pixels.
+        long count() const;
+        
+        // Whether any pixel inside the rectangle is set.
+        bool anyIn(cv::Rect rect) const;
+        
+        // Expand to an 8-bit image of 0s and 255s, e.g. for cv::findContours.
+        void toMat(cv::Mat& dst) const;
+    };
+}
+
+#endif /* bit_mask_h */
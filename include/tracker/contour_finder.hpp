@@ -1,11 +1,17 @@
 #ifndef contour_finder_h
 #define contour_finder_h
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/video/tracking.hpp>
 
+#include "tracker/activity_map.hpp"
+#include "tracker/bit_mask.hpp"
+#include "tracker/run_labeler.hpp"
+
 namespace OT {
     /**
      * This class will find blobs representing objects in a frame. It uses
@@ -14,12 +20,149 @@ namespace OT {
      */
     class ContourFinder {
     private:
-        // The background subtractor that isolates the foreground.
-        cv::Ptr<cv::BackgroundSubtractorMOG2> bg;
+        // The parameters of the background subtractors.
+        int history;
+        int nMixtures;
+        
+        // The frame is split into square tiles of this size (0 for a single tile covering
+        // the frame), each with its own background subtractor. MOG2 models every pixel on
+        // its own, so this gives the same foreground as one subtractor for the whole frame,
+        // but lets us skip the tiles where nothing can happen.
+        int tileSize;
+        
+        // The size of the frames the tiles were laid out for.
+        cv::Size frameSize;
+        
+        // The tiles, the background subtractor that isolates the foreground of each,
+        // whether each tile touches the region of interest, and whether each tile is
+        // processed on the current frame.
+        std::vector<cv::Rect> tiles;
+        std::vector<cv::Ptr<cv::BackgroundSubtractorMOG2>> tileModels;
+        std::vector<bool> tileInRoi;
+        std::vector<bool> tileActive;
+        
+        // The models are only updated every updateInterval frames, on a rotating subset of
+        // the tiles; on the other frames they only classify. This is the number of frames
+        // each model has seen.
+        int updateInterval;
+        std::vector<long> tileFrames;
+        
+        // Classifying with the model costs about as much as updating it, so between updates
+        // the tiles are classified against what each model gave at its last update instead:
+        // the frame and its foreground, and the background image of the model.
+        std::vector<cv::Mat> tileBackgrounds;
+        std::vector<cv::Mat> tileUpdateFrames;
+        std::vector<cv::Mat> tileUpdateForegrounds;
+        
+        // Classify the pixels of the tile without the model. The pixels that haven't changed
+        // since the last update keep the class they got then. The others are foreground (255)
+        // if they differ from the background image, or shadow (127) where they are only
+        // darker, like MOG2 does.
+        void classifyTile(size_t tile, const cv::Mat& frame, cv::Mat& foreground) const;
+        
+        // Learns which tiles ever have foreground, so the others can be skipped. This is
+        // null unless it has been enabled.
+        std::unique_ptr<ActivityMap> activityMap;
+        
+        // Where the codec saw motion on the current frame, one pixel per macroblock, if it
+        // has been given, and the same at the size of the modelled frame. Tiles without any
+        // motion are skipped.
+        cv::Mat motionBlocks;
+        cv::Mat motionPixels;
+        
+        // Whether the tile has any motion on the current frame.
+        bool tileHasMotion(size_t tile) const;
+        
+        // The region the filters and the contour search run over: the active tiles, padded
+        // by how far the filters reach.
+        cv::Rect activeRect;
+        
+        // The polygons of the region of interest, if any. Pixels outside of it are never
+        // foreground, and tiles that don't touch it are skipped.
+        std::vector<std::vector<cv::Point>> roiPolygons;
+        
+        // The region of interest over the whole frame, and within the active region as a
+        // bit mask.
+        cv::Mat roiPixels;
+        BitMask roiMask;
+        
+        // The filtered foreground, which the contours are found in.
+        cv::Mat filtered;
+        
+        // Whether to show the filtered foreground in a window on every frame.
+        bool showForeground;
+        
+        // In multi-scale mode (coarseScale > 1), the background is modelled and the blobs
+        // are found on a frame downscaled by this factor. Only the (padded) blobs are then
+        // looked at again at full resolution, to split them and place them precisely.
+        int coarseScale;
+        
+        // The downscaled frame.
+        cv::Mat coarseFrame;
+        
+        // The full resolution background the blobs are refined against, which is a running
+        // average of the frame wherever the coarse pass found no foreground, and the number
+        // of frames it has seen.
+        cv::Mat fineBackground;
+        long fineFrames;
+        
+        // The difference from the fine background that makes a pixel foreground.
+        int fineThreshold;
+        
+        // Scratch space for refining the blobs.
+        cv::Mat fineMask;
+        cv::Mat coarseMaskUp;
+        cv::Mat fineScratch;
+        
+        // Update the fine background with the frame, leaving out the coarse foreground.
+        void updateFineBackground(const cv::Mat& frame);
+        
+        // Look at the regions of the coarse bounding boxes again at full resolution, and
+        // find the contours in them.
+        void refineBlobs(const cv::Mat& frame,
+                         const std::vector<cv::Rect>& coarseBoxes,
+                         std::vector<std::vector<cv::Point>>& contours);
+        
+        // Lay out the tiles for frames of the given size.
+        void setupTiles(cv::Size size);
+        
+        // Recompute the active region (and the ROI mask within it) from the active tiles.
+        void updateActiveRect();
+        
+        // Count another frame for the model of the tile and return the learning rate to
+        // apply it with: 0 if it should only classify.
+        double learningRate(size_t tile);
+        
+        // Create a background subtractor with our parameters.
+        cv::Ptr<cv::BackgroundSubtractorMOG2> createModel() const;
         
         // The foreground of the frame that should contain the blobs.
         cv::Mat foreground;
         
+        // The thresholded foreground, one bit per pixel, and a scratch mask for the filters.
+        BitMask mask;
+        BitMask scratchMask;
+        
+        // Whether to find blobs by labeling the runs of the mask instead of tracing contours.
+        bool useRunLabeling;
+        
+        // With tiles, the mask is labeled in parallel bands of one row of tiles each, and
+        // the blobs are stitched across the seams. This is 0 for a single band.
+        int bandRows;
+        
+        // Labels the runs of the mask, and the blobs it found.
+        RunLabeler labeler;
+        std::vector<Blob> blobs;
+        
+        // Find the blobs of the mask and turn them into contours (their bounding boxes),
+        // mass centers and bounding boxes, filtering, suppressing and merging them the
+        // same way as contours.
+        void findBlobs(const BitMask& mask,
+                       cv::Point offset,
+                       std::vector<std::vector<cv::Point>>& contours,
+                       std::vector<cv::Point2f>& massCenters,
+                       std::vector<cv::Rect>& boundingBoxes);
+        
         // Remove contours that are too small.
         void filterOutBadContours(std::vector<std::vector<cv::Point>>& contours);
         
@@ -75,6 +218,55 @@ namespace OT {
                           std::vector<cv::Rect>& boundingBoxes);
         
         void suppressRectangle(cv::Rect rect);
+        
+        // Label the runs of the foreground instead of tracing contours. This is much
+        // faster for sparse foregrounds. The areas and mass centers are computed from the
+        // pixels rather than the contour polygons, and the contours are the bounding boxes.
+        void setRunLabeling(bool enabled);
+        
+        // Show the filtered foreground in a window (on by default). This has to be off when
+        // finding contours off the main thread, e.g. from the Python bindings.
+        void setShowForeground(bool enabled);
+        
+        // Only process the tiles that overlap a moving macroblock on the next frame. The
+        // blocks are a CV_8U map covering the whole frame, with one pixel per macroblock.
+        void setMotionBlocks(const cv::Mat& blocks);
+        
+        // Find the objects straight from the moving macroblocks, without modelling the
+        // background, filtering, suppressing and merging them like findContours().
+        void findMotionContours(const cv::Mat& blocks,
+                                cv::Size size,
+                                std::vector<std::vector<cv::Point>>& contours,
+                                std::vector<cv::Point2f>& massCenters,
+                                std::vector<cv::Rect>& boundingBoxes);
+        
+        // Only update each background model every this many frames (the tiles take turns),
+        // with a learning rate scaled up to match, and only classify on the other frames.
+        void setUpdateInterval(int updateInterval);
+        
+        // Model the background and find the blobs on frames downscaled by this factor, and
+        // only refine the blobs at full resolution (1 turns this off). The tiles and the
+        // region of interest are still given in pixels of the full frame.
+        void setCoarseScale(int coarseScale);
+        
+        // Split the frame into tiles of this size. This must be called before the first frame.
+        void setTileSize(int tileSize);
+        
+        // Only look for objects inside these polygons (in the coordinates of the frames
+        // passed to findContours).
+        void setRegionOfInterest(const std::vector<std::vector<cv::Point>>& polygons);
+        
+        // Load the region of interest from a JSON file of the form
+        // {"polygons": [[[x, y], ...], ...]}. Returns false if it can't be read.
+        bool loadRegionOfInterest(const std::string& path);
+        
+        // Learn which tiles ever have foreground and stop processing the rest after
+        // warmupFrames, probing them every probeInterval frames. The map is kept in path
+        // (if it isn't empty) so that the next run with the same camera starts from it.
+        void setActivityMap(const std::string& path, long warmupFrames = 500, long probeInterval = 100);
+        
+        // Save the activity map, if there is one.
+        void saveActivityMap() const;
     };
 }
 
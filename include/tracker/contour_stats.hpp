@@ -0,0 +1,20 @@
+#ifndef contour_stats_h
+#define contour_stats_h
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "tracker/run_labeler.hpp"
+
+namespace OT {
+    /**
+     * Compute the area, first moments and exact bounding box of a contour in a single pass
+     * over its points. The moments are those of the polygon, as cv::moments computes them
+     * (including the sign convention), but they are accumulated in exact integer
+     * arithmetic, and the loop is free of branches so that the compiler can vectorize it.
+     */
+    Blob contourStats(const std::vector<cv::Point>& contour);
+}
+
+#endif /* contour_stats_h */
@@ -41,6 +41,9 @@ namespace OT {
         // The unique color associated with this Kalman tracker.
         cv::Scalar color;
         
+        // The measurement passed to the filter, reused by every correction.
+        cv::Mat_<float> measurement;
+        
         void addPointToTrajectory(cv::Point pt);
     public:
         KalmanTracker(cv::Point startPt,
@@ -62,7 +65,9 @@ namespace OT {
         cv::Point predict();
         cv::Point latestPrediction();
         cv::Point correct(cv::Point pt);
-        OT::TrackingOutput latestTrackingOutput();
+        
+        // The latest ID, location and color, and a copy of the trajectory if asked for.
+        OT::TrackingOutput latestTrackingOutput(bool withTrajectory = true);
     };
 }
 
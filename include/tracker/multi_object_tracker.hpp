@@ -1,12 +1,15 @@
 #ifndef multi_object_tracker_h
 #define multi_object_tracker_h
 
+#include <memory>
 #include <vector>
 
 #include <opencv2/opencv.hpp>
 
 #include "kalman_tracker.hpp"
 
+class AssignmentProblemSolver;
+
 namespace OT {
     class MultiObjectTracker {
     private:
@@ -51,6 +54,16 @@ namespace OT {
         // Check if the tracker prediction at index i shares the given
         // bounding rectangle with another point.
         bool sharesBoundingRect(size_t i, cv::Rect boundingRect);
+        
+        // The association state of the last update, kept so that the buffers are reused and
+        // an update doesn't allocate once they have grown to the number of objects in view.
+        // The cost matrix is stored row by row, one row per Kalman tracker.
+        std::unique_ptr<AssignmentProblemSolver> solver;
+        std::vector<double> costMatrix;
+        std::vector<int> assignment;
+        std::vector<cv::Point2f> predictions;
+        std::vector<int> kalmansWithoutCenters;
+        std::vector<int> centersWithoutKalman;
     public:
         MultiObjectTracker(cv::Size frameSize,
                            long lifetimeThreshold = 20,
@@ -61,11 +74,15 @@ namespace OT {
                            int lifetimeSuppressionThreshold = 20,
                            float distanceSuppressionThreshold = 0.1,
                            float ageSuppressionThreshold = 2);
+        ~MultiObjectTracker();
         
         // Update the object tracker with the mass centers of the observed boundings rects.
+        // Without trajectories, the outputs only have an ID, a location and a color, and
+        // reusing the same trackingOutputs doesn't allocate.
         void update(const std::vector<cv::Point2f>& massCenters,
                     const std::vector<cv::Rect>& boundingRects,
-                    std::vector<OT::TrackingOutput>& trackingOutputs);
+                    std::vector<OT::TrackingOutput>& trackingOutputs,
+                    bool withTrajectories = true);
     };
 }
 
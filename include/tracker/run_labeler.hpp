@@ -0,0 +1,99 @@
+#ifndef run_labeler_h
+#define run_labeler_h
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "tracker/bit_mask.hpp"
+
+namespace OT {
+    // A connected blob of foreground pixels, or the polygon of a contour.
+    struct Blob {
+        // The area (the number of pixels, for blobs found by labeling), and the first
+        // moments (the sums of the x and y coordinates of the pixels).
+        double m00;
+        double m10;
+        double m01;
+        
+        // The bounding box of the pixels.
+        cv::Rect box;
+        
+        cv::Point2f center() const;
+        
+        // Add the pixels of another blob to this one.
+        void merge(const Blob& other);
+        
+        // Move the blob by the given offset.
+        void translate(cv::Point offset);
+    };
+    
+    /**
+     * Finds the 8-connected blobs of a mask from its runs of set pixels, so the cost
+     * scales with the number of runs rather than the number of pixels. Each row is split
+     * into runs 64 pixels at a time with bit scans over the packed mask, runs that touch
+     * a run of the previous row are joined with a union-find over run indices, and the
+     * moments and bounding boxes are accumulated per run and then per blob.
+     *
+     * Large masks can be split into bands of rows that are labeled in parallel. The blobs
+     * of neighbouring bands are then stitched together with a second union-find over the
+     * runs on either side of each seam, which gives the same blobs, in the same order, as
+     * labeling the whole mask at once.
+     */
+    class RunLabeler {
+    public:
+        // A run of set pixels [start, end) on row y.
+        struct Run {
+            int y;
+            int start;
+            int end;
+        };
+    private:
+        // The labeling of rows [y0, y1) of the mask.
+        struct Band {
+            int y0;
+            int y1;
+            
+            // The runs of the band, in row order, and the index of the first run of each
+            // row (with one extra entry at the end).
+            std::vector<Run> runs;
+            std::vector<int> rowStart;
+            
+            // The union-find parent of each run.
+            std::vector<int> parent;
+            
+            // The blob of each run.
+            std::vector<int> blobForRun;
+            
+            // The blobs of the band, in the raster order of their first runs.
+            std::vector<Blob> blobs;
+        };
+        
+        std::vector<Band> bands;
+        
+        // The union-find parent of each blob of every band, for stitching, and the stitched
+        // blob of each root.
+        std::vector<int> blobParent;
+        std::vector<int> stitchedBlob;
+        
+        // Label a band on its own.
+        static void labelBand(const BitMask& mask, Band& band);
+        
+        // Find the root of an element, and join two sets such that the root is always the
+        // smallest element, so roots come in raster order.
+        static int find(std::vector<int>& parent, int element);
+        static void unite(std::vector<int>& parent, int a, int b);
+    public:
+        // Append the runs of rows [y0, y1) of the mask to runs, and the index of the first
+        // run of each row to rowStart.
+        static void extractRuns(const BitMask& mask, int y0, int y1,
+                                std::vector<Run>& runs,
+                                std::vector<int>& rowStart);
+        
+        // Find the blobs of the mask. If bandRows > 0, the mask is labeled in parallel
+        // bands of that many rows.
+        void label(const BitMask& mask, std::vector<Blob>& blobs, int bandRows = 0);
+    };
+}
+
+#endif /* run_labeler_h */
@@ -0,0 +1,71 @@
+#ifndef track_journal_h
+#define track_journal_h
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "tracker/tracker_log.hpp"
+#include "utils/async_io.hpp"
+
+namespace OT {
+    /**
+     * A crash-safe, append-only journal of the tracks output for each frame. Each frame is
+     * appended as a binary record with a CRC32 checksum. Records are buffered in memory and
+     * handed to the async I/O service together once the commit interval has elapsed, followed
+     * by an fdatasync (group commit), so a crash loses at most about one interval of frames
+     * and the capture loop never waits for the disk. On restart, recover() reads back every
+     * intact record and truncates a trailing partial record left behind by the crash.
+     */
+    class TrackJournal {
+    private:
+        // The journal file.
+        AsyncIO::Sink sink;
+        
+        // Encoded records that have not been committed yet.
+        std::string buffer;
+        
+        // Commit at most this often.
+        std::chrono::milliseconds commitInterval;
+        
+        // Commit early if the buffer grows past this many bytes.
+        size_t maxBufferBytes;
+        
+        // When the last commit happened.
+        std::chrono::steady_clock::time_point lastCommit;
+    public:
+        TrackJournal(int commitIntervalMs = 200, size_t maxBufferBytes = 1024 * 1024);
+        ~TrackJournal();
+        
+        // Open the journal for appending, creating it if needed. Call recover() first
+        // if the journal may have been left behind by a crash. Returns false if the file
+        // exists but isn't a journal.
+        bool open(const std::string& path);
+        
+        // Append the tracks for one frame. The record is committed with the next group.
+        void append(long frameNumber, int width, int height, const std::vector<Track>& tracks);
+        
+        // Write every buffered record and sync it in the background.
+        void commit();
+        
+        // Commit and close the journal.
+        void close();
+        
+        /**
+         * Read every intact record of the journal at path into tracks, and return the last
+         * frame number that was recovered (0 if there is none). If truncate is true, the
+         * journal is cut back to the end of the last intact record (or to nothing, if
+         * even its header is incomplete) so that it can be appended to again.
+         */
+        static long recover(const std::string& path,
+                            std::vector<Track>& tracks,
+                            int& width,
+                            int& height,
+                            bool truncate = true);
+        
+        // Check if the file at path is a track journal.
+        static bool isJournal(const std::string& path);
+    };
+}
+
+#endif /* track_journal_h */
@@ -4,6 +4,11 @@
 #include <unordered_map>
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <string>
+
+#include "utils/async_io.hpp"
+#include "utils/log_segment.hpp"
 
 namespace OT {
     struct Track {
@@ -13,6 +18,8 @@ namespace OT {
         long frameNumber;
     };
     
+    class TrajectorySimplifier;
+    
     class TrackerLog {
     private:
         // Get the tracks associated with a tracker given its tracker id.
@@ -30,17 +37,98 @@ namespace OT {
         // Capture the dimensions of the frame.
         int width;
         int height;
+        
+        // Writes tracks that fall out of the retention window to segment files.
+        // This is null unless a retention policy has been set.
+        std::unique_ptr<LogSegment::Writer> spill;
+        
+        // Keep at most this many frames in memory (0 = unlimited).
+        long maxFramesInMemory;
+        
+        // Keep at most this many bytes of tracks in memory (0 = unlimited).
+        size_t maxBytesInMemory;
+        
+        // The number of tracks currently held in memory.
+        size_t numTracksInMemory;
+        
+        // The heap memory held by the tracks in memory, counting the capacity of the
+        // vectors and the nodes and buckets of the maps, not just the tracks themselves.
+        size_t bytesInMemory;
+        
+        // Count the memory held by every tracker again, e.g. after a spill.
+        void recountBytesInMemory();
+        
+        // The oldest frame number that is still held in memory.
+        long oldestFrameInMemory;
+        
+        // Spill every track whose frame is older than cutoffFrame.
+        void spillTracksBefore(long cutoffFrame);
+        
+        // Simplifies the trajectories before they are stored, if simplification is on.
+        std::unique_ptr<TrajectorySimplifier> simplifier;
+        
+        // The vertices that the simplifier has finished, waiting to be stored.
+        std::vector<Track> vertices;
+        
+        // Whether the stored tracks are simplified, in which case readers interpolate
+        // between them.
+        bool simplified;
+        
+        // The frames on which the trajectories of a tracker start, which readers don't
+        // interpolate into from the vertex before.
+        std::unordered_map<int, std::vector<long>> startsForTrackerId;
+        
+        // Store a track (or a vertex of a simplified trajectory).
+        void storeTrack(const Track& track);
+        
+        // Store the vertices of every trajectory the simplifier still has open.
+        void finishSimplification();
     public:
         TrackerLog(bool compress = false);
+        ~TrackerLog();
         
         // Update the tracker log with the latest info for some tracker.
         void addTrack(int trackerId, int x, int y, long frameNumber);
         
         // Output the log to the given file as JSON.
-        void logToFile(std::ofstream& outputStream);
+        void logToFile(AsyncIO::Sink& outputFile);
         
         // Set the frame dimensions.
         void setDimensions(int width, int height);
+        
+        // Keep only the last maxFrames frames or maxBytes of tracks in memory (0 means no limit
+        // for either). Older tracks are written to rolling segment files starting with
+        // segmentPrefix. Use the merger mode to turn the segments back into JSON.
+        void setRetention(long maxFrames,
+                          size_t maxBytes,
+                          const std::string& segmentPrefix,
+                          size_t maxSegmentBytes = 64 * 1024 * 1024);
+        
+        // Write every track still in memory to the segment files.
+        void flushToSegments();
+        
+        // Only store the vertices needed to reconstruct each trajectory within tolerance
+        // pixels. This must be called before setRetention().
+        void setSimplification(double tolerance, size_t maxWindow = 100);
+        
+        // Mark the tracks being added as already simplified (e.g. when merging segments).
+        void markSimplified();
+        
+        // Mark the vertex of a tracker on the given frame as the start of a trajectory.
+        void markTrajectoryStart(int trackerId, long frameNumber);
+        
+        // Read a log written by logToFile(). The tracks of a simplified log are interpolated
+        // back to one per frame of each trajectory, unless interpolate is false. Each
+        // tracker's tracks are contiguous and in frame order. If startsTrajectory is given,
+        // it is filled with whether each track starts a trajectory: the first track of a
+        // tracker, the ones listed in "starts" in a simplified log, and the ones after a gap
+        // in the frames otherwise. Returns false if the file can't be read.
+        static bool readFromFile(const std::string& path,
+                                 std::vector<Track>& tracks,
+                                 int& width,
+                                 int& height,
+                                 bool interpolate = true,
+                                 std::vector<bool>* startsTrajectory = nullptr);
     };
 }
 
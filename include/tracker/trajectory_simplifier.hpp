@@ -0,0 +1,61 @@
+#ifndef trajectory_simplifier_h
+#define trajectory_simplifier_h
+
+#include <unordered_map>
+#include <vector>
+
+#include "tracker/tracker_log.hpp"
+
+namespace OT {
+    /**
+     * Simplifies trajectories as they are recorded, keeping only the vertices needed to
+     * reconstruct every track within a pixel tolerance. It uses an opening window per
+     * tracker: points are buffered as long as the segment from the last vertex to the
+     * newest point stays within the tolerance of each buffered point, measured at the
+     * same frame (the synchronized Euclidean distance, so that standing still and moving
+     * along the same line are told apart). When it doesn't, the previous point becomes a
+     * vertex. Windows are capped at maxWindow points to bound the work per point.
+     */
+    class TrajectorySimplifier {
+    private:
+        // The tolerance, in pixels.
+        double tolerance;
+        
+        // The maximum number of points buffered for a tracker.
+        size_t maxWindow;
+        
+        // The last vertex of a tracker, and the points after it that have not been decided.
+        struct Window {
+            Track anchor;
+            std::vector<Track> points;
+        };
+        std::unordered_map<int, Window> windowForTrackerId;
+        
+        // Whether every point is within the tolerance of the segment from anchor to end.
+        bool fits(const Track& anchor, const Track& end, const std::vector<Track>& points) const;
+    public:
+        TrajectorySimplifier(double tolerance, size_t maxWindow = 100);
+        
+        // Add the next point of a tracker. Points of a tracker must come in frame order.
+        // The vertices that become final are appended to vertices. Returns true if the
+        // point starts a new trajectory: the first point of a tracker, or the first after
+        // frames without one.
+        bool add(const Track& track, std::vector<Track>& vertices);
+        
+        // End the trajectories whose last point is before the given frame, appending their
+        // final vertices. If the tracker shows up again, it starts a new trajectory.
+        void finishBefore(long frameNumber, std::vector<Track>& vertices);
+        
+        // End every trajectory.
+        void finish(std::vector<Track>& vertices);
+        
+        // Expand the vertices of one tracker back to a track with a point on every frame
+        // of each of its trajectories, by linear interpolation. starts holds the frames on
+        // which a trajectory starts, which aren't joined to the vertex before them.
+        static void interpolate(const std::vector<Track>& vertices,
+                                const std::vector<long>& starts,
+                                std::vector<Track>& tracks);
+    };
+}
+
+#endif /* trajectory_simplifier_h */
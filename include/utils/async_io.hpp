@@ -0,0 +1,176 @@
+#ifndef async_io_h
+#define async_io_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace OT {
+    namespace AsyncIO {
+        class Sink;
+        
+        // A fixed-size buffer from the shared pool. When io_uring is available, the
+        // buffers are registered with the ring so that writes skip the page pinning.
+        // Buffers allocated when the pool ran dry have index -1 and are freed once written.
+        struct Buffer {
+            char* data;
+            size_t capacity;
+            int index;
+        };
+        
+        // A write or a sync of one file.
+        struct Request {
+            enum Type { Write, Sync };
+            Type type;
+            int fd;
+            Buffer* buffer;
+            size_t length;
+            off_t offset;
+            Sink* sink;
+        };
+        
+        // Carries out requests in the background and reports back to the service.
+        class Backend {
+        public:
+            virtual ~Backend() {}
+            
+            // Queue a request. It may not be started until the next flush().
+            virtual void submit(const Request& request) = 0;
+            
+            // Start every queued request.
+            virtual void flush() = 0;
+            
+            // The name of the backend, for logging.
+            virtual const char* name() const = 0;
+        };
+        
+        /**
+         * The process-wide I/O service shared by every file sink. It owns a pool of
+         * buffers and a backend: io_uring on Linux (with registered buffers and batched
+         * submissions), or a small thread pool doing pwrite/fdatasync when io_uring is
+         * unavailable (e.g. blocked in a container) or disabled with useThreadPool().
+         */
+        class Service {
+        private:
+            // The memory behind every buffer.
+            std::unique_ptr<char[]> memory;
+            
+            // The pool of buffers, and the ones that are not in use.
+            std::vector<Buffer> buffers;
+            std::vector<Buffer*> freeBuffers;
+            size_t bufferSize;
+            
+            // The buffers submitted but not yet written, which are the only ones certain to
+            // come back to the pool. The rest are being filled by sinks, which may hold on
+            // to them for as long as they like.
+            int buffersInFlight;
+            
+            // Performs the actual I/O.
+            std::unique_ptr<Backend> backend;
+            
+            // Guards the free buffers and the per-sink bookkeeping.
+            std::mutex mutex;
+            std::condition_variable condition;
+            
+            Service(size_t numBuffers, size_t bufferSize);
+        public:
+            ~Service();
+            
+            // The shared service, created on first use.
+            static Service& shared();
+            
+            // Use the thread pool backend even if io_uring is available. This must be
+            // called before the service is first used.
+            static void useThreadPool(bool enabled);
+            
+            // Take a free buffer from the pool, waiting for one if some are being written.
+            // If every buffer is held by a sink filling it, a new one is allocated instead,
+            // since waiting could then deadlock.
+            Buffer* acquire();
+            
+            // Hand a request to the backend.
+            void submit(const Request& request);
+            
+            // Make sure every submitted request has been started.
+            void flush();
+            
+            // Called by the backend when a request has finished.
+            void complete(const Request& request, bool succeeded);
+            
+            // Wait until every request of the sink has finished.
+            void waitFor(Sink* sink);
+            
+            // The name of the backend in use.
+            const char* backendName() const;
+        };
+        
+        /**
+         * A file that is written asynchronously through the shared service. Writes are
+         * copied into pooled buffers, and full buffers are written in the background, so
+         * write() only blocks while other buffers are in flight. A partly filled buffer
+         * stays with the sink until it is flushed, so a sink that writes now and then
+         * should flush after each batch. Writes and syncs of one sink are carried out in
+         * order.
+         */
+        class Sink {
+        private:
+            friend class Service;
+            
+            // The file descriptor, or -1 if the sink is not open.
+            int fd;
+            
+            // The offset in the file at which the current buffer will be written.
+            off_t offset;
+            
+            // The buffer being filled, if any.
+            Buffer* current;
+            
+            // The number of bytes in the current buffer.
+            size_t used;
+            
+            // The number of requests that have not finished. Guarded by the service.
+            int inflight;
+            
+            // Whether any request of this sink failed.
+            bool failed;
+            
+            // Write the current buffer in the background.
+            void submitCurrent();
+        public:
+            Sink();
+            ~Sink();
+            
+            Sink(const Sink&) = delete;
+            Sink& operator=(const Sink&) = delete;
+            
+            // Open the file at path, truncating it unless append is true.
+            bool open(const std::string& path, bool append = false);
+            
+            bool isOpen() const;
+            
+            // Append data to the file.
+            void write(const char* data, size_t length);
+            void write(const std::string& data);
+            
+            // Start writing whatever has been buffered.
+            void flush();
+            
+            // Flush, then sync the file to disk once every earlier write has finished.
+            // This does not wait for the sync.
+            void sync();
+            
+            // Wait for every write and sync of this sink to finish.
+            void wait();
+            
+            // Flush, wait, and close the file. Returns false if any write failed.
+            bool close();
+        };
+    }
+}
+
+#endif /* async_io_h */
@@ -0,0 +1,118 @@
+#ifndef deadline_scheduler_h
+#define deadline_scheduler_h
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+namespace OT {
+    /**
+     * Decides which stream a worker processes next. Frame k of a stream is released at
+     * start + k / fps and is due a latency target later. Among the streams whose next frame
+     * has been released, the one whose frame is due first runs first, with the latency divided by the weight of the stream, so heavier
+     * streams get their frames done sooner. When a stream keeps missing its deadlines, only
+     * every detectionInterval-th frame of it is detected (the others are just skipped), and
+     * the interval is halved again once it meets them. A stream that has fallen far behind
+     * starts counting its deadlines from now, so it can't starve the others. This class
+     * isn't thread safe.
+     */
+    class DeadlineScheduler {
+    public:
+        typedef std::chrono::steady_clock Clock;
+        
+        // A frame of a stream that a worker should process.
+        struct Task {
+            int stream;
+            long frame;
+            bool detect;
+            Clock::time_point deadline;
+        };
+        
+        struct StreamStats {
+            // The frames processed and how many of them were detected rather than skipped.
+            long frames;
+            long detected;
+            
+            // The frames finished after their deadline, overall and among the recent ones.
+            long misses;
+            double recentMissRate;
+            
+            // How late (negative if early) the last frame finished, in milliseconds.
+            double lastLatenessMs;
+            
+            // The times the deadlines had to be counted from now again.
+            long resets;
+            
+            int detectionInterval;
+        };
+    private:
+        struct Stream {
+            int id;
+            Clock::duration frameInterval;
+            Clock::duration latency;
+            double weight;
+            
+            // When frame 0 was released, and the next frame to process.
+            Clock::time_point start;
+            long nextFrame;
+            
+            // Whether a worker is processing the stream, and whether it should be scheduled
+            // at all.
+            bool running;
+            bool active;
+            
+            int detectionInterval;
+            
+            // Whether each of the recent frames missed its deadline.
+            std::deque<bool> recent;
+            
+            StreamStats stats;
+        };
+        
+        std::vector<Stream> streams;
+        
+        // Decide on the detection interval after this many frames.
+        size_t window;
+        
+        // Shed load once more than this fraction of the recent frames miss.
+        double maxMissRate;
+        
+        // The most frames detection is decimated by.
+        int maxDetectionInterval;
+        
+        Stream* find(int id);
+        const Stream* find(int id) const;
+        
+        // When the next frame of the stream is released and due, and the due time adjusted
+        // for the weight, which orders the streams.
+        Clock::time_point release(const Stream& stream) const;
+        Clock::time_point priority(const Stream& stream) const;
+    public:
+        DeadlineScheduler(size_t window = 30, double maxMissRate = 0.1, int maxDetectionInterval = 8);
+        
+        // Add a stream at the given frame rate, with a latency target in milliseconds and a
+        // weight (1 is normal), or change them.
+        void addStream(int id, double fps, double latencyMs, double weight = 1);
+        void updateStream(int id, double fps, double latencyMs, double weight);
+        
+        // Stop scheduling the stream (e.g. at its end), keeping its statistics.
+        void deactivate(int id);
+        
+        void removeStream(int id);
+        
+        // Take the frame that is due first among the frames released by now of the streams
+        // nobody is processing. Returns false if there is none.
+        bool next(Task& task, Clock::time_point now);
+        
+        // When the next frame of a stream nobody is processing is released, or
+        // Clock::time_point::max() if there is no such stream.
+        Clock::time_point nextRelease() const;
+        
+        // Account for a task that finished (or failed) at the given time.
+        void complete(const Task& task, Clock::time_point finished);
+        
+        StreamStats stats(int id) const;
+    };
+}
+
+#endif /* deadline_scheduler_h */
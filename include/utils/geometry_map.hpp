@@ -0,0 +1,83 @@
+#ifndef geometry_map_h
+#define geometry_map_h
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace OT {
+    /**
+     * All of the geometric corrections of a frame (lens undistortion, the perspective
+     * transform, and the scaling to the maximum dimension) composed into a single
+     * fixed-point remap table, so each frame is resampled once. The table is built with
+     * cv::initUndistortRectifyMap, with the perspective transform and the scaling folded
+     * into its rectification, and cached on disk because building it for a large frame
+     * takes a while.
+     */
+    class GeometryMap {
+    private:
+        // The intrinsics and distortion coefficients of the camera (identity and none
+        // without a calibration), and the frame size they were calibrated at.
+        cv::Matx33d cameraMatrix;
+        std::vector<double> distortion;
+        cv::Size calibrationSize;
+        
+        // The perspective transform of the undistorted frame (identity if there is none),
+        // and the size of the frame it produces.
+        cv::Matx33d perspective;
+        cv::Size perspectiveSize;
+        
+        // Scale the frames so that neither dimension exceeds this (-1 for no scaling).
+        int maxDimension;
+        
+        // The size of the input frames the table is for, and of the frames it produces.
+        cv::Size inputSize;
+        cv::Size outputSize;
+        
+        // The table: the integer source coordinates (CV_16SC2) and the fractional parts as
+        // an index into the interpolation table (CV_16UC1).
+        cv::Mat map1;
+        cv::Mat map2;
+        
+        // Where the table is cached (next to the calibration file), if anywhere.
+        std::string cachePath;
+        
+        // The corrected frame.
+        cv::Mat corrected;
+        
+        // The parameters the table was built with, which a cached table has to match.
+        std::vector<double> parameters() const;
+        
+        // Load the table from the cache, or save it. Loading fails if the parameters differ.
+        bool loadCache(const std::string& path);
+        void saveCache(const std::string& path) const;
+    public:
+        GeometryMap();
+        
+        // Load the camera calibration from a JSON file of the form
+        // {"image_width": w, "image_height": h, "camera_matrix": [[fx, 0, cx], [0, fy, cy], [0, 0, 1]],
+        //  "distortion_coefficients": [k1, k2, p1, p2, k3]}. Returns false if it can't be read.
+        // The table is then cached in <path>.map.
+        bool loadCalibration(const std::string& path);
+        
+        // Apply the perspective transform (in pixels of the undistorted frame) after the
+        // undistortion, producing frames of the given size.
+        void setPerspective(const cv::Mat& matrix, cv::Size size);
+        
+        // Scale the frames like Utils::scale() afterwards.
+        void setMaxDimension(int maxDimension);
+        
+        // Whether there is anything to correct besides the scaling.
+        bool isEnabled() const;
+        
+        // Build the table for input frames of the given size, or load it from the cache if
+        // it was cached with the same parameters (and cache it otherwise).
+        void prepare(cv::Size inputSize);
+        
+        // Correct the frame in one pass, building the table first if the frame size changed.
+        void correct(cv::Mat& frame);
+    };
+}
+
+#endif /* geometry_map_h */
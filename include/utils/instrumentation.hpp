@@ -0,0 +1,203 @@
+#ifndef instrumentation_h
+#define instrumentation_h
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "utils/perf_counters.hpp"
+
+namespace OT {
+    namespace Instrumentation {
+        // The stages of the pipeline that work is attributed to.
+        enum Stage {
+            // Anything outside of the other stages.
+            Other,
+            
+            // Decoding the frame.
+            Capture,
+            
+            // Correcting the geometry of the frame and scaling it.
+            Correction,
+            
+            // Finding the blobs.
+            Detection,
+            
+            // Updating the tracks.
+            Tracking,
+            
+            // The heatmap and the zones.
+            Analytics,
+            
+            // The tracker log and the journal.
+            Logging,
+            
+            // Drawing and showing the frames.
+            Display,
+            
+            NumStages
+        };
+        
+        const char* stageName(Stage stage);
+        
+        // The stage the calling thread is in.
+        Stage currentStage();
+        
+        /**
+         * Attributes the work of the calling thread to a stage while it is in scope, and
+         * restores the previous stage afterwards. When tracing, the scope is also recorded
+         * as a trace event named after the stage, and when counting hardware events, the
+         * time and events of the calling thread since its last change of stage are added to
+         * the stage being left.
+         */
+        class StageScope {
+        private:
+            Stage stage;
+            Stage previous;
+            
+            // When the scope started, in nanoseconds since tracing started, or -1 if the
+            // scope isn't being traced.
+            int64_t start;
+        public:
+            explicit StageScope(Stage stage);
+            ~StageScope();
+            
+            StageScope(const StageScope&) = delete;
+            StageScope& operator=(const StageScope&) = delete;
+        };
+        
+        /**
+         * Records a trace event for the calling thread while it is in scope, if tracing is
+         * on. This is for the steps within a stage, and for threads outside the pipeline.
+         * The name must outlive the trace (e.g. a string literal).
+         */
+        class TraceScope {
+        private:
+            const char* name;
+            int64_t start;
+        public:
+            explicit TraceScope(const char* name);
+            ~TraceScope();
+            
+            TraceScope(const TraceScope&) = delete;
+            TraceScope& operator=(const TraceScope&) = delete;
+        };
+        
+        // Start recording trace events into a buffer per thread that holds up to
+        // eventsPerThread events (later events are dropped), to be written to path as
+        // Chrome trace event JSON (which Perfetto also reads). SIGUSR1 then asks for the
+        // trace to be written, see pollTraceRequest().
+        void startTracing(const std::string& path, size_t eventsPerThread = 256 * 1024);
+        
+        bool tracingEnabled();
+        
+        // Name the calling thread in the trace. The name must outlive the trace.
+        void setThreadName(const char* name);
+        
+        // Write the trace recorded so far. Returns false if it couldn't be written.
+        bool writeTrace();
+        
+        // Write the trace if SIGUSR1 has been received since the last call. Signal handlers
+        // can't do I/O safely, so the pipeline calls this once per frame.
+        void pollTraceRequest();
+        
+        // Start counting the hardware events of every stage. Each thread counts its own
+        // events from its first stage on, so the work of the sinks and of the parallel
+        // workers is added to the stage they work in. Time outside of every stage is only
+        // counted on the calling thread, which should be the one running the pipeline.
+        // Returns false if there are no counters, and the stages then just aren't counted.
+        bool startPerfCounters();
+        
+        bool perfCountersEnabled();
+        
+        // The wall time and hardware events of a stage.
+        struct StageCounts {
+            uint64_t nanoseconds;
+            uint64_t events[PerfCounters::NumEvents];
+        };
+        
+        // The time the threads spent in the stage so far and the hardware events they
+        // counted meanwhile, summed over the threads. Time outside of every stage counts
+        // towards Other.
+        StageCounts stageCounts(Stage stage);
+        
+        /**
+         * Turns the stage counts into per frame statistics: the mean and the longest time
+         * per frame, and per frame means of the cycles, the instructions per cycle,
+         * and the cache and branch misses, which tell whether a stage is bound by compute
+         * or by memory.
+         */
+        class PerfReport {
+        private:
+            // The counts at the end of the previous frame.
+            StageCounts previous[NumStages];
+            
+            // The number of frames, and per stage, the totals and the longest frame.
+            long numFrames;
+            StageCounts totals[NumStages];
+            uint64_t longest[NumStages];
+        public:
+            PerfReport();
+            
+            // Account for the time and the events since the previous frame.
+            void nextFrame();
+            
+            // Print a table of the statistics.
+            void print(std::ostream& out) const;
+        };
+        
+        // Heap allocations made by one thread in one stage.
+        struct AllocationCounts {
+            uint64_t allocations;
+            uint64_t bytes;
+            uint64_t frees;
+        };
+        
+        // Whether global operator new and delete are being counted. This needs the tracker
+        // to be built with OT_ALLOC_TRACKING.
+        bool allocationTrackingEnabled();
+        
+        // The allocations the calling thread has made in the stage so far, or in every
+        // stage. Comparing these before and after a piece of code tells whether it
+        // allocated at all.
+        AllocationCounts allocations(Stage stage);
+        AllocationCounts allocations();
+        
+        // The allocations every thread has made in the stage so far.
+        AllocationCounts allThreadAllocations(Stage stage);
+        
+        /**
+         * Turns the allocation counts of every thread into per frame statistics for every
+         * stage: the mean and the most allocations and bytes per frame, and the last
+         * frame that allocated at all, which shows whether the stage reaches a steady state
+         * without allocations.
+         */
+        class AllocationReport {
+        private:
+            // The counts at the end of the previous frame, and the allocations of that frame.
+            AllocationCounts previous[NumStages];
+            AllocationCounts last[NumStages];
+            
+            // The number of frames, and per stage, the totals, the most in any one frame, and
+            // the last frame with any allocations.
+            long numFrames;
+            AllocationCounts totals[NumStages];
+            AllocationCounts most[NumStages];
+            long lastAllocatingFrame[NumStages];
+        public:
+            AllocationReport();
+            
+            // Account for the allocations made since the previous frame.
+            void nextFrame();
+            
+            // The allocations made in the stage on the last frame.
+            AllocationCounts lastFrame(Stage stage) const;
+            
+            // Print a table of the statistics.
+            void print(std::ostream& out) const;
+        };
+    }
+}
+
+#endif /* instrumentation_h */
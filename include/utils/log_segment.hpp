@@ -0,0 +1,100 @@
+#ifndef log_segment_h
+#define log_segment_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/async_io.hpp"
+
+namespace OT {
+    namespace LogSegment {
+        // The kind of log whose records are stored in a segment.
+        enum Kind : uint32_t {
+            Tracks = 1,
+            Annotations = 2,
+            
+            // The vertices of simplified trajectories.
+            SimplifiedTracks = 3
+        };
+        
+        // A single spilled log entry. Annotations use id = 0.
+        struct Record {
+            long frame;
+            int id;
+            int x;
+            int y;
+            
+            // Whether the vertex starts a trajectory of its tracker (simplified tracks only).
+            bool startsTrajectory = false;
+        };
+        
+        /**
+         * Appends chunks of records to a rolling sequence of segment files named
+         * <prefix>.000000.seg, <prefix>.000001.seg, ... Each file starts with a
+         * small header, followed by chunks of varint encoded records (frame numbers
+         * are delta encoded within a chunk). A new file is started whenever the
+         * current one grows past maxSegmentBytes. The first segment replaces every
+         * segment left behind with the same prefix.
+         */
+        class Writer {
+        private:
+            // The path prefix of the segment files.
+            std::string prefix;
+            
+            // The kind of records in this log.
+            Kind kind;
+            
+            // Start a new segment once the current one has this many bytes.
+            size_t maxSegmentBytes;
+            
+            // The index of the segment that is currently open.
+            int segmentIndex;
+            
+            // The number of bytes written to the current segment.
+            size_t segmentBytes;
+            
+            // The frame dimensions, stored in each segment header.
+            int width;
+            int height;
+            
+            // The current segment, written through the shared async I/O service.
+            AsyncIO::Sink segment;
+            
+            // Reused buffer for encoding a chunk.
+            std::string buffer;
+            
+            // Close the current segment and open the next one.
+            void rotate();
+        public:
+            Writer(const std::string& prefix,
+                   Kind kind,
+                   size_t maxSegmentBytes = 64 * 1024 * 1024);
+            
+            // Set the frame dimensions recorded in segment headers.
+            void setDimensions(int width, int height);
+            
+            // Append a chunk of records. They should be sorted by frame.
+            void writeChunk(const std::vector<Record>& records);
+            
+            // Flush and close the current segment, writing an empty one if nothing was
+            // written.
+            void close();
+        };
+        
+        // Return the path of the segment with the given index.
+        std::string segmentPath(const std::string& prefix, int index);
+        
+        /**
+         * Read every record from the segments with the given prefix, in the order they
+         * were written. Returns false if there are no segments or a segment is corrupt.
+         */
+        bool readAll(const std::string& prefix,
+                     Kind& kind,
+                     int& width,
+                     int& height,
+                     std::vector<Record>& records);
+    }
+}
+
+#endif /* log_segment_h */
@@ -0,0 +1,74 @@
+#ifndef motion_vector_reader_h
+#define motion_vector_reader_h
+
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+namespace OT {
+    /**
+     * Decodes a local video file with libavcodec, asking the decoder to export the motion
+     * vectors it already has (e.g. for H.264). Along with each frame, it returns a map with
+     * one pixel per macroblock that is set wherever something moved, which is much cheaper
+     * to look at than the pixels. This needs the tracker to be built with libav
+     * (OT_WITH_LIBAV); otherwise open() always fails.
+     */
+    class MotionVectorReader {
+    private:
+        // The demuxer, the decoder, and the index of the video stream.
+        AVFormatContext* format;
+        AVCodecContext* decoder;
+        int streamIndex;
+        
+        // The packet and decoded frame being worked on.
+        AVPacket* packet;
+        AVFrame* decoded;
+        
+        // Converts the decoded frames to BGR.
+        SwsContext* converter;
+        
+        // Whether the demuxer has run out of packets and the decoder is being drained.
+        bool draining;
+        
+        // The size of a macroblock, in pixels.
+        int blockSize;
+        
+        // Motion vectors shorter than this many pixels are ignored.
+        double minMotion;
+        
+        // The motion map of the last frame that had motion vectors. Frames without any
+        // (e.g. key frames) reuse it.
+        cv::Mat motion;
+        
+        // Decode the next frame into decoded. Returns false at the end of the video.
+        bool decodeNext();
+        
+        // Rebuild the motion map from the motion vectors of the decoded frame.
+        void updateMotion();
+    public:
+        MotionVectorReader(int blockSize = 16, double minMotion = 0.5);
+        ~MotionVectorReader();
+        
+        MotionVectorReader(const MotionVectorReader&) = delete;
+        MotionVectorReader& operator=(const MotionVectorReader&) = delete;
+        
+        // Open a local video file. Returns false if it can't be decoded (or if the tracker
+        // was built without libav).
+        bool open(const std::string& path);
+        
+        // Read the next frame as BGR, and its motion map: a CV_8U image with one pixel per
+        // macroblock, 255 where a block (or one of its neighbours) moved. Returns false at
+        // the end of the video.
+        bool read(cv::Mat& frame, cv::Mat& blocks);
+        
+        void close();
+    };
+}
+
+#endif /* motion_vector_reader_h */
@@ -0,0 +1,45 @@
+#ifndef perf_counters_h
+#define perf_counters_h
+
+#include <cstdint>
+
+namespace OT {
+    /**
+     * Hardware performance counters (cycles, instructions, cache misses and branch misses)
+     * read with perf_event_open. They count the thread that opened them, in user space
+     * only, so they work with the default perf_event_paranoid. Counters the machine doesn't have are skipped, and
+     * none are available in most containers or off Linux.
+     */
+    class PerfCounters {
+    public:
+        enum Event {
+            Cycles,
+            Instructions,
+            CacheMisses,
+            BranchMisses,
+            NumEvents
+        };
+    private:
+        // The file descriptor of each counter, or -1 if it isn't available.
+        int fds[NumEvents];
+    public:
+        PerfCounters();
+        ~PerfCounters();
+        
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+        
+        // Open the counters. Returns false, and says why, if none of them are available.
+        bool open();
+        
+        bool isAvailable(Event event) const;
+        
+        // Read the counts so far, scaled up for the time a counter wasn't scheduled when
+        // there are more counters than the hardware has. Unavailable counters read 0.
+        void read(uint64_t values[NumEvents]) const;
+        
+        void close();
+    };
+}
+
+#endif /* perf_counters_h */
@@ -0,0 +1,142 @@
+#ifndef result_bus_h
+#define result_bus_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tracker/kalman_tracker.hpp"
+
+namespace OT {
+    // The results of one frame.
+    struct ResultBatch {
+        long frameNumber;
+        int width;
+        int height;
+        std::vector<OT::TrackingOutput> predictions;
+        
+        // When the batch was published, set by the bus.
+        std::chrono::steady_clock::time_point published;
+    };
+    
+    /**
+     * Broadcasts the results of every frame from the tracking loop to any number of sinks,
+     * each running on its own thread at its own pace. The batches go through a ring of
+     * slots without locks: the producer fills the next slot in place and publishes it, and
+     * each sink copies the batch out of the slot into its own buffer (which reuses its
+     * memory from batch to batch) before handling it, so a slot is only held for the length
+     * of a copy.
+     *
+     * A blocking sink gets every batch, and the producer waits for it once it is a whole
+     * ring behind. A dropping sink never holds up the producer: when it is overtaken, it
+     * skips to the oldest batch still in the ring and counts the ones it missed. The locks
+     * are only taken to put a thread to sleep that has nothing to do.
+     *
+     * There is a single producer, and every sink must be added before the first batch is
+     * published.
+     */
+    class ResultBus {
+    public:
+        enum Policy { Block, Drop };
+        
+        struct SinkStats {
+            std::string name;
+            Policy policy;
+            
+            // The batches handled and skipped.
+            long delivered;
+            long dropped;
+            
+            // How many batches the sink is behind now and was at most.
+            long lag;
+            long maxLag;
+            
+            // The time from publishing a batch to the sink having handled it.
+            double meanLatencyMs;
+            double maxLatencyMs;
+            
+            // How long the producer waited for the sink.
+            double stalledMs;
+        };
+    private:
+        struct Slot {
+            // The sequence number of the batch in the slot, or -1 while it is being written.
+            std::atomic<long> sequence;
+            
+            // The sinks copying the batch out.
+            std::atomic<int> readers;
+            
+            ResultBatch batch;
+        };
+        
+        struct Sink {
+            std::string name;
+            Policy policy;
+            std::function<void(const ResultBatch&)> handler;
+            std::thread thread;
+            
+            // The sequence number of the next batch the sink takes.
+            std::atomic<long> cursor;
+            
+            // The statistics, written by the sink (or by the producer for the stalls).
+            std::atomic<long> delivered;
+            std::atomic<long> dropped;
+            std::atomic<long> maxLag;
+            std::atomic<int64_t> totalLatency;
+            std::atomic<int64_t> maxLatency;
+            std::atomic<int64_t> stalled;
+        };
+        
+        std::unique_ptr<Slot[]> slots;
+        size_t capacity;
+        std::vector<std::unique_ptr<Sink>> sinks;
+        
+        // The number of batches published, and whether no more will be.
+        std::atomic<long> published;
+        std::atomic<bool> closed;
+        
+        // Only used to sleep: the sinks waiting for a batch and the producer waiting for a
+        // blocking sink.
+        std::mutex mutex;
+        std::condition_variable batchAvailable;
+        std::condition_variable slotAvailable;
+        std::atomic<int> sleepingSinks;
+        std::atomic<bool> producerSleeping;
+        
+        void run(Sink& sink);
+        
+        // Whether every blocking sink is done with the slot of the batch with the sequence
+        // number.
+        bool canWrite(long sequence) const;
+    public:
+        // A ring of the given number of batches.
+        ResultBus(size_t capacity = 64);
+        ~ResultBus();
+        
+        // Start a sink that calls the handler with every batch it takes.
+        void addSink(const std::string& name, Policy policy, std::function<void(const ResultBatch&)> handler);
+        
+        // The batch to fill for the next frame, once the blocking sinks have made room for it.
+        // It holds whatever the slot last held, so every field should be set.
+        ResultBatch& prepare();
+        
+        // Hand the prepared batch to the sinks.
+        void publish();
+        
+        // Let the sinks handle what they haven't yet and stop them.
+        void close();
+        
+        std::vector<SinkStats> stats() const;
+        void print(std::ostream& out) const;
+    };
+}
+
+#endif /* result_bus_h */
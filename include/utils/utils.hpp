@@ -3,6 +3,8 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "utils/motion_vector_reader.hpp"
+
 namespace OT {
     namespace Utils {
         /**
@@ -10,6 +12,10 @@ namespace OT {
          * the "Q" key) and then trying to retrieve the next frame of the video.
          */
         bool hasFrame(cv::VideoCapture& capture);
+        /**
+         * The same for a motion vector reader, which also reads the frame and its motion map.
+         */
+        bool hasFrame(MotionVectorReader& reader, cv::Mat& frame, cv::Mat& blocks);
         /**
          * Resize the image so that neither # rows nor # cols exceed maxDimension.
          * Preserve the aspect ratio though.
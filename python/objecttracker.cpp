@@ -0,0 +1,302 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include "tracker/contour_finder.hpp"
+#include "tracker/kalman_tracker.hpp"
+#include "tracker/multi_object_tracker.hpp"
+#include "tracker/track_journal.hpp"
+#include "tracker/tracker_log.hpp"
+#include "utils/log_segment.hpp"
+
+namespace py = pybind11;
+
+namespace {
+    // A logged track, as a row of a numpy structured array.
+    struct TrackRecord {
+        int32_t tracker_id;
+        int32_t x;
+        int32_t y;
+        int64_t frame;
+    };
+    
+    // An object tracked on the current frame, as a row of a numpy structured array.
+    struct TrackedObject {
+        int32_t id;
+        int32_t x;
+        int32_t y;
+    };
+    
+    // Wrap a BGR numpy frame in a cv::Mat without copying it. The pixels of a row have to be
+    // contiguous, but the rows may be padded (e.g. a crop of a larger frame). The rows have to
+    // go forward without overlapping, since a cv::Mat can't step backwards.
+    cv::Mat wrapFrame(const py::array& frame) {
+        py::buffer_info info = frame.request();
+        if (info.format != py::format_descriptor<uint8_t>::format()) {
+            throw std::invalid_argument("Frames must be uint8");
+        }
+        if (info.ndim != 3 || info.shape[2] != 3) {
+            throw std::invalid_argument("Frames must be BGR, with a shape of (height, width, 3)");
+        }
+        if (info.strides[2] != 1 || info.strides[1] != 3) {
+            throw std::invalid_argument("The pixels of each row of a frame must be contiguous");
+        }
+        if (info.shape[0] > 1 && info.strides[0] < info.shape[1] * 3) {
+            throw std::invalid_argument("The rows of a frame must be in order and not overlap (e.g. not frame[::-1]), "
+                                        "use np.ascontiguousarray(frame)");
+        }
+        return cv::Mat(static_cast<int>(info.shape[0]),
+                       static_cast<int>(info.shape[1]),
+                       CV_8UC3,
+                       info.ptr,
+                       static_cast<size_t>(info.strides[0]));
+    }
+    
+    py::array_t<TrackRecord> toRecords(const std::vector<OT::Track>& tracks) {
+        py::array_t<TrackRecord> records(static_cast<py::ssize_t>(tracks.size()));
+        TrackRecord* data = records.mutable_data();
+        for (size_t i = 0; i < tracks.size(); i++) {
+            data[i] = TrackRecord{tracks[i].trackerId, tracks[i].x, tracks[i].y, static_cast<int64_t>(tracks[i].frameNumber)};
+        }
+        return records;
+    }
+    
+    py::array_t<TrackRecord> toRecords(const std::vector<OT::LogSegment::Record>& segmentRecords) {
+        py::array_t<TrackRecord> records(static_cast<py::ssize_t>(segmentRecords.size()));
+        TrackRecord* data = records.mutable_data();
+        for (size_t i = 0; i < segmentRecords.size(); i++) {
+            const OT::LogSegment::Record& record = segmentRecords[i];
+            data[i] = TrackRecord{record.id, record.x, record.y, static_cast<int64_t>(record.frame)};
+        }
+        return records;
+    }
+    
+    // The mass centers as an (n, 2) float32 array and the bounding boxes as an (n, 4) int32
+    // array of x, y, width and height.
+    py::tuple toDetections(const std::vector<cv::Point2f>& massCenters, const std::vector<cv::Rect>& boundingBoxes) {
+        py::array_t<float> centers({static_cast<py::ssize_t>(massCenters.size()), static_cast<py::ssize_t>(2)});
+        auto c = centers.mutable_unchecked<2>();
+        for (size_t i = 0; i < massCenters.size(); i++) {
+            c(i, 0) = massCenters[i].x;
+            c(i, 1) = massCenters[i].y;
+        }
+        py::array_t<int32_t> boxes({static_cast<py::ssize_t>(boundingBoxes.size()), static_cast<py::ssize_t>(4)});
+        auto b = boxes.mutable_unchecked<2>();
+        for (size_t i = 0; i < boundingBoxes.size(); i++) {
+            b(i, 0) = boundingBoxes[i].x;
+            b(i, 1) = boundingBoxes[i].y;
+            b(i, 2) = boundingBoxes[i].width;
+            b(i, 3) = boundingBoxes[i].height;
+        }
+        return py::make_tuple(centers, boxes);
+    }
+    
+    const char* kindName(OT::LogSegment::Kind kind) {
+        switch (kind) {
+            case OT::LogSegment::Tracks:
+                return "tracks";
+            case OT::LogSegment::Annotations:
+                return "annotations";
+            case OT::LogSegment::SimplifiedTracks:
+                return "simplified_tracks";
+        }
+        return "unknown";
+    }
+}
+
+PYBIND11_MODULE(objecttracker, m) {
+    m.doc() = "Bindings for the tracking core. Frames are passed as numpy arrays without copies, "
+              "and the work is done without the GIL, so several streams can be tracked from "
+              "Python threads at once (each with its own ContourFinder and MultiObjectTracker).";
+    
+    PYBIND11_NUMPY_DTYPE(TrackRecord, tracker_id, x, y, frame);
+    PYBIND11_NUMPY_DTYPE(TrackedObject, id, x, y);
+    
+    py::class_<OT::ContourFinder>(m, "ContourFinder")
+        .def(py::init([](int history, int mixtures, float contourSizeThreshold, int medianFilterSize, float contourMergeThreshold) {
+                 auto finder = new OT::ContourFinder(history, mixtures, contourSizeThreshold, medianFilterSize, contourMergeThreshold);
+                 finder->setShowForeground(false);
+                 return finder;
+             }),
+             py::arg("history") = 1000,
+             py::arg("mixtures") = 3,
+             py::arg("contour_size_threshold") = 0.1f,
+             py::arg("median_filter_size") = 9,
+             py::arg("contour_merge_threshold") = 0.01f)
+        .def("find",
+             [](OT::ContourFinder& finder, const py::array& frame) {
+                 cv::Mat pixels = wrapFrame(frame);
+                 std::vector<cv::Vec4i> hierarchy;
+                 std::vector<std::vector<cv::Point>> contours;
+                 std::vector<cv::Point2f> massCenters;
+                 std::vector<cv::Rect> boundingBoxes;
+                 {
+                     py::gil_scoped_release release;
+                     finder.findContours(pixels, hierarchy, contours, massCenters, boundingBoxes);
+                 }
+                 return toDetections(massCenters, boundingBoxes);
+             },
+             py::arg("frame"),
+             "Find the objects in a BGR frame of shape (height, width, 3). Returns their mass "
+             "centers as an (n, 2) float32 array and their bounding boxes as an (n, 4) int32 "
+             "array of x, y, width and height. The frame must not change until this returns.")
+        .def("suppress_rectangle",
+             [](OT::ContourFinder& finder, int x, int y, int width, int height) {
+                 finder.suppressRectangle(cv::Rect(x, y, width, height));
+             },
+             py::arg("x"), py::arg("y"), py::arg("width"), py::arg("height"))
+        .def("set_run_labeling", &OT::ContourFinder::setRunLabeling, py::arg("enabled"))
+        .def("set_tile_size", &OT::ContourFinder::setTileSize, py::arg("tile_size"))
+        .def("set_update_interval", &OT::ContourFinder::setUpdateInterval, py::arg("update_interval"))
+        .def("set_coarse_scale", &OT::ContourFinder::setCoarseScale, py::arg("coarse_scale"))
+        .def("set_region_of_interest",
+             [](OT::ContourFinder& finder, const std::vector<std::vector<std::pair<int, int>>>& polygons) {
+                 std::vector<std::vector<cv::Point>> points;
+                 for (const auto& polygon : polygons) {
+                     points.emplace_back();
+                     for (const auto& point : polygon) {
+                         points.back().emplace_back(point.first, point.second);
+                     }
+                 }
+                 finder.setRegionOfInterest(points);
+             },
+             py::arg("polygons"),
+             "Only look for objects inside these polygons, given as lists of (x, y) points.")
+        .def("load_region_of_interest", &OT::ContourFinder::loadRegionOfInterest, py::arg("path"))
+        .def("set_activity_map",
+             &OT::ContourFinder::setActivityMap,
+             py::arg("path"),
+             py::arg("warmup_frames") = 500,
+             py::arg("probe_interval") = 100)
+        .def("save_activity_map", &OT::ContourFinder::saveActivityMap);
+    
+    py::class_<OT::MultiObjectTracker>(m, "MultiObjectTracker")
+        .def(py::init([](int width,
+                         int height,
+                         long lifetimeThreshold,
+                         float distanceThreshold,
+                         long missedFramesThreshold,
+                         float dt,
+                         float magnitudeOfAccelerationNoise,
+                         int lifetimeSuppressionThreshold,
+                         float distanceSuppressionThreshold,
+                         float ageSuppressionThreshold) {
+                 return new OT::MultiObjectTracker(cv::Size(width, height),
+                                                   lifetimeThreshold,
+                                                   distanceThreshold,
+                                                   missedFramesThreshold,
+                                                   dt,
+                                                   magnitudeOfAccelerationNoise,
+                                                   lifetimeSuppressionThreshold,
+                                                   distanceSuppressionThreshold,
+                                                   ageSuppressionThreshold);
+             }),
+             py::arg("width"),
+             py::arg("height"),
+             py::arg("lifetime_threshold") = 20,
+             py::arg("distance_threshold") = 0.1f,
+             py::arg("missed_frames_threshold") = 10,
+             py::arg("dt") = 0.2f,
+             py::arg("acceleration_noise") = 0.5f,
+             py::arg("lifetime_suppression_threshold") = 20,
+             py::arg("distance_suppression_threshold") = 0.1f,
+             py::arg("age_suppression_threshold") = 2.0f)
+        .def("update",
+             [](OT::MultiObjectTracker& tracker,
+                py::array_t<float, py::array::c_style | py::array::forcecast> centers,
+                py::array_t<int32_t, py::array::c_style | py::array::forcecast> boxes) {
+                 if (centers.ndim() != 2 || centers.shape(1) != 2 || boxes.ndim() != 2 || boxes.shape(1) != 4
+                     || centers.shape(0) != boxes.shape(0)) {
+                     throw std::invalid_argument("Expected (n, 2) centers and (n, 4) boxes, as returned by ContourFinder.find");
+                 }
+                 auto c = centers.unchecked<2>();
+                 auto b = boxes.unchecked<2>();
+                 std::vector<cv::Point2f> massCenters;
+                 std::vector<cv::Rect> boundingBoxes;
+                 for (py::ssize_t i = 0; i < centers.shape(0); i++) {
+                     massCenters.emplace_back(c(i, 0), c(i, 1));
+                     boundingBoxes.emplace_back(b(i, 0), b(i, 1), b(i, 2), b(i, 3));
+                 }
+                 
+                 std::vector<OT::TrackingOutput> outputs;
+                 {
+                     py::gil_scoped_release release;
+                     tracker.update(massCenters, boundingBoxes, outputs);
+                 }
+                 
+                 py::array_t<TrackedObject> objects(static_cast<py::ssize_t>(outputs.size()));
+                 TrackedObject* data = objects.mutable_data();
+                 for (size_t i = 0; i < outputs.size(); i++) {
+                     data[i] = TrackedObject{outputs[i].id, outputs[i].location.x, outputs[i].location.y};
+                 }
+                 return objects;
+             },
+             py::arg("centers"),
+             py::arg("boxes"),
+             "Update the tracks with the detections of the next frame. Returns the objects "
+             "being tracked as a structured array with id, x and y fields.");
+    
+    m.def("read_tracker_log",
+          [](const std::string& path, bool interpolate) {
+              std::vector<OT::Track> tracks;
+              int width = 0;
+              int height = 0;
+              bool read;
+              {
+                  py::gil_scoped_release release;
+                  read = OT::TrackerLog::readFromFile(path, tracks, width, height, interpolate);
+              }
+              if (!read) {
+                  throw std::runtime_error("Problem reading the tracker log " + path);
+              }
+              return py::make_tuple(toRecords(tracks), width, height);
+          },
+          py::arg("path"),
+          py::arg("interpolate") = true,
+          "Read a JSON tracker log. Returns the tracks as a structured array with tracker_id, "
+          "x, y and frame fields (each tracker's tracks contiguous and in frame order), and "
+          "the frame width and height. Simplified logs are interpolated back to one track per "
+          "frame unless interpolate is False.");
+    
+    m.def("read_journal",
+          [](const std::string& path) {
+              std::vector<OT::Track> tracks;
+              int width = 0;
+              int height = 0;
+              {
+                  py::gil_scoped_release release;
+                  OT::TrackJournal::recover(path, tracks, width, height, false);
+              }
+              return py::make_tuple(toRecords(tracks), width, height);
+          },
+          py::arg("path"),
+          "Read the intact records of a track journal, without truncating it. Returns the "
+          "tracks like read_tracker_log.");
+    
+    m.def("read_segments",
+          [](const std::string& prefix) {
+              std::vector<OT::LogSegment::Record> records;
+              OT::LogSegment::Kind kind = OT::LogSegment::Tracks;
+              int width = 0;
+              int height = 0;
+              bool read;
+              {
+                  py::gil_scoped_release release;
+                  read = OT::LogSegment::readAll(prefix, kind, width, height, records);
+              }
+              if (!read) {
+                  throw std::runtime_error("Problem reading the segments " + prefix + ".*.seg");
+              }
+              return py::make_tuple(toRecords(records), kindName(kind), width, height);
+          },
+          py::arg("prefix"),
+          "Read the segments spilled by a log with a retention policy. Returns the records like "
+          "read_tracker_log (annotations have a tracker_id of 0), the kind of log (tracks, "
+          "annotations or simplified_tracks), and the frame width and height.");
+}
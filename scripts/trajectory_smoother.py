@@ -27,6 +27,24 @@ width = data["width"]
 height = data["height"]
 
 
+def expandTrajectory(track, starts):
+    # Simplified logs only keep the vertices of each trajectory, so interpolate the
+    # frames in between, but not across the gap before a trajectory that starts again.
+    expanded = []
+    for i in xrange(len(track) - 1):
+        (x, y, frame) = track[i]
+        (xn, yn, framen) = track[i + 1]
+        if framen in starts:
+            expanded.append(track[i])
+            continue
+        for f in xrange(frame, framen):
+            t = float(f - frame) / (framen - frame)
+            expanded.append([int(round(x + t * (xn - x))), int(round(y + t * (yn - y))), f])
+    if track:
+        expanded.append(track[-1])
+    return expanded
+
+
 def smoothTrajectory(track, sigma=51):
     global width, height
     trackNp = np.array(track, dtype=float).transpose()
@@ -86,7 +104,10 @@ indexForTrackerId = {}
 for i in xrange(len(data["trackers"])):
     tracker = data["trackers"][i]
     indexForTrackerId[tracker["trackerId"]] = i
-    trackForId[tracker["trackerId"]] = smoothTrajectory(tracker["track"])
+    track = tracker["track"]
+    if data.get("simplified", False):
+        track = expandTrajectory(track, set(tracker.get("starts", [])))
+    trackForId[tracker["trackerId"]] = smoothTrajectory(track)
 
 pointsForFrame = {}
 
@@ -0,0 +1,99 @@
+#include "analytics/occupancy_map.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "lib/json.hpp"
+#include "utils/async_io.hpp"
+
+namespace OT {
+    OccupancyMap::OccupancyMap(cv::Size frameSize,
+                               int cellSize,
+                               const std::string& snapshotPath,
+                               long snapshotInterval) {
+        this->frameSize = frameSize;
+        this->cellSize = std::max(1, cellSize);
+        this->cols = (frameSize.width + this->cellSize - 1) / this->cellSize;
+        this->rows = (frameSize.height + this->cellSize - 1) / this->cellSize;
+        this->visits = std::vector<uint32_t>(this->cols * this->rows, 0);
+        this->dwellFrames = std::vector<uint32_t>(this->cols * this->rows, 0);
+        this->numFrames = 0;
+        this->droppedFrames = 0;
+        this->lastFrameNumber = -1;
+        this->snapshotFrames = 0;
+        this->snapshotPath = snapshotPath;
+        this->snapshotInterval = snapshotInterval;
+    }
+    
+    void OccupancyMap::update(const std::vector<OT::TrackingOutput>& trackingOutputs, long frameNumber) {
+        // Weigh the frame by the frames it covers, so the dwell doesn't shrink when frames
+        // are skipped.
+        long weight = 1;
+        if (this->lastFrameNumber >= 0 && frameNumber > this->lastFrameNumber) {
+            weight = frameNumber - this->lastFrameNumber;
+        }
+        this->lastFrameNumber = frameNumber;
+        this->numFrames += weight;
+        this->droppedFrames += weight - 1;
+        this->nextCellForTrackerId.clear();
+        
+        for (const auto& output : trackingOutputs) {
+            // Predictions can drift off the frame, so ignore those.
+            int x = output.location.x;
+            int y = output.location.y;
+            if (x < 0 || y < 0 || x >= this->frameSize.width || y >= this->frameSize.height) {
+                continue;
+            }
+            int cell = (y / this->cellSize) * this->cols + x / this->cellSize;
+            this->dwellFrames[cell] += weight;
+            
+            // Count a visit when the track enters a cell it wasn't in last frame.
+            auto previous = this->cellForTrackerId.find(output.id);
+            if (previous == this->cellForTrackerId.end() || previous->second != cell) {
+                this->visits[cell]++;
+            }
+            this->nextCellForTrackerId[output.id] = cell;
+        }
+        std::swap(this->cellForTrackerId, this->nextCellForTrackerId);
+        
+        if (!this->snapshotPath.empty() && this->snapshotInterval > 0
+            && this->numFrames - this->snapshotFrames >= this->snapshotInterval) {
+            this->snapshot();
+        }
+    }
+    
+    void OccupancyMap::snapshot() {
+        if (this->snapshotPath.empty()) {
+            return;
+        }
+        this->snapshotFrames = this->numFrames;
+        
+        nlohmann::json json;
+        json["width"] = this->frameSize.width;
+        json["height"] = this->frameSize.height;
+        json["cellSize"] = this->cellSize;
+        json["cols"] = this->cols;
+        json["rows"] = this->rows;
+        json["numFrames"] = this->numFrames;
+        json["droppedFrames"] = this->droppedFrames;
+        json["visits"] = this->visits;
+        json["dwellFrames"] = this->dwellFrames;
+        
+        // Write to a temporary file and rename it, so readers never see a partial snapshot.
+        std::string temporaryPath = this->snapshotPath + ".tmp";
+        OT::AsyncIO::Sink sink;
+        if (!sink.open(temporaryPath)) {
+            return;
+        }
+        sink.write(json.dump());
+        if (sink.close()) {
+            std::rename(temporaryPath.c_str(), this->snapshotPath.c_str());
+        }
+    }
+}
@@ -0,0 +1,375 @@
+#include "analytics/track_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tracker/tracker_log.hpp"
+#include "utils/async_io.hpp"
+
+namespace OT {
+    // The index file starts with this header, followed by the nodes, the entries, and the
+    // log paths (each a uint32 length followed by the characters).
+    struct IndexHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t numNodes;
+        uint32_t numLeaves;
+        uint32_t numEntries;
+        uint32_t numLogs;
+    };
+    
+    static const char kIndexMagic[4] = {'O', 'T', 'R', 'I'};
+    static const uint32_t kIndexVersion = 1;
+    
+    // The bounds of a single entry.
+    static TrackIndex::Node boundsOf(const TrackIndex::Entry& entry) {
+        return TrackIndex::Node{std::min(entry.x0, entry.x1),
+                                std::min(entry.y0, entry.y1),
+                                std::max(entry.x0, entry.x1),
+                                std::max(entry.y0, entry.y1),
+                                entry.frame0,
+                                entry.frame1,
+                                0,
+                                0};
+    }
+    
+    static const TrackIndex::Node& boundsOf(const TrackIndex::Node& node) {
+        return node;
+    }
+    
+    // Sort items in Sort-Tile-Recursive order: into vertical slices by the x of their
+    // centers, then by the y of their centers within each slice, so that each run of
+    // capacity items is a compact tile.
+    template <typename T>
+    static void sortTiles(std::vector<T>& items, size_t capacity) {
+        auto centerX = [](const T& item) {
+            const TrackIndex::Node& bounds = boundsOf(item);
+            return static_cast<int64_t>(bounds.minX) + bounds.maxX;
+        };
+        auto centerY = [](const T& item) {
+            const TrackIndex::Node& bounds = boundsOf(item);
+            return static_cast<int64_t>(bounds.minY) + bounds.maxY;
+        };
+        std::sort(items.begin(), items.end(), [&centerX](const T& a, const T& b) {
+            return centerX(a) < centerX(b);
+        });
+        size_t numParents = (items.size() + capacity - 1) / capacity;
+        size_t numSlices = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(numParents))));
+        size_t sliceSize = std::max<size_t>(1, numSlices) * capacity;
+        for (size_t start = 0; start < items.size(); start += sliceSize) {
+            auto end = items.begin() + std::min(items.size(), start + sliceSize);
+            std::sort(items.begin() + start, end, [&centerY](const T& a, const T& b) {
+                return centerY(a) < centerY(b);
+            });
+        }
+    }
+    
+    // Make a parent for every run of capacity items, starting at item offset.
+    template <typename T>
+    static void packLevel(const std::vector<T>& items,
+                          size_t offset,
+                          size_t capacity,
+                          std::vector<TrackIndex::Node>& parents) {
+        for (size_t start = 0; start < items.size(); start += capacity) {
+            size_t count = std::min(capacity, items.size() - start);
+            TrackIndex::Node parent = boundsOf(items[start]);
+            for (size_t i = start + 1; i < start + count; i++) {
+                TrackIndex::Node bounds = boundsOf(items[i]);
+                parent.minX = std::min(parent.minX, bounds.minX);
+                parent.minY = std::min(parent.minY, bounds.minY);
+                parent.maxX = std::max(parent.maxX, bounds.maxX);
+                parent.maxY = std::max(parent.maxY, bounds.maxY);
+                parent.minFrame = std::min(parent.minFrame, bounds.minFrame);
+                parent.maxFrame = std::max(parent.maxFrame, bounds.maxFrame);
+            }
+            parent.first = static_cast<uint32_t>(offset + start);
+            parent.count = static_cast<uint32_t>(count);
+            parents.push_back(parent);
+        }
+    }
+    
+    TrackIndex::TrackIndex() {
+        this->mapping = nullptr;
+        this->mappingBytes = 0;
+        this->nodes = nullptr;
+        this->entries = nullptr;
+        this->numNodes = 0;
+        this->numLeaves = 0;
+        this->entryCount = 0;
+    }
+    
+    TrackIndex::~TrackIndex() {
+        this->close();
+    }
+    
+    bool TrackIndex::build(const std::vector<std::string>& logPaths,
+                           const std::string& indexPath,
+                           size_t nodeCapacity) {
+        nodeCapacity = std::max<size_t>(2, nodeCapacity);
+        
+        // Turn every pair of consecutive points of a trajectory into an entry. A trajectory
+        // with a single point gets an entry of its own. Simplified logs are indexed by their
+        // vertices, which describe the same path. Nothing is indexed across the gap between
+        // two trajectories of a tracker, where it wasn't seen.
+        std::vector<Entry> entries;
+        std::vector<OT::Track> tracks;
+        std::vector<bool> startsTrajectory;
+        for (size_t logIndex = 0; logIndex < logPaths.size(); logIndex++) {
+            int width = 0;
+            int height = 0;
+            tracks.clear();
+            startsTrajectory.clear();
+            if (!OT::TrackerLog::readFromFile(logPaths[logIndex], tracks, width, height, false, &startsTrajectory)) {
+                std::cerr << "Problem reading " << logPaths[logIndex] << std::endl;
+                return false;
+            }
+            for (size_t i = 0; i < tracks.size(); i++) {
+                const OT::Track& from = tracks[i];
+                bool hasNext = i + 1 < tracks.size() && !startsTrajectory[i + 1];
+                bool isFirst = startsTrajectory[i];
+                if (!hasNext && !isFirst) {
+                    continue;
+                }
+                const OT::Track& to = hasNext ? tracks[i + 1] : from;
+                entries.push_back(Entry{from.x, from.y, to.x, to.y,
+                                        from.frameNumber, to.frameNumber,
+                                        from.trackerId, static_cast<uint32_t>(logIndex)});
+            }
+        }
+        
+        // Pack the leaves, then each level above them, until there is a single root. The
+        // nodes are stored level by level, so the leaves come first and the root last.
+        std::vector<Node> nodes;
+        sortTiles(entries, nodeCapacity);
+        packLevel(entries, 0, nodeCapacity, nodes);
+        uint32_t numLeaves = static_cast<uint32_t>(nodes.size());
+        size_t levelStart = 0;
+        while (nodes.size() - levelStart > 1) {
+            std::vector<Node> level(nodes.begin() + levelStart, nodes.end());
+            sortTiles(level, nodeCapacity);
+            std::copy(level.begin(), level.end(), nodes.begin() + levelStart);
+            size_t nextLevelStart = nodes.size();
+            packLevel(level, levelStart, nodeCapacity, nodes);
+            levelStart = nextLevelStart;
+        }
+        
+        AsyncIO::Sink indexFile;
+        if (!indexFile.open(indexPath)) {
+            return false;
+        }
+        IndexHeader header;
+        std::copy(kIndexMagic, kIndexMagic + 4, header.magic);
+        header.version = kIndexVersion;
+        header.numNodes = static_cast<uint32_t>(nodes.size());
+        header.numLeaves = numLeaves;
+        header.numEntries = static_cast<uint32_t>(entries.size());
+        header.numLogs = static_cast<uint32_t>(logPaths.size());
+        indexFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        indexFile.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Node));
+        indexFile.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+        for (const auto& path : logPaths) {
+            uint32_t length = static_cast<uint32_t>(path.size());
+            indexFile.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            indexFile.write(path);
+        }
+        return indexFile.close();
+    }
+    
+    bool TrackIndex::open(const std::string& indexPath) {
+        this->close();
+        int fd = ::open(indexPath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(IndexHeader)) {
+            ::close(fd);
+            return false;
+        }
+        this->mappingBytes = static_cast<size_t>(info.st_size);
+        this->mapping = mmap(nullptr, this->mappingBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (this->mapping == MAP_FAILED) {
+            this->mapping = nullptr;
+            return false;
+        }
+        
+        const char* base = static_cast<const char*>(this->mapping);
+        const IndexHeader* header = reinterpret_cast<const IndexHeader*>(base);
+        size_t nodesOffset = sizeof(IndexHeader);
+        size_t entriesOffset = nodesOffset + static_cast<size_t>(header->numNodes) * sizeof(Node);
+        size_t pathsOffset = entriesOffset + static_cast<size_t>(header->numEntries) * sizeof(Entry);
+        if (!std::equal(kIndexMagic, kIndexMagic + 4, header->magic)
+            || header->version != kIndexVersion
+            || pathsOffset > this->mappingBytes) {
+            this->close();
+            return false;
+        }
+        this->nodes = reinterpret_cast<const Node*>(base + nodesOffset);
+        this->entries = reinterpret_cast<const Entry*>(base + entriesOffset);
+        this->numNodes = header->numNodes;
+        this->numLeaves = header->numLeaves;
+        this->entryCount = header->numEntries;
+        
+        // Check that every node points inside the index, so that a corrupt one can't send a
+        // query out of bounds. The nodes are stored level by level, so a node's children
+        // always come before it.
+        bool isValid = this->numLeaves <= this->numNodes && (this->numNodes == 0 || this->numLeaves > 0);
+        for (uint32_t i = 0; isValid && i < this->numNodes; i++) {
+            uint64_t end = static_cast<uint64_t>(this->nodes[i].first) + this->nodes[i].count;
+            isValid = i < this->numLeaves ? end <= this->entryCount : end <= i;
+        }
+        if (!isValid) {
+            this->close();
+            return false;
+        }
+        
+        // The log paths are small, so copy them out.
+        size_t offset = pathsOffset;
+        for (uint32_t i = 0; i < header->numLogs; i++) {
+            uint32_t length;
+            if (offset + sizeof(length) > this->mappingBytes) {
+                this->close();
+                return false;
+            }
+            std::memcpy(&length, base + offset, sizeof(length));
+            offset += sizeof(length);
+            if (offset + length > this->mappingBytes) {
+                this->close();
+                return false;
+            }
+            this->logPaths.push_back(std::string(base + offset, length));
+            offset += length;
+        }
+        return true;
+    }
+    
+    // Clip the segment of an entry to the frames [fromFrame, toFrame] and the rectangle
+    // [x1, x2] x [y1, y2] (Liang-Barsky). If anything is left, return the frames it spans.
+    static bool clipEntry(const TrackIndex::Entry& entry,
+                          double x1, double y1, double x2, double y2,
+                          long fromFrame, long toFrame,
+                          int64_t& firstFrame, int64_t& lastFrame) {
+        double t0 = 0;
+        double t1 = 1;
+        auto clip = [&t0, &t1](double p, double q) {
+            // The part of the segment where p * t <= q.
+            if (p == 0) {
+                return q >= 0;
+            }
+            double t = q / p;
+            if (p < 0) {
+                t0 = std::max(t0, t);
+            } else {
+                t1 = std::min(t1, t);
+            }
+            return t0 <= t1;
+        };
+        double dx = entry.x1 - entry.x0;
+        double dy = entry.y1 - entry.y0;
+        double df = static_cast<double>(entry.frame1 - entry.frame0);
+        if (!clip(-dx, entry.x0 - x1) || !clip(dx, x2 - entry.x0)
+            || !clip(-dy, entry.y0 - y1) || !clip(dy, y2 - entry.y0)
+            || !clip(-df, entry.frame0 - static_cast<double>(fromFrame))
+            || !clip(df, static_cast<double>(toFrame) - entry.frame0)) {
+            return false;
+        }
+        firstFrame = entry.frame0 + static_cast<int64_t>(std::floor(t0 * df));
+        lastFrame = entry.frame0 + static_cast<int64_t>(std::ceil(t1 * df));
+        firstFrame = std::max<int64_t>(firstFrame, fromFrame);
+        lastFrame = std::min<int64_t>(lastFrame, toFrame);
+        return true;
+    }
+    
+    void TrackIndex::query(int x1, int y1, int x2, int y2,
+                           long fromFrame,
+                           long toFrame,
+                           std::vector<Hit>& hits) const {
+        hits.clear();
+        if (this->numNodes == 0) {
+            return;
+        }
+        if (x1 > x2) {
+            std::swap(x1, x2);
+        }
+        if (y1 > y2) {
+            std::swap(y1, y2);
+        }
+        
+        // Walk the tree from the root, skipping the nodes that miss the query.
+        std::map<std::pair<uint32_t, int32_t>, Hit> hitForTrack;
+        std::vector<uint32_t> stack;
+        stack.push_back(this->numNodes - 1);
+        while (!stack.empty()) {
+            const Node& node = this->nodes[stack.back()];
+            bool isLeaf = stack.back() < this->numLeaves;
+            stack.pop_back();
+            if (node.maxX < x1 || node.minX > x2 || node.maxY < y1 || node.minY > y2
+                || node.maxFrame < fromFrame || node.minFrame > toFrame) {
+                continue;
+            }
+            if (!isLeaf) {
+                for (uint32_t i = 0; i < node.count; i++) {
+                    stack.push_back(node.first + i);
+                }
+                continue;
+            }
+            
+            // Test the segments themselves, since a box can overlap the region without the
+            // segment passing through it.
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                const Entry& entry = this->entries[i];
+                int64_t firstFrame, lastFrame;
+                if (!clipEntry(entry, x1, y1, x2, y2, fromFrame, toFrame, firstFrame, lastFrame)) {
+                    continue;
+                }
+                auto key = std::make_pair(entry.logIndex, entry.trackerId);
+                auto it = hitForTrack.find(key);
+                if (it == hitForTrack.end()) {
+                    hitForTrack[key] = Hit{entry.logIndex, entry.trackerId, firstFrame, lastFrame};
+                } else {
+                    it->second.firstFrame = std::min(it->second.firstFrame, firstFrame);
+                    it->second.lastFrame = std::max(it->second.lastFrame, lastFrame);
+                }
+            }
+        }
+        for (const auto& kv : hitForTrack) {
+            hits.push_back(kv.second);
+        }
+    }
+    
+    const std::string& TrackIndex::logPath(uint32_t logIndex) const {
+        return this->logPaths[logIndex];
+    }
+    
+    size_t TrackIndex::numEntries() const {
+        return this->entryCount;
+    }
+    
+    void TrackIndex::close() {
+        if (this->mapping != nullptr) {
+            munmap(this->mapping, this->mappingBytes);
+        }
+        this->mapping = nullptr;
+        this->mappingBytes = 0;
+        this->nodes = nullptr;
+        this->entries = nullptr;
+        this->numNodes = 0;
+        this->numLeaves = 0;
+        this->entryCount = 0;
+        this->logPaths.clear();
+    }
+}
@@ -0,0 +1,259 @@
+#include "analytics/zone_analyzer.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "lib/json.hpp"
+
+namespace OT {
+    ZoneAnalyzer::ZoneAnalyzer(cv::Size frameSize, int binSize) {
+        this->labels = cv::Mat::zeros(frameSize, CV_8U);
+        this->binSize = std::max(1, binSize);
+        this->binCols = (frameSize.width + this->binSize - 1) / this->binSize;
+        this->binRows = (frameSize.height + this->binSize - 1) / this->binSize;
+        this->binStart = std::vector<int>(this->binCols * this->binRows + 1, 0);
+        this->stamp = 0;
+    }
+    
+    bool ZoneAnalyzer::load(const std::string& configPath) {
+        std::ifstream configFile(configPath);
+        if (!configFile.is_open()) {
+            return false;
+        }
+        // Read every zone and line before keeping any, so that a malformed entry fails the
+        // whole file instead of aborting.
+        nlohmann::json config;
+        std::vector<std::string> zoneNames;
+        std::vector<std::vector<cv::Point>> zonePolygons;
+        std::vector<std::string> lineNames;
+        std::vector<cv::Point2f> lineFrom;
+        std::vector<cv::Point2f> lineTo;
+        try {
+            configFile >> config;
+            for (const auto& zone : config["zones"]) {
+                if (this->zoneNames.size() + zoneNames.size() == 254) {
+                    std::cerr << "Only 254 zones are supported, ignoring the rest" << std::endl;
+                    break;
+                }
+                std::vector<cv::Point> polygon;
+                for (const auto& pt : zone.at("polygon")) {
+                    polygon.push_back(cv::Point(pt.at(0).get<int>(), pt.at(1).get<int>()));
+                }
+                zoneNames.push_back(zone.at("name").get<std::string>());
+                zonePolygons.push_back(polygon);
+            }
+            for (const auto& line : config["lines"]) {
+                lineNames.push_back(line.at("name").get<std::string>());
+                lineFrom.push_back(cv::Point2f(line.at("from").at(0).get<float>(), line.at("from").at(1).get<float>()));
+                lineTo.push_back(cv::Point2f(line.at("to").at(0).get<float>(), line.at("to").at(1).get<float>()));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Problem parsing " << configPath << ": " << e.what() << std::endl;
+            return false;
+        }
+        
+        // Rasterize the zones. Where zones overlap, the later one wins.
+        for (size_t i = 0; i < zoneNames.size(); i++) {
+            this->zoneNames.push_back(zoneNames[i]);
+            std::vector<std::vector<cv::Point>> polygons = {zonePolygons[i]};
+            cv::fillPoly(this->labels, polygons, cv::Scalar::all(this->zoneNames.size()));
+        }
+        this->lineNames.insert(this->lineNames.end(), lineNames.begin(), lineNames.end());
+        this->lineFrom.insert(this->lineFrom.end(), lineFrom.begin(), lineFrom.end());
+        this->lineTo.insert(this->lineTo.end(), lineTo.begin(), lineTo.end());
+        
+        // Bin the lines by the cells their bounding boxes overlap. First count the lines in
+        // each bin, then fill them in.
+        auto forEachBin = [this](size_t line, std::function<void(int)> callback) {
+            int x0 = std::min(this->lineFrom[line].x, this->lineTo[line].x) / this->binSize;
+            int x1 = std::max(this->lineFrom[line].x, this->lineTo[line].x) / this->binSize;
+            int y0 = std::min(this->lineFrom[line].y, this->lineTo[line].y) / this->binSize;
+            int y1 = std::max(this->lineFrom[line].y, this->lineTo[line].y) / this->binSize;
+            for (int by = std::max(0, y0); by <= std::min(this->binRows - 1, y1); by++) {
+                for (int bx = std::max(0, x0); bx <= std::min(this->binCols - 1, x1); bx++) {
+                    callback(by * this->binCols + bx);
+                }
+            }
+        };
+        std::vector<int> counts(this->binCols * this->binRows, 0);
+        for (size_t i = 0; i < this->lineNames.size(); i++) {
+            forEachBin(i, [&counts](int bin) { counts[bin]++; });
+        }
+        this->binStart[0] = 0;
+        for (size_t bin = 0; bin < counts.size(); bin++) {
+            this->binStart[bin + 1] = this->binStart[bin] + counts[bin];
+        }
+        this->binLines = std::vector<int>(this->binStart.back());
+        std::vector<int> fill(this->binStart.begin(), this->binStart.end() - 1);
+        for (size_t i = 0; i < this->lineNames.size(); i++) {
+            forEachBin(i, [this, &fill, i](int bin) { this->binLines[fill[bin]++] = i; });
+        }
+        
+        this->lineStamp = std::vector<long>(this->lineNames.size(), -1);
+        this->entersForZone = std::vector<long>(this->zoneNames.size(), 0);
+        this->exitsForZone = std::vector<long>(this->zoneNames.size(), 0);
+        this->forwardCrossingsForLine = std::vector<long>(this->lineNames.size(), 0);
+        this->backwardCrossingsForLine = std::vector<long>(this->lineNames.size(), 0);
+        return true;
+    }
+    
+    bool ZoneAnalyzer::openEventFile(const std::string& path) {
+        return this->eventFile.open(path);
+    }
+    
+    int ZoneAnalyzer::zoneAt(cv::Point pt) const {
+        if (pt.x < 0 || pt.y < 0 || pt.x >= this->labels.cols || pt.y >= this->labels.rows) {
+            return 0;
+        }
+        return this->labels.at<uchar>(pt.y, pt.x);
+    }
+    
+    // The cross product (b - a) x (c - a). In image coordinates it is positive when c is to the
+    // right of the line from a to b.
+    static float orientation(cv::Point2f a, cv::Point2f b, cv::Point2f c) {
+        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    }
+    
+    void ZoneAnalyzer::findCrossings(cv::Point a, cv::Point b, int trackerId, long frame, std::vector<ZoneEvent>& events) {
+        if (this->lineNames.empty() || a == b) {
+            return;
+        }
+        this->stamp++;
+        
+        // Visit the bins overlapped by the movement's bounding box.
+        int bx0 = std::max(0, std::min(a.x, b.x) / this->binSize);
+        int bx1 = std::min(this->binCols - 1, std::max(a.x, b.x) / this->binSize);
+        int by0 = std::max(0, std::min(a.y, b.y) / this->binSize);
+        int by1 = std::min(this->binRows - 1, std::max(a.y, b.y) / this->binSize);
+        for (int by = by0; by <= by1; by++) {
+            for (int bx = bx0; bx <= bx1; bx++) {
+                int bin = by * this->binCols + bx;
+                for (int k = this->binStart[bin]; k < this->binStart[bin + 1]; k++) {
+                    int line = this->binLines[k];
+                    if (this->lineStamp[line] == this->stamp) {
+                        continue;
+                    }
+                    this->lineStamp[line] = this->stamp;
+                    
+                    // The movement crosses the line if its endpoints are on different sides
+                    // of the line, and the line's endpoints are not both on one side of the
+                    // movement. A point exactly on the line counts as being on its left, so
+                    // a track stopping on the line is counted once, when it leaves that side.
+                    cv::Point2f p = this->lineFrom[line];
+                    cv::Point2f q = this->lineTo[line];
+                    bool rightA = orientation(p, q, a) > 0;
+                    bool rightB = orientation(p, q, b) > 0;
+                    float sideP = orientation(a, b, p);
+                    float sideQ = orientation(a, b, q);
+                    if (rightA == rightB || (sideP > 0 && sideQ > 0) || (sideP < 0 && sideQ < 0)) {
+                        continue;
+                    }
+                    events.push_back(ZoneEvent{ZoneEvent::Cross, trackerId, frame, line, rightB ? 1 : -1});
+                }
+            }
+        }
+    }
+    
+    void ZoneAnalyzer::update(const std::vector<OT::TrackingOutput>& trackingOutputs,
+                              long frameNumber,
+                              std::vector<ZoneEvent>& events) {
+        events.clear();
+        this->nextStateForTrackerId.clear();
+        
+        for (const auto& output : trackingOutputs) {
+            int zone = this->zoneAt(output.location);
+            auto previous = this->stateForTrackerId.find(output.id);
+            if (previous == this->stateForTrackerId.end()) {
+                // A new track that starts inside a zone enters it.
+                if (zone != 0) {
+                    events.push_back(ZoneEvent{ZoneEvent::Enter, output.id, frameNumber, zone - 1, 0});
+                }
+            } else {
+                const TrackState& state = previous->second;
+                if (zone != state.zone) {
+                    if (state.zone != 0) {
+                        events.push_back(ZoneEvent{ZoneEvent::Exit, output.id, frameNumber, state.zone - 1, 0});
+                    }
+                    if (zone != 0) {
+                        events.push_back(ZoneEvent{ZoneEvent::Enter, output.id, frameNumber, zone - 1, 0});
+                    }
+                }
+                this->findCrossings(state.position, output.location, output.id, frameNumber, events);
+                this->stateForTrackerId.erase(previous);
+            }
+            this->nextStateForTrackerId[output.id] = TrackState{output.location, zone};
+        }
+        
+        // The tracks that are left have disappeared, so they exit their zones.
+        for (const auto& kv : this->stateForTrackerId) {
+            if (kv.second.zone != 0) {
+                events.push_back(ZoneEvent{ZoneEvent::Exit, kv.first, frameNumber, kv.second.zone - 1, 0});
+            }
+        }
+        std::swap(this->stateForTrackerId, this->nextStateForTrackerId);
+        
+        for (const auto& event : events) {
+            this->record(event);
+        }
+    }
+    
+    void ZoneAnalyzer::record(const ZoneEvent& event) {
+        std::string type;
+        std::string name;
+        switch (event.type) {
+            case ZoneEvent::Enter:
+                this->entersForZone[event.index]++;
+                type = "enter";
+                name = this->zoneNames[event.index];
+                break;
+            case ZoneEvent::Exit:
+                this->exitsForZone[event.index]++;
+                type = "exit";
+                name = this->zoneNames[event.index];
+                break;
+            case ZoneEvent::Cross:
+                if (event.direction > 0) {
+                    this->forwardCrossingsForLine[event.index]++;
+                } else {
+                    this->backwardCrossingsForLine[event.index]++;
+                }
+                type = "cross";
+                name = this->lineNames[event.index];
+                break;
+        }
+        
+        if (this->eventFile.isOpen()) {
+            nlohmann::json json;
+            json["frame"] = event.frame;
+            json["trackerId"] = event.trackerId;
+            json["event"] = type;
+            json[event.type == ZoneEvent::Cross ? "line" : "zone"] = name;
+            if (event.type == ZoneEvent::Cross) {
+                json["direction"] = event.direction;
+            }
+            this->eventFile.write(json.dump() + "\n");
+        }
+    }
+    
+    void ZoneAnalyzer::printSummary(std::ostream& output) const {
+        for (size_t i = 0; i < this->zoneNames.size(); i++) {
+            output << "Zone " << this->zoneNames[i] << ": " << this->entersForZone[i] << " enters, "
+                   << this->exitsForZone[i] << " exits" << std::endl;
+        }
+        for (size_t i = 0; i < this->lineNames.size(); i++) {
+            output << "Line " << this->lineNames[i] << ": " << this->forwardCrossingsForLine[i] << " forward, "
+                   << this->backwardCrossingsForLine[i] << " backward" << std::endl;
+        }
+    }
+    
+    void ZoneAnalyzer::close() {
+        this->eventFile.close();
+    }
+}
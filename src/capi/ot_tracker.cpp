@@ -0,0 +1,211 @@
+#include "capi/ot_tracker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "tracker/contour_finder.hpp"
+#include "tracker/kalman_tracker.hpp"
+#include "tracker/multi_object_tracker.hpp"
+
+struct ot_tracker {
+    // Serializes the calls on the handle.
+    std::mutex mutex;
+    
+    ot_tracker_config config;
+    OT::ContourFinder contourFinder;
+    
+    // Created with the first frame, once the frame size is known.
+    std::unique_ptr<OT::MultiObjectTracker> tracker;
+    cv::Size frameSize;
+    
+    // Frames in other formats are converted to BGR in here.
+    cv::Mat converted;
+    
+    // The detections and the tracks of the last frame, kept so that their storage is reused.
+    std::vector<cv::Vec4i> hierarchy;
+    std::vector<std::vector<cv::Point>> contours;
+    std::vector<cv::Point2f> massCenters;
+    std::vector<cv::Rect> boundingBoxes;
+    std::vector<OT::TrackingOutput> trackingOutputs;
+    
+    ot_tracker(const ot_tracker_config& config)
+    : config(config), contourFinder(config.history, config.mixtures) {
+        this->contourFinder.setShowForeground(false);
+        this->contourFinder.setTileSize(config.tile_size);
+        this->contourFinder.setUpdateInterval(config.update_interval);
+        this->contourFinder.setCoarseScale(config.coarse_scale);
+        this->contourFinder.setRunLabeling(config.run_labeling != 0);
+    }
+};
+
+namespace {
+    int channelsOf(ot_pixel_format format) {
+        switch (format) {
+            case OT_PIXEL_BGR24:
+            case OT_PIXEL_RGB24:
+                return 3;
+            case OT_PIXEL_BGRA32:
+            case OT_PIXEL_RGBA32:
+                return 4;
+            case OT_PIXEL_GRAY8:
+                return 1;
+        }
+        return 0;
+    }
+    
+    bool isValid(const ot_tracker_config& config) {
+        return config.history > 0
+            && config.mixtures > 0
+            && config.tile_size >= 0
+            && config.update_interval > 0
+            && config.coarse_scale > 0
+            && config.lifetime_threshold >= 0
+            && config.missed_frames_threshold > 0
+            && config.distance_threshold > 0;
+    }
+}
+
+extern "C" {
+    uint32_t ot_api_version(void) {
+        return OT_API_VERSION;
+    }
+    
+    void ot_tracker_config_init(ot_tracker_config* config) {
+        if (config == nullptr) {
+            return;
+        }
+        std::memset(config, 0, sizeof(*config));
+        config->struct_size = sizeof(*config);
+        config->history = 1000;
+        config->mixtures = 3;
+        config->tile_size = 0;
+        config->update_interval = 1;
+        config->coarse_scale = 1;
+        config->run_labeling = 0;
+        config->lifetime_threshold = 20;
+        config->missed_frames_threshold = 10;
+        config->distance_threshold = 0.1f;
+    }
+    
+    ot_tracker* ot_tracker_create(const ot_tracker_config* config) {
+        // Start from the defaults, so a configuration from an older header (which is
+        // shorter) still gets sensible values for the fields it doesn't know about.
+        ot_tracker_config merged;
+        ot_tracker_config_init(&merged);
+        if (config != nullptr) {
+            if (config->struct_size < sizeof(uint32_t)) {
+                return nullptr;
+            }
+            std::memcpy(&merged, config, std::min<size_t>(config->struct_size, sizeof(merged)));
+            merged.struct_size = sizeof(merged);
+        }
+        if (!isValid(merged)) {
+            return nullptr;
+        }
+        try {
+            return new ot_tracker(merged);
+        } catch (...) {
+            return nullptr;
+        }
+    }
+    
+    ot_status ot_tracker_process_frame(ot_tracker* tracker,
+                                       const uint8_t* pixels,
+                                       int32_t width,
+                                       int32_t height,
+                                       size_t stride,
+                                       ot_pixel_format format) {
+        int channels = channelsOf(format);
+        if (tracker == nullptr || pixels == nullptr || width <= 0 || height <= 0 || channels == 0
+            || stride < static_cast<size_t>(width) * channels) {
+            return OT_ERROR_INVALID_ARGUMENT;
+        }
+        
+        std::lock_guard<std::mutex> lock(tracker->mutex);
+        try {
+            cv::Size size(width, height);
+            if (tracker->tracker == nullptr) {
+                tracker->frameSize = size;
+                tracker->tracker = std::make_unique<OT::MultiObjectTracker>(size,
+                                                                            tracker->config.lifetime_threshold,
+                                                                            tracker->config.distance_threshold,
+                                                                            tracker->config.missed_frames_threshold);
+            } else if (size != tracker->frameSize) {
+                return OT_ERROR_FRAME_SIZE;
+            }
+            
+            // Read BGR frames in place, and convert the others.
+            cv::Mat input(height, width, CV_8UC(channels), const_cast<uint8_t*>(pixels), stride);
+            const cv::Mat* frame = &input;
+            if (format != OT_PIXEL_BGR24) {
+                int conversion = cv::COLOR_GRAY2BGR;
+                if (format == OT_PIXEL_RGB24) {
+                    conversion = cv::COLOR_RGB2BGR;
+                } else if (format == OT_PIXEL_BGRA32) {
+                    conversion = cv::COLOR_BGRA2BGR;
+                } else if (format == OT_PIXEL_RGBA32) {
+                    conversion = cv::COLOR_RGBA2BGR;
+                }
+                cv::cvtColor(input, tracker->converted, conversion);
+                frame = &tracker->converted;
+            }
+            
+            tracker->contourFinder.findContours(*frame,
+                                                tracker->hierarchy,
+                                                tracker->contours,
+                                                tracker->massCenters,
+                                                tracker->boundingBoxes);
+            
+            // Tracks are reported without their trajectories, so don't copy them.
+            tracker->tracker->update(tracker->massCenters,
+                                     tracker->boundingBoxes,
+                                     tracker->trackingOutputs,
+                                     false);
+        } catch (const std::exception&) {
+            return OT_ERROR_INTERNAL;
+        } catch (...) {
+            return OT_ERROR_INTERNAL;
+        }
+        return OT_OK;
+    }
+    
+    ot_status ot_tracker_get_tracks(ot_tracker* tracker, ot_track* tracks, size_t capacity, size_t* count) {
+        if (tracker == nullptr || count == nullptr || (tracks == nullptr && capacity > 0)) {
+            return OT_ERROR_INVALID_ARGUMENT;
+        }
+        std::lock_guard<std::mutex> lock(tracker->mutex);
+        const std::vector<OT::TrackingOutput>& outputs = tracker->trackingOutputs;
+        size_t copied = std::min(capacity, outputs.size());
+        for (size_t i = 0; i < copied; i++) {
+            tracks[i].id = outputs[i].id;
+            tracks[i].x = outputs[i].location.x;
+            tracks[i].y = outputs[i].location.y;
+        }
+        *count = outputs.size();
+        return OT_OK;
+    }
+    
+    void ot_tracker_destroy(ot_tracker* tracker) {
+        delete tracker;
+    }
+    
+    const char* ot_status_string(ot_status status) {
+        switch (status) {
+            case OT_OK:
+                return "ok";
+            case OT_ERROR_INVALID_ARGUMENT:
+                return "invalid argument";
+            case OT_ERROR_FRAME_SIZE:
+                return "the frame size changed";
+            case OT_ERROR_INTERNAL:
+                return "internal error";
+        }
+        return "unknown status";
+    }
+}
@@ -1,21 +1,60 @@
 #include "ground_truth/ground_truth_log.hpp"
 
 #include <vector>
+#include <string>
+#include <algorithm>
 
 namespace OT {
     namespace GroundTruth {
         Log::Log() {
             this->log = std::vector<OT::GroundTruth::Annotation>();
+            this->spill = nullptr;
+            this->maxAnnotationsInMemory = 0;
         }
         
         void Log::addAnnotation(OT::GroundTruth::Annotation annotation) {
             this->log.push_back(annotation);
+            
+            // Spill the older half of the log at once so that spills are rare.
+            if (this->spill != nullptr && this->log.size() > this->maxAnnotationsInMemory) {
+                this->spillOldest(std::max<size_t>(1, this->log.size() / 2));
+            }
+        }
+        
+        void Log::setRetention(size_t maxAnnotations,
+                               const std::string& segmentPrefix,
+                               size_t maxSegmentBytes) {
+            this->maxAnnotationsInMemory = maxAnnotations;
+            this->spill = std::make_unique<OT::LogSegment::Writer>(segmentPrefix,
+                                                                   OT::LogSegment::Annotations,
+                                                                   maxSegmentBytes);
+        }
+        
+        void Log::spillOldest(size_t count) {
+            std::vector<OT::LogSegment::Record> chunk;
+            for (size_t i = 0; i < count; i++) {
+                chunk.push_back(OT::LogSegment::Record{this->log[i].frame, 0, this->log[i].x, this->log[i].y});
+            }
+            this->spill->writeChunk(chunk);
+            this->log.erase(this->log.begin(), this->log.begin() + count);
+        }
+        
+        void Log::flushToSegments() {
+            if (this->spill == nullptr) {
+                return;
+            }
+            this->spillOldest(this->log.size());
+            this->spill->close();
         }
         
-        void Log::writeToStream(std::ofstream& outputStream) {
+        void Log::writeToStream(OT::AsyncIO::Sink& outputFile) {
+            // Format every line into one string instead of flushing line by line.
+            std::string output;
             for (auto annotation : this->log) {
-                outputStream << annotation.frame << "," << annotation.x << "," << annotation.y << std::endl;
+                output += std::to_string(annotation.frame) + "," + std::to_string(annotation.x) + ","
+                    + std::to_string(annotation.y) + "\n";
             }
+            outputFile.write(output);
         }
     }
 }
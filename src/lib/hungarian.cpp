@@ -1,11 +1,14 @@
 #include "lib/hungarian.hpp"
 
+#include <algorithm>
+
 #define DBL_MAX 100000
 
 using namespace std;
 
 AssignmentProblemSolver::AssignmentProblemSolver()
 {
+    flagBufferSize = 0;
 }
 
 AssignmentProblemSolver::~AssignmentProblemSolver()
@@ -17,10 +20,9 @@ double AssignmentProblemSolver::Solve(vector<vector<double> >& DistMatrix,vector
     int N=DistMatrix.size(); // number of columns (tracks)
     int M=DistMatrix[0].size(); // number of rows (measurements)
     
-    int *assignment		=new int[N];
-    double *distIn		=new double[N*M];
+    distInBuffer.resize(N*M);
+    double *distIn		=distInBuffer.data();
     
-    double  cost;
     // Fill matrix with random numbers
     for(int i=0; i<N; i++)
     {
@@ -29,6 +31,31 @@ double AssignmentProblemSolver::Solve(vector<vector<double> >& DistMatrix,vector
             distIn[i+N*j] = DistMatrix[i][j];
         }
     }
+    return solveBuffered(N, M, Assignment, Method);
+}
+
+double AssignmentProblemSolver::Solve(const vector<double>& DistMatrix,int N,int M,vector<int>& Assignment,TMethod Method)
+{
+    distInBuffer.resize(N*M);
+    double *distIn		=distInBuffer.data();
+    
+    for(int i=0; i<N; i++)
+    {
+        for(int j=0; j<M; j++)
+        {
+            distIn[i+N*j] = DistMatrix[i*M+j];
+        }
+    }
+    return solveBuffered(N, M, Assignment, Method);
+}
+
+double AssignmentProblemSolver::solveBuffered(int N, int M, vector<int>& Assignment, TMethod Method)
+{
+    assignmentBuffer.resize(N);
+    int *assignment		=assignmentBuffer.data();
+    double *distIn		=distInBuffer.data();
+    
+    double  cost;
     switch(Method)
     {
         case optimal: assignmentoptimal(assignment, &cost, distIn, N, M); break;
@@ -45,8 +72,6 @@ double AssignmentProblemSolver::Solve(vector<vector<double> >& DistMatrix,vector
         Assignment.push_back(assignment[x]);
     }
     
-    delete[] assignment;
-    delete[] distIn;
     return cost;
 }
 // --------------------------------------------------------------------------
@@ -84,8 +109,9 @@ void AssignmentProblemSolver::assignmentoptimal(int *assignment, double *cost, d
     
     // Total elements number
     nOfElements   = nOfRows * nOfColumns;
-    // Memory allocation
-    distMatrix    = (double *)malloc(nOfElements * sizeof(double));
+    // Memory allocation (reused from the previous call when it is large enough)
+    distMatrixBuffer.resize(nOfElements);
+    distMatrix    = distMatrixBuffer.data();
     // Pointer to last element
     distMatrixEnd = distMatrix + nOfElements;
     
@@ -100,12 +126,19 @@ void AssignmentProblemSolver::assignmentoptimal(int *assignment, double *cost, d
         distMatrix[row] = value;
     }
     
-    // Memory allocation
-    coveredColumns = (bool *)calloc(nOfColumns,  sizeof(bool));
-    coveredRows    = (bool *)calloc(nOfRows,     sizeof(bool));
-    starMatrix     = (bool *)calloc(nOfElements, sizeof(bool));
-    primeMatrix    = (bool *)calloc(nOfElements, sizeof(bool));
-    newStarMatrix  = (bool *)calloc(nOfElements, sizeof(bool)); /* used in step4 */
+    // Memory allocation (one cleared block for all the flags, reused like the above)
+    size_t nOfFlags = nOfColumns + nOfRows + 3 * (size_t)nOfElements;
+    if(nOfFlags > flagBufferSize)
+    {
+        flagBuffer.reset(new bool[nOfFlags]);
+        flagBufferSize = nOfFlags;
+    }
+    std::fill(flagBuffer.get(), flagBuffer.get() + nOfFlags, false);
+    coveredColumns = flagBuffer.get();
+    coveredRows    = coveredColumns + nOfColumns;
+    starMatrix     = coveredRows + nOfRows;
+    primeMatrix    = starMatrix + nOfElements;
+    newStarMatrix  = primeMatrix + nOfElements; /* used in step4 */
     
     /* preliminary steps */
     if(nOfRows <= nOfColumns)
@@ -202,13 +235,6 @@ void AssignmentProblemSolver::assignmentoptimal(int *assignment, double *cost, d
     step2b(assignment, distMatrix, starMatrix, newStarMatrix, primeMatrix, coveredColumns, coveredRows, nOfRows, nOfColumns, minDim);
     /* compute cost and remove invalid assignments */
     computeassignmentcost(assignment, cost, distMatrixIn, nOfRows);
-    /* free allocated memory */
-    free(distMatrix);
-    free(coveredColumns);
-    free(coveredRows);
-    free(starMatrix);
-    free(primeMatrix);
-    free(newStarMatrix);
     return;
 }
 // --------------------------------------------------------------------------
@@ -1,38 +1,98 @@
 #include "modes/tracking_mode.hpp"
 #include "modes/plotting_mode.hpp"
 #include "modes/ground_truth_mode.hpp"
+#include "modes/merging_mode.hpp"
+#include "modes/indexing_mode.hpp"
+#include "modes/serving_mode.hpp"
 
 #include <string>
 
 #include "lib/cmdparser.hpp"
+#include "utils/async_io.hpp"
 
 int main(int argc, char **argv) {
     // Parse the command line arguments.
     cli::Parser parser(argc, argv);
-    parser.set_required<std::string>("m", "The mode that the tracker should be run in: either tracker, plotter, ground_truth");
+    parser.set_required<std::string>("m", "The mode that the tracker should be run in: either tracker, plotter, ground_truth, merger, index, serve");
     
     // Arguments common to all modes.
     parser.set_required<std::string>("i", "input video");
     parser.set_optional<std::vector<int>>("p", "perspective_points", std::vector<int>(), "The perspective points");
     parser.set_optional<int>("d", "max_dimension", -1, "Scale the video so that the # rows and # cols do not exceed this value. Preserve the aspect ratio.");
+    parser.set_optional<std::string>("c", "calibration", "", "A JSON file with the camera matrix and distortion coefficients of the camera. The frames are undistorted, along with the perspective transform (whose points are then in the undistorted frame) and the scaling, in a single remap that is cached next to the file.");
     parser.set_optional<std::string>("s", "support_file", "", "Path to the support file. If you're in tracker mode, this is the output JSON file for the tracker. If you're in plotter mode, this is the path to the tracks file, which is a (timestamp, x, y, frame) CSV");
     
+    // Arguments for bounded-retention logging (tracker and ground_truth modes).
+    parser.set_optional<int>("rf", "retain_frames", 0, "Keep only this many frames (annotations in ground_truth mode) of the log in memory, and spill older ones to segment files prefixed by the support file. Run the merger mode to get the standard output.");
+    parser.set_optional<int>("rm", "retain_megabytes", 0, "Keep only this many megabytes of the tracker log in memory, and spill older tracks to segment files prefixed by the support file.");
+    parser.set_optional<int>("sm", "segment_megabytes", 64, "Start a new segment file once the current one reaches this many megabytes.");
+    
+    // Arguments for trajectory simplification (tracker mode).
+    parser.set_optional<double>("ts", "simplify_tolerance", 0, "Only log the vertices needed to reconstruct each trajectory within this many pixels (0 logs every frame).");
+    parser.set_optional<int>("tw", "simplify_window", 100, "The most points the simplifier considers at once for a trajectory.");
+    
+    parser.set_optional<std::string>("io", "io_backend", "uring", "How output files are written in the background: uring (io_uring, falling back to threads if it is unavailable) or threads.");
+    
     // Arguments for tracker mode.
     parser.set_optional<int>("w", "webcam", -1, "number to use (this will override -i)");
     
+    parser.set_optional<bool>("rl", "run_labeling", false, "Find blobs by labeling runs of foreground pixels instead of tracing contours (faster for sparse foregrounds).");
+    
+    parser.set_optional<std::string>("roi", "region_of_interest", "", "A JSON file with the polygons to look for objects in. Everything else is ignored, and tiles outside of them are never processed.");
+    parser.set_optional<int>("tl", "tile_size", 0, "Model the background in square tiles of this many pixels (0 for the whole frame, or 64 with a region of interest).");
+    parser.set_optional<int>("bu", "background_update", 1, "Only update the background model every this many frames (the tiles take turns), and only classify pixels on the others.");
+    parser.set_optional<int>("cs", "coarse_scale", 1, "Model the background and find blobs on frames downscaled by this factor, and only refine the blobs at full resolution (1 turns this off).");
+    parser.set_optional<std::string>("mv", "motion_vectors", "", "Decode the input file with libav and use the motion vectors of the codec: gate only processes the tiles where something moved, blocks finds the objects straight from the moving macroblocks.");
+    
+    parser.set_optional<std::string>("am", "activity_map", "", "Learn which tiles of the frame ever have foreground, stop processing the others after a warmup, and keep what was learned in this JSON file for the next run with the same camera.");
+    parser.set_optional<int>("aw", "activity_warmup", 500, "The number of frames to process every tile for before dropping inactive ones.");
+    parser.set_optional<int>("ap", "activity_probe", 100, "Check the dropped tiles again every this many frames.");
+    
+    parser.set_optional<std::string>("j", "journal", "", "Append the tracks of every frame to this crash-safe journal. If the journal already exists, its tracks are recovered into the log and frame numbering continues after them.");
+    parser.set_optional<int>("ji", "journal_interval", 200, "Sync the journal to disk at most this often, in milliseconds.");
+    
+    parser.set_optional<std::string>("hm", "heatmap", "", "Accumulate an occupancy heatmap (visits and dwell frames per cell) and snapshot it to this JSON file.");
+    parser.set_optional<int>("hc", "heatmap_cell", 10, "The size of a heatmap cell, in pixels of the processed frame.");
+    parser.set_optional<int>("hi", "heatmap_interval", 300, "Snapshot the heatmap every this many frames.");
+    
+    parser.set_optional<std::string>("z", "zones", "", "A JSON file with the zones and lines to count tracks entering, leaving and crossing.");
+    parser.set_optional<std::string>("ze", "zone_events", "", "Write every zone and line event to this file, one JSON object per line.");
+    
+    parser.set_optional<int>("rb", "result_buffer", 64, "The number of frames of results the log and analytics sinks can fall behind the tracker by.");
+    parser.set_optional<bool>("ad", "analytics_drop", false, "Let the analytics (heatmap and zones) skip the results of frames when they fall a whole result buffer behind, instead of holding up the tracker.");
+    
+    parser.set_optional<bool>("pc", "perf_counters", false, "Count cycles, instructions, cache misses and branch misses in every stage with perf_event_open, and print them per frame next to the wall time at the end.");
+    parser.set_optional<std::string>("tr", "trace", "", "Record when every stage of every frame (and its steps) runs on each thread, and write it to this Chrome trace event JSON file at the end, or whenever the tracker gets SIGUSR1.");
+    
+    // Arguments for serve mode.
+    parser.set_optional<int>("sw", "serve_workers", 0, "The number of worker threads shared by the streams (0 for one per core).");
+    
     // Arguments for plotter mode.
     parser.set_optional<std::string>("s2", "track_file_2", "", "The second track file for the plotter");
     
+    // Arguments for index mode.
+    parser.set_optional<std::string>("b", "build_index", "", "A comma-separated list of tracker JSON logs to build the index (-i) from.");
+    parser.set_optional<std::vector<int>>("q", "query", std::vector<int>(), "List the tracks that passed through this rectangle: x1 y1 x2 y2");
+    parser.set_optional<std::vector<int>>("fr", "frame_range", std::vector<int>(), "Only consider the frames between these two frames, inclusive.");
+    
     parser.run_and_exit_if_error();
     
     auto mode = parser.get<std::string>("m");
     
+    OT::AsyncIO::Service::useThreadPool(parser.get<std::string>("io") == "threads");
+    
     if (mode == "tracker") {
         OT::Mode::Tracking::run(parser);
     } else if (mode == "plotter") {
         OT::Mode::Plotting::run(parser);
     } else if (mode == "ground_truth") {
         OT::Mode::GroundTruth::run(parser);
+    } else if (mode == "merger") {
+        OT::Mode::Merging::run(parser);
+    } else if (mode == "index") {
+        OT::Mode::Indexing::run(parser);
+    } else if (mode == "serve") {
+        OT::Mode::Serving::run(parser);
     }
     return 0;
 }
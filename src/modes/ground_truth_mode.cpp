@@ -6,6 +6,8 @@
 #include "ground_truth/ground_truth_log.hpp"
 #include "utils/utils.hpp"
 #include "utils/perspective_transformer.hpp"
+#include "utils/geometry_map.hpp"
+#include "utils/async_io.hpp"
 
 namespace OT {
     namespace Mode {
@@ -52,8 +54,16 @@ namespace OT {
                 // Read the second positional command line argument and use that as the log
                 // for the output file.
                 bool hasOutputFile = false;
-                std::ofstream outputFile;
-                if (!parser.get<std::string>("s").empty()) {
+                OT::AsyncIO::Sink outputFile;
+                
+                // With a retention policy, only recent annotations are kept in memory and
+                // the rest are spilled to segment files next to the output file.
+                bool hasRetention = parser.get<int>("rf") > 0;
+                if (!parser.get<std::string>("s").empty() && hasRetention) {
+                    logger.setRetention(parser.get<int>("rf"),
+                                        parser.get<std::string>("s"),
+                                        static_cast<size_t>(parser.get<int>("sm")) * 1024 * 1024);
+                } else if (!parser.get<std::string>("s").empty()) {
                     hasOutputFile = true;
                     outputFile.open(parser.get<std::string>("s"));
                 }
@@ -80,19 +90,30 @@ namespace OT {
                     perspectiveMatrix = OT::Perspective::getPerspectiveMatrix(points, perspectiveSize);
                 }
                 
+                // Correct the lens distortion, do the perspective transform and scale the frame
+                // in a single pass, if there's a calibration or a perspective transform.
+                OT::GeometryMap geometryMap;
+                std::string calibrationPath = parser.get<std::string>("c");
+                if (!calibrationPath.empty() && !geometryMap.loadCalibration(calibrationPath)) {
+                    std::cerr << "Problem loading the camera calibration from " << calibrationPath << std::endl;
+                }
+                if (!points.empty()) {
+                    geometryMap.setPerspective(perspectiveMatrix, perspectiveSize);
+                }
+                geometryMap.setMaxDimension(maxDimension);
+                
                 while(OT::Utils::hasFrame(capture)) {
                     // Fetch the next frame.
                     capture.retrieve(frame);
                     frameNumber++;
                     
-                    // Do the perspective transform.
-                    if (!points.empty()) {
-                        cv::warpPerspective(frame, frame, perspectiveMatrix, perspectiveSize);
+                    // Correct the geometry of the frame, or just scale it.
+                    if (geometryMap.isEnabled()) {
+                        geometryMap.correct(frame);
+                    } else {
+                        OT::Utils::scale(frame, maxDimension);
                     }
                     
-                    // Scale the image.
-                    OT::Utils::scale(frame, maxDimension);
-                    
                     // Show the frame
                     imshow("Video", frame);
                     
@@ -104,7 +125,9 @@ namespace OT {
                 }
                 
                 // Log the output file if we need to.
-                if (hasOutputFile) {
+                if (hasRetention) {
+                    logger.flushToSegments();
+                } else if (hasOutputFile) {
                     logger.writeToStream(outputFile);
                     outputFile.close();
                 }
@@ -0,0 +1,76 @@
+#include "modes/indexing_mode.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "analytics/track_index.hpp"
+#include "lib/cmdparser.hpp"
+
+namespace OT {
+    namespace Mode {
+        namespace Indexing {
+            void run(const cli::Parser& parser) {
+                std::string indexPath = parser.get<std::string>("i");
+                
+                // Build the index if we were given logs.
+                std::string logList = parser.get<std::string>("b");
+                if (!logList.empty()) {
+                    std::vector<std::string> logPaths;
+                    std::stringstream stream(logList);
+                    std::string path;
+                    while (std::getline(stream, path, ',')) {
+                        if (!path.empty()) {
+                            logPaths.push_back(path);
+                        }
+                    }
+                    if (!OT::TrackIndex::build(logPaths, indexPath)) {
+                        std::cerr << "Problem building the index " << indexPath << std::endl;
+                        return;
+                    }
+                    std::cout << "Indexed " << logPaths.size() << " logs into " << indexPath << std::endl;
+                }
+                
+                auto queryRect = parser.get<std::vector<int>>("q");
+                if (queryRect.empty()) {
+                    return;
+                }
+                if (queryRect.size() != 4) {
+                    std::cerr << "The query should be a rectangle: x1 y1 x2 y2" << std::endl;
+                    return;
+                }
+                
+                // Restrict the query to a range of frames if there is one.
+                long fromFrame = std::numeric_limits<long>::min();
+                long toFrame = std::numeric_limits<long>::max();
+                auto frameRange = parser.get<std::vector<int>>("fr");
+                if (frameRange.size() == 2) {
+                    fromFrame = frameRange[0];
+                    toFrame = frameRange[1];
+                }
+                
+                OT::TrackIndex index;
+                if (!index.open(indexPath)) {
+                    std::cerr << "Problem opening the index " << indexPath << std::endl;
+                    return;
+                }
+                
+                auto start = std::chrono::steady_clock::now();
+                std::vector<OT::TrackIndex::Hit> hits;
+                index.query(queryRect[0], queryRect[1], queryRect[2], queryRect[3], fromFrame, toFrame, hits);
+                auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+                
+                std::cout << "log,trackerId,firstFrame,lastFrame" << std::endl;
+                for (const auto& hit : hits) {
+                    std::cout << index.logPath(hit.logIndex) << "," << hit.trackerId << ","
+                              << hit.firstFrame << "," << hit.lastFrame << std::endl;
+                }
+                std::cerr << hits.size() << " tracks from " << index.numEntries() << " segments in "
+                          << elapsed.count() << " ms" << std::endl;
+            } // run
+        } // Indexing
+    } // Mode
+} // OT
@@ -0,0 +1,70 @@
+#include "modes/merging_mode.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lib/cmdparser.hpp"
+#include "tracker/tracker_log.hpp"
+#include "tracker/track_journal.hpp"
+#include "ground_truth/ground_truth_log.hpp"
+#include "utils/log_segment.hpp"
+#include "utils/async_io.hpp"
+
+namespace OT {
+    namespace Mode {
+        namespace Merging {
+            void run(const cli::Parser& parser) {
+                std::string segmentPrefix = parser.get<std::string>("i");
+                std::string outputFilePath = parser.get<std::string>("s");
+                if (outputFilePath.empty()) {
+                    std::cerr << "The merger needs an output file (-s)" << std::endl;
+                    return;
+                }
+                
+                // Read every record from the segments, or from a track journal.
+                OT::LogSegment::Kind kind = OT::LogSegment::Tracks;
+                int width = 0;
+                int height = 0;
+                std::vector<OT::LogSegment::Record> records;
+                if (OT::TrackJournal::isJournal(segmentPrefix)) {
+                    std::vector<OT::Track> tracks;
+                    OT::TrackJournal::recover(segmentPrefix, tracks, width, height, false);
+                    for (auto track : tracks) {
+                        records.push_back(OT::LogSegment::Record{track.frameNumber, track.trackerId, track.x, track.y});
+                    }
+                } else if (!OT::LogSegment::readAll(segmentPrefix, kind, width, height, records)) {
+                    std::cerr << "Problem reading segments with prefix " << segmentPrefix << std::endl;
+                    return;
+                }
+                
+                OT::AsyncIO::Sink outputFile;
+                outputFile.open(outputFilePath);
+                if (kind == OT::LogSegment::Tracks || kind == OT::LogSegment::SimplifiedTracks) {
+                    // Replay the tracks into a log, which recomputes the birth frames.
+                    OT::TrackerLog trackerLog(true);
+                    trackerLog.setDimensions(width, height);
+                    if (kind == OT::LogSegment::SimplifiedTracks) {
+                        trackerLog.markSimplified();
+                    }
+                    for (auto record : records) {
+                        if (record.startsTrajectory) {
+                            trackerLog.markTrajectoryStart(record.id, record.frame);
+                        }
+                        trackerLog.addTrack(record.id, record.x, record.y, record.frame);
+                    }
+                    trackerLog.logToFile(outputFile);
+                } else {
+                    OT::GroundTruth::Log logger;
+                    for (auto record : records) {
+                        logger.addAnnotation(OT::GroundTruth::Annotation{record.frame, record.x, record.y});
+                    }
+                    logger.writeToStream(outputFile);
+                }
+                outputFile.close();
+                
+                std::cout << "Merged " << records.size() << " records into " << outputFilePath << std::endl;
+            } // run
+        } // Merging
+    } // Mode
+} // OT
@@ -10,6 +10,7 @@
 #include "lib/csv.hpp"
 #include "utils/utils.hpp"
 #include "utils/perspective_transformer.hpp"
+#include "utils/geometry_map.hpp"
 
 /**
  * Plots points listed in the (timestamp, x, y, frame) CSV overlaid on a video.
@@ -97,20 +98,31 @@ namespace OT {
                     perspectiveMatrix = OT::Perspective::getPerspectiveMatrix(points, perspectiveSize);
                 }
                 
+                // Correct the lens distortion, do the perspective transform and scale the frame
+                // in a single pass, if there's a calibration or a perspective transform.
+                OT::GeometryMap geometryMap;
+                std::string calibrationPath = parser.get<std::string>("c");
+                if (!calibrationPath.empty() && !geometryMap.loadCalibration(calibrationPath)) {
+                    std::cerr << "Problem loading the camera calibration from " << calibrationPath << std::endl;
+                }
+                if (!points.empty()) {
+                    geometryMap.setPerspective(perspectiveMatrix, perspectiveSize);
+                }
+                geometryMap.setMaxDimension(maxDimension);
+                
                 // Repeat while the user has not pressed "q" and while there's another frame.
                 while(OT::Utils::hasFrame(capture)) {
                     // Fetch the next frame.
                     capture.retrieve(frame);
                     frameNumber++;
                     
-                    // Do the perspective transform.
-                    if (!points.empty()) {
-                        cv::warpPerspective(frame, frame, perspectiveMatrix, perspectiveSize);
+                    // Correct the geometry of the frame, or just scale it.
+                    if (geometryMap.isEnabled()) {
+                        geometryMap.correct(frame);
+                    } else {
+                        OT::Utils::scale(frame, maxDimension);
                     }
                     
-                    // Scale the image.
-                    OT::Utils::scale(frame, maxDimension);
-                    
                     // Update the current track entry.
                     if (entryForFrame.find(frameNumber) != entryForFrame.end()) {
                         currentTrackEntry = entryForFrame.at(frameNumber);
@@ -137,7 +149,7 @@ namespace OT {
                 
                     imshow("Video", frame);
                 }
-
+            
             } // run
         } // Tracking
     } // Mode
@@ -0,0 +1,788 @@
+#include "modes/serving_mode.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lib/cmdparser.hpp"
+#include "lib/json.hpp"
+#include "tracker/contour_finder.hpp"
+#include "tracker/kalman_tracker.hpp"
+#include "tracker/multi_object_tracker.hpp"
+#include "tracker/track_journal.hpp"
+#include "tracker/tracker_log.hpp"
+#include "utils/async_io.hpp"
+#include "utils/deadline_scheduler.hpp"
+#include "utils/instrumentation.hpp"
+#include "utils/utils.hpp"
+
+namespace OT {
+    namespace Mode {
+        namespace Serving {
+            // Set by SIGINT and SIGTERM.
+            volatile std::sig_atomic_t stopRequested = 0;
+            
+            void requestStop(int) {
+                stopRequested = 1;
+            }
+            
+            // The settings of a stream that can be changed while it runs.
+            struct StreamSettings {
+                int maxDimension = -1;
+                int tileSize = 0;
+                int updateInterval = 1;
+                int coarseScale = 1;
+                bool runLabeling = false;
+                
+                // How the stream is scheduled: its frame rate (0 for the one the input
+                // reports), how soon after its arrival a frame should be done (0 for two frame
+                // intervals), and its weight against the other streams.
+                double fps = 0;
+                double latencyMs = 0;
+                double weight = 1;
+            };
+            
+            // Read the settings given in a command over settings. Returns false, with the
+            // reason in error, if one of them is invalid.
+            bool readSettings(const nlohmann::json& command, StreamSettings& settings, std::string& error) {
+                settings.maxDimension = command.value("max_dimension", settings.maxDimension);
+                settings.tileSize = command.value("tile_size", settings.tileSize);
+                settings.updateInterval = command.value("update_interval", settings.updateInterval);
+                settings.coarseScale = command.value("coarse_scale", settings.coarseScale);
+                settings.runLabeling = command.value("run_labeling", settings.runLabeling);
+                settings.fps = command.value("fps", settings.fps);
+                settings.latencyMs = command.value("latency_ms", settings.latencyMs);
+                settings.weight = command.value("weight", settings.weight);
+                if (settings.maxDimension == 0 || settings.maxDimension < -1) {
+                    error = "max_dimension must be positive, or -1 for no scaling";
+                } else if (settings.tileSize < 0) {
+                    error = "tile_size must not be negative";
+                } else if (settings.updateInterval < 1) {
+                    error = "update_interval must be at least 1";
+                } else if (settings.coarseScale < 1) {
+                    error = "coarse_scale must be at least 1";
+                } else if (settings.fps < 0) {
+                    error = "fps must not be negative";
+                } else if (settings.latencyMs < 0) {
+                    error = "latency_ms must not be negative";
+                } else if (settings.weight <= 0) {
+                    error = "weight must be positive";
+                } else {
+                    return true;
+                }
+                return false;
+            }
+            
+            /**
+             * The state of one stream: its capture, background model, tracks and outputs.
+             * Only one worker processes a session at a time, but the control thread may
+             * reconfigure it and read its statistics meanwhile.
+             */
+            class Session {
+            private:
+                std::string name;
+                std::string input;
+                cv::VideoCapture capture;
+                
+                // The settings in use, and the settings to switch to before the next frame.
+                StreamSettings settings;
+                std::mutex mutex;
+                StreamSettings pendingSettings;
+                bool hasPendingSettings;
+                
+                std::unique_ptr<OT::ContourFinder> contourFinder;
+                std::unique_ptr<OT::MultiObjectTracker> tracker;
+                cv::Size trackerSize;
+                
+                // The detections and tracks of the current frame, reused from frame to frame.
+                std::vector<cv::Vec4i> hierarchy;
+                std::vector<std::vector<cv::Point>> contours;
+                std::vector<cv::Point2f> massCenters;
+                std::vector<cv::Rect> boundingBoxes;
+                std::vector<OT::TrackingOutput> predictions;
+                std::vector<OT::Track> frameTracks;
+                long frameNumber;
+                
+                // The outputs, written through the shared async I/O service.
+                std::string journalPath;
+                OT::TrackJournal journal;
+                std::string outputPath;
+                OT::TrackerLog trackerLog;
+                OT::AsyncIO::Sink outputFile;
+                
+                // Whether the log keeps only recent frames in memory and spills the rest to
+                // segment files prefixed by the output path, instead of writing the JSON.
+                bool hasRetention;
+                
+                // The statistics.
+                std::chrono::steady_clock::time_point started;
+                std::atomic<long> framesProcessed;
+                std::atomic<int> numTracks;
+                
+                // Make a new background model with the current settings.
+                void resetContourFinder() {
+                    this->contourFinder = std::make_unique<OT::ContourFinder>();
+                    this->contourFinder->setShowForeground(false);
+                    this->contourFinder->setTileSize(this->settings.tileSize);
+                    this->contourFinder->setUpdateInterval(this->settings.updateInterval);
+                    this->contourFinder->setCoarseScale(this->settings.coarseScale);
+                    this->contourFinder->setRunLabeling(this->settings.runLabeling);
+                }
+                
+                // Switch to new settings. Changing the tiles or the scale of the model
+                // starts a new background model; the rest applies in place.
+                void applySettings(const StreamSettings& settings) {
+                    bool resetModel = settings.tileSize != this->settings.tileSize
+                        || settings.coarseScale != this->settings.coarseScale;
+                    this->settings = settings;
+                    if (resetModel) {
+                        this->resetContourFinder();
+                    } else {
+                        this->contourFinder->setUpdateInterval(settings.updateInterval);
+                        this->contourFinder->setRunLabeling(settings.runLabeling);
+                    }
+                }
+            public:
+                Session(const std::string& name) : name(name) {
+                    this->hasPendingSettings = false;
+                    this->hasRetention = false;
+                    this->frameNumber = 0;
+                    this->framesProcessed = 0;
+                    this->numTracks = 0;
+                }
+                
+                const std::string& getName() const {
+                    return this->name;
+                }
+                
+                // Open the input and the outputs given in an open command. Returns false, with
+                // the reason in error, if one of them can't be opened.
+                bool open(const nlohmann::json& command, std::string& error) {
+                    this->input = command.value("input", std::string());
+                    if (this->input.empty()) {
+                        error = "open needs an input";
+                        return false;
+                    }
+                    if (!readSettings(command, this->settings, error)) {
+                        return false;
+                    }
+                    
+                    // A number is a camera, anything else a file or a URL.
+                    bool isCamera = !this->input.empty() && std::all_of(this->input.begin(), this->input.end(), ::isdigit);
+                    if (isCamera) {
+                        this->capture.open(std::stoi(this->input));
+                    } else {
+                        this->capture.open(this->input);
+                    }
+                    if (!this->capture.isOpened()) {
+                        error = "Problem opening " + this->input;
+                        return false;
+                    }
+                    if (this->settings.fps <= 0) {
+                        double fps = this->capture.get(cv::CAP_PROP_FPS);
+                        this->settings.fps = fps > 0 ? fps : 30;
+                    }
+                    if (this->settings.latencyMs <= 0) {
+                        this->settings.latencyMs = 2000 / this->settings.fps;
+                    }
+                    
+                    // With a retention policy, like -rf and -rm, the log spills all but the
+                    // recent frames to segment files next to the output.
+                    this->outputPath = command.value("output", std::string());
+                    long retainFrames = command.value("retain_frames", 0L);
+                    long retainMegabytes = command.value("retain_megabytes", 0L);
+                    long segmentMegabytes = command.value("segment_megabytes", 64L);
+                    if (retainFrames < 0 || retainMegabytes < 0) {
+                        error = "retain_frames and retain_megabytes must not be negative";
+                        return false;
+                    }
+                    if (segmentMegabytes < 1) {
+                        error = "segment_megabytes must be at least 1";
+                        return false;
+                    }
+                    this->hasRetention = !this->outputPath.empty() && (retainFrames > 0 || retainMegabytes > 0);
+                    if (this->hasRetention) {
+                        this->trackerLog.setRetention(retainFrames,
+                                                      static_cast<size_t>(retainMegabytes) * 1024 * 1024,
+                                                      this->outputPath,
+                                                      static_cast<size_t>(segmentMegabytes) * 1024 * 1024);
+                    } else if (!this->outputPath.empty() && !this->outputFile.open(this->outputPath)) {
+                        error = "Problem opening " + this->outputPath;
+                        return false;
+                    }
+                    
+                    // Carry on from the frame numbers of the journal, if it already exists, with
+                    // the tracks it recovers in the log.
+                    this->journalPath = command.value("journal", std::string());
+                    if (!this->journalPath.empty()) {
+                        int width = 0;
+                        int height = 0;
+                        std::vector<OT::Track> recoveredTracks;
+                        this->frameNumber = OT::TrackJournal::recover(this->journalPath, recoveredTracks, width, height);
+                        if (!this->outputPath.empty()) {
+                            if (width > 0 && height > 0) {
+                                this->trackerLog.setDimensions(width, height);
+                            }
+                            for (const auto& track : recoveredTracks) {
+                                this->trackerLog.addTrack(track.trackerId, track.x, track.y, track.frameNumber);
+                            }
+                        }
+                        if (!this->journal.open(this->journalPath)) {
+                            error = "Problem opening journal " + this->journalPath;
+                            return false;
+                        }
+                    }
+                    
+                    this->resetContourFinder();
+                    this->started = std::chrono::steady_clock::now();
+                    return true;
+                }
+                
+                StreamSettings currentSettings() {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    return this->hasPendingSettings ? this->pendingSettings : this->settings;
+                }
+                
+                // Switch to the settings before the next frame.
+                void reconfigure(const StreamSettings& settings) {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->pendingSettings = settings;
+                    this->hasPendingSettings = true;
+                }
+                
+                // Read, detect and track the next frame, decoding it into frame, or only skip
+                // it if detect is false. Returns false at the end of the stream.
+                bool processFrame(cv::Mat& frame, bool detect) {
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        if (this->hasPendingSettings) {
+                            this->applySettings(this->pendingSettings);
+                            this->hasPendingSettings = false;
+                        }
+                    }
+                    
+                    // A skipped frame is grabbed but not decoded, which is most of what reading
+                    // it costs. The tracks coast on to the next frame that is detected.
+                    if (!detect) {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Capture);
+                        if (!this->capture.grab()) {
+                            return false;
+                        }
+                        this->frameNumber++;
+                        this->framesProcessed++;
+                        return true;
+                    }
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Capture);
+                        if (!this->capture.read(frame)) {
+                            return false;
+                        }
+                    }
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Correction);
+                        OT::Utils::scale(frame, this->settings.maxDimension);
+                    }
+                    
+                    // The tracker depends on the frame size, which a new max_dimension changes.
+                    if (this->tracker == nullptr || frame.size() != this->trackerSize) {
+                        this->tracker = std::make_unique<OT::MultiObjectTracker>(frame.size());
+                        this->trackerSize = frame.size();
+                    }
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Detection);
+                        this->contourFinder->findContours(frame,
+                                                          this->hierarchy,
+                                                          this->contours,
+                                                          this->massCenters,
+                                                          this->boundingBoxes);
+                    }
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Tracking);
+                        this->tracker->update(this->massCenters, this->boundingBoxes, this->predictions);
+                    }
+                    this->frameNumber++;
+                    
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Logging);
+                        this->frameTracks.clear();
+                        for (const auto& pred : this->predictions) {
+                            this->frameTracks.push_back(OT::Track{pred.id, pred.location.x, pred.location.y, this->frameNumber});
+                        }
+                        if (!this->journalPath.empty()) {
+                            this->journal.append(this->frameNumber, frame.cols, frame.rows, this->frameTracks);
+                        }
+                        if (!this->outputPath.empty()) {
+                            this->trackerLog.setDimensions(frame.cols, frame.rows);
+                            for (const auto& track : this->frameTracks) {
+                                this->trackerLog.addTrack(track.trackerId, track.x, track.y, track.frameNumber);
+                            }
+                        }
+                    }
+                    
+                    this->framesProcessed++;
+                    this->numTracks = static_cast<int>(this->predictions.size());
+                    return true;
+                }
+                
+                nlohmann::json stats(const std::string& state) const {
+                    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->started).count();
+                    long frames = this->framesProcessed;
+                    nlohmann::json json;
+                    json["stream"] = this->name;
+                    json["input"] = this->input;
+                    json["state"] = state;
+                    json["frames"] = frames;
+                    json["fps"] = seconds > 0 ? frames / seconds : 0.0;
+                    json["tracks"] = this->numTracks.load();
+                    return json;
+                }
+                
+                // Write the outputs that were opened. The session must not be processing a frame.
+                void close() {
+                    this->capture.release();
+                    if (!this->journalPath.empty()) {
+                        this->journal.close();
+                    }
+                    if (this->hasRetention) {
+                        this->trackerLog.flushToSegments();
+                    } else if (this->outputFile.isOpen()) {
+                        this->trackerLog.logToFile(this->outputFile);
+                        this->outputFile.close();
+                    }
+                }
+            };
+            
+            /**
+             * The sessions and the workers that process them. A worker takes the frame that
+             * is due first among the released frames of the sessions nobody is processing, as
+             * the scheduler decides, and processes it, or skips it when the scheduler sheds
+             * load from the stream.
+             */
+            class Server {
+            private:
+                struct Entry {
+                    std::shared_ptr<Session> session;
+                    int id;
+                    bool busy;
+                    bool finished;
+                };
+                
+                std::mutex mutex;
+                std::condition_variable condition;
+                std::vector<Entry> entries;
+                
+                // Schedules the entries by their ids, which aren't reused.
+                OT::DeadlineScheduler scheduler;
+                int nextId;
+                
+                std::vector<std::thread> workers;
+                bool stopping;
+                bool shutdownRequested;
+                
+                // The index of the entry for the stream, or entries.size() if there is none.
+                size_t find(const std::string& name) const {
+                    for (size_t i = 0; i < this->entries.size(); i++) {
+                        if (this->entries[i].session->getName() == name) {
+                            return i;
+                        }
+                    }
+                    return this->entries.size();
+                }
+                
+                // The index of the entry with the id, or entries.size() if there is none.
+                size_t findId(int id) const {
+                    for (size_t i = 0; i < this->entries.size(); i++) {
+                        if (this->entries[i].id == id) {
+                            return i;
+                        }
+                    }
+                    return this->entries.size();
+                }
+                
+                // Add the deadline statistics of the entry to the statistics of its session.
+                // The lock must be held.
+                nlohmann::json entryStats(const Entry& entry, const std::string& state) const {
+                    nlohmann::json json = entry.session->stats(state);
+                    OT::DeadlineScheduler::StreamStats deadlines = this->scheduler.stats(entry.id);
+                    json["detected"] = deadlines.detected;
+                    json["skipped"] = deadlines.frames - deadlines.detected;
+                    json["deadline_misses"] = deadlines.misses;
+                    json["recent_miss_rate"] = deadlines.recentMissRate;
+                    json["lateness_ms"] = deadlines.lastLatenessMs;
+                    json["deadline_resets"] = deadlines.resets;
+                    json["detection_interval"] = deadlines.detectionInterval;
+                    return json;
+                }
+                
+                void work() {
+                    OT::Instrumentation::setThreadName("session worker");
+                    
+                    // The frame buffer of this worker, reused for every stream it processes.
+                    cv::Mat frame;
+                    OT::DeadlineScheduler::Task task;
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    while (true) {
+                        // Sleep until the next frame is released, unless the sessions change first.
+                        while (!this->stopping && !this->scheduler.next(task, OT::DeadlineScheduler::Clock::now())) {
+                            OT::DeadlineScheduler::Clock::time_point release = this->scheduler.nextRelease();
+                            if (release == OT::DeadlineScheduler::Clock::time_point::max()) {
+                                this->condition.wait(lock);
+                            } else {
+                                this->condition.wait_until(lock, release);
+                            }
+                        }
+                        if (this->stopping) {
+                            return;
+                        }
+                        size_t i = this->findId(task.stream);
+                        this->entries[i].busy = true;
+                        std::shared_ptr<Session> session = this->entries[i].session;
+                        lock.unlock();
+                        
+                        bool hasMore = false;
+                        try {
+                            hasMore = session->processFrame(frame, task.detect);
+                        } catch (const std::exception& e) {
+                            std::cerr << "Stream " << session->getName() << " failed: " << e.what() << std::endl;
+                        }
+                        OT::DeadlineScheduler::Clock::time_point finished = OT::DeadlineScheduler::Clock::now();
+                        
+                        // Other sessions may have been removed meanwhile, so look it up again.
+                        lock.lock();
+                        this->scheduler.complete(task, finished);
+                        size_t j = this->findId(task.stream);
+                        if (j < this->entries.size()) {
+                            this->entries[j].busy = false;
+                            this->entries[j].finished = !hasMore;
+                            if (!hasMore) {
+                                this->scheduler.deactivate(task.stream);
+                            }
+                        }
+                        this->condition.notify_all();
+                    }
+                }
+                
+                // Remove the entry once no worker is processing it, and return its session
+                // with its final statistics. The lock must be held.
+                std::shared_ptr<Session> remove(std::unique_lock<std::mutex>& lock, const std::string& name, nlohmann::json& stats) {
+                    size_t i = this->find(name);
+                    int id = this->entries[i].id;
+                    this->scheduler.deactivate(id);
+                    this->condition.wait(lock, [this, &name] {
+                        size_t j = this->find(name);
+                        return j == this->entries.size() || !this->entries[j].busy;
+                    });
+                    i = this->find(name);
+                    std::shared_ptr<Session> session = this->entries[i].session;
+                    stats = this->entryStats(this->entries[i], "closed");
+                    this->entries.erase(this->entries.begin() + i);
+                    this->scheduler.removeStream(id);
+                    return session;
+                }
+                
+                nlohmann::json open(const nlohmann::json& command) {
+                    nlohmann::json reply;
+                    std::string name = command.value("stream", std::string());
+                    if (name.empty()) {
+                        reply["error"] = "open needs a stream name";
+                        return reply;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        if (this->find(name) < this->entries.size()) {
+                            reply["error"] = "There already is a stream " + name;
+                            return reply;
+                        }
+                    }
+                    
+                    // Opening the input can take a while (e.g. for a network camera), so it
+                    // is done before the session is added, without holding the lock.
+                    auto session = std::make_shared<Session>(name);
+                    std::string error;
+                    if (!session->open(command, error)) {
+                        session->close();
+                        reply["error"] = error;
+                        return reply;
+                    }
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    if (this->find(name) < this->entries.size()) {
+                        session->close();
+                        reply["error"] = "There already is a stream " + name;
+                        return reply;
+                    }
+                    StreamSettings settings = session->currentSettings();
+                    int id = this->nextId++;
+                    this->entries.push_back(Entry{session, id, false, false});
+                    this->scheduler.addStream(id, settings.fps, settings.latencyMs, settings.weight);
+                    this->condition.notify_all();
+                    reply["ok"] = true;
+                    return reply;
+                }
+                
+                nlohmann::json close(const nlohmann::json& command) {
+                    nlohmann::json reply;
+                    std::string name = command.value("stream", std::string());
+                    std::shared_ptr<Session> session;
+                    {
+                        std::unique_lock<std::mutex> lock(this->mutex);
+                        if (this->find(name) == this->entries.size()) {
+                            reply["error"] = "There is no stream " + name;
+                            return reply;
+                        }
+                        session = this->remove(lock, name, reply);
+                    }
+                    session->close();
+                    reply["ok"] = true;
+                    return reply;
+                }
+                
+                nlohmann::json reconfigure(const nlohmann::json& command) {
+                    nlohmann::json reply;
+                    std::string name = command.value("stream", std::string());
+                    std::shared_ptr<Session> session;
+                    int id;
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        size_t i = this->find(name);
+                        if (i == this->entries.size()) {
+                            reply["error"] = "There is no stream " + name;
+                            return reply;
+                        }
+                        session = this->entries[i].session;
+                        id = this->entries[i].id;
+                    }
+                    StreamSettings settings = session->currentSettings();
+                    std::string error;
+                    if (!readSettings(command, settings, error)) {
+                        reply["error"] = error;
+                        return reply;
+                    }
+                    session->reconfigure(settings);
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        this->scheduler.updateStream(id, settings.fps, settings.latencyMs, settings.weight);
+                    }
+                    reply["ok"] = true;
+                    return reply;
+                }
+                
+                nlohmann::json stats(const nlohmann::json& command) {
+                    nlohmann::json reply;
+                    std::string name = command.value("stream", std::string());
+                    nlohmann::json streams = nlohmann::json::array();
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        for (const auto& entry : this->entries) {
+                            if (name.empty() || entry.session->getName() == name) {
+                                streams.push_back(this->entryStats(entry, entry.finished ? "finished" : "running"));
+                            }
+                        }
+                    }
+                    if (!name.empty() && streams.empty()) {
+                        reply["error"] = "There is no stream " + name;
+                        return reply;
+                    }
+                    reply["ok"] = true;
+                    reply["workers"] = this->workers.size();
+                    reply["streams"] = streams;
+                    return reply;
+                }
+            public:
+                Server(size_t numWorkers) {
+                    this->nextId = 0;
+                    this->stopping = false;
+                    this->shutdownRequested = false;
+                    for (size_t i = 0; i < numWorkers; i++) {
+                        this->workers.emplace_back([this] { this->work(); });
+                    }
+                }
+                
+                ~Server() {
+                    this->stop();
+                }
+                
+                bool isShuttingDown() {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    return this->shutdownRequested;
+                }
+                
+                // Carry out a command, and return the reply.
+                std::string handle(const std::string& line) {
+                    nlohmann::json reply;
+                    try {
+                        nlohmann::json command = nlohmann::json::parse(line);
+                        std::string name = command.value("command", std::string());
+                        if (name == "open") {
+                            reply = this->open(command);
+                        } else if (name == "close") {
+                            reply = this->close(command);
+                        } else if (name == "reconfigure") {
+                            reply = this->reconfigure(command);
+                        } else if (name == "stats") {
+                            reply = this->stats(command);
+                        } else if (name == "shutdown") {
+                            std::lock_guard<std::mutex> lock(this->mutex);
+                            this->shutdownRequested = true;
+                            reply["ok"] = true;
+                        } else {
+                            reply["error"] = "Unknown command " + name;
+                        }
+                    } catch (const std::exception& e) {
+                        reply = nlohmann::json();
+                        reply["error"] = std::string("Problem with the command: ") + e.what();
+                    }
+                    if (reply.count("ok") == 0) {
+                        reply["ok"] = false;
+                    }
+                    return reply.dump() + "\n";
+                }
+                
+                // Stop the workers, and close every session.
+                void stop() {
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        this->stopping = true;
+                    }
+                    this->condition.notify_all();
+                    for (auto& worker : this->workers) {
+                        worker.join();
+                    }
+                    this->workers.clear();
+                    for (auto& entry : this->entries) {
+                        entry.session->close();
+                    }
+                    this->entries.clear();
+                }
+            };
+            
+            // A connection on the control socket, and what it has sent that isn't a whole
+            // line yet.
+            struct Client {
+                int fd;
+                std::string buffer;
+            };
+            
+            // Answer the complete lines a client has sent. Returns false if the client should
+            // be dropped.
+            bool serveClient(Server& server, Client& client) {
+                char data[4096];
+                ssize_t received = recv(client.fd, data, sizeof(data), 0);
+                if (received <= 0) {
+                    return false;
+                }
+                client.buffer.append(data, static_cast<size_t>(received));
+                size_t end;
+                while ((end = client.buffer.find('\n')) != std::string::npos) {
+                    std::string line = client.buffer.substr(0, end);
+                    client.buffer.erase(0, end + 1);
+                    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                        continue;
+                    }
+                    std::string reply = server.handle(line);
+                    if (send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(reply.size())) {
+                        return false;
+                    }
+                }
+                
+                // Commands are small, so a client that sends a huge line is misbehaving.
+                return client.buffer.size() <= 1024 * 1024;
+            }
+            
+            void run(const cli::Parser& parser) {
+                std::string socketPath = parser.get<std::string>("i");
+                int numWorkers = parser.get<int>("sw");
+                if (numWorkers <= 0) {
+                    numWorkers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+                }
+                
+                // Listen on the control socket, replacing the one a previous run left behind.
+                // Only the owner may connect.
+                sockaddr_un address;
+                std::memset(&address, 0, sizeof(address));
+                address.sun_family = AF_UNIX;
+                if (socketPath.size() >= sizeof(address.sun_path)) {
+                    std::cerr << "The socket path " << socketPath << " is too long" << std::endl;
+                    return;
+                }
+                std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+                int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (listener < 0) {
+                    std::cerr << "Problem creating the control socket: " << std::strerror(errno) << std::endl;
+                    return;
+                }
+                unlink(socketPath.c_str());
+                mode_t previousMask = umask(0077);
+                int bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+                umask(previousMask);
+                if (bound < 0 || listen(listener, 16) < 0) {
+                    std::cerr << "Problem listening on " << socketPath << ": " << std::strerror(errno) << std::endl;
+                    ::close(listener);
+                    return;
+                }
+                
+                std::signal(SIGINT, requestStop);
+                std::signal(SIGTERM, requestStop);
+                
+                Server server(static_cast<size_t>(numWorkers));
+                std::cout << "Serving on " << socketPath << " with " << numWorkers << " workers" << std::endl;
+                
+                // Wait for connections and commands, waking up now and then to check whether
+                // to stop.
+                std::vector<Client> clients;
+                while (!stopRequested && !server.isShuttingDown()) {
+                    std::vector<pollfd> fds;
+                    fds.push_back(pollfd{listener, POLLIN, 0});
+                    for (const auto& client : clients) {
+                        fds.push_back(pollfd{client.fd, POLLIN, 0});
+                    }
+                    if (poll(fds.data(), fds.size(), 200) <= 0) {
+                        continue;
+                    }
+                    
+                    // Serve the clients first, since accepting changes the list.
+                    for (size_t i = clients.size(); i-- > 0;) {
+                        if (fds[i + 1].revents != 0 && !serveClient(server, clients[i])) {
+                            ::close(clients[i].fd);
+                            clients.erase(clients.begin() + i);
+                        }
+                    }
+                    if (fds[0].revents & POLLIN) {
+                        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                        if (fd >= 0) {
+                            clients.push_back(Client{fd, std::string()});
+                        }
+                    }
+                }
+                
+                for (const auto& client : clients) {
+                    ::close(client.fd);
+                }
+                ::close(listener);
+                unlink(socketPath.c_str());
+                
+                // Write the outputs of every stream still open.
+                server.stop();
+                std::cout << "Stopped serving" << std::endl;
+            }
+        } // Serving
+    } // Mode
+} // OT
@@ -1,5 +1,6 @@
 #include "modes/tracking_mode.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -14,9 +15,17 @@
 #include "tracker/multi_object_tracker.hpp"
 #include "tracker/contour_finder.hpp"
 #include "tracker/tracker_log.hpp"
+#include "tracker/track_journal.hpp"
+#include "analytics/occupancy_map.hpp"
+#include "analytics/zone_analyzer.hpp"
 #include "lib/cmdparser.hpp"
 #include "utils/utils.hpp"
 #include "utils/perspective_transformer.hpp"
+#include "utils/geometry_map.hpp"
+#include "utils/async_io.hpp"
+#include "utils/instrumentation.hpp"
+#include "utils/motion_vector_reader.hpp"
+#include "utils/result_bus.hpp"
 
 namespace OT {
     namespace Mode {
@@ -47,6 +56,20 @@ namespace OT {
             
             void run(const cli::Parser& parser) {
                 
+                // Record a timeline of every stage of every frame, to be opened in
+                // chrome://tracing or Perfetto.
+                std::string tracePath = parser.get<std::string>("tr");
+                if (!tracePath.empty()) {
+                    OT::Instrumentation::startTracing(tracePath);
+                    OT::Instrumentation::setThreadName("main");
+                }
+                
+                // Count the hardware events of every stage. This has to start before the
+                // OpenCV workers do, so they are counted too.
+                if (parser.get<bool>("pc")) {
+                    OT::Instrumentation::startPerfCounters();
+                }
+                
                 // This does the actual tracking of the objects. We can't initialize it now because
                 // it needs to know the size of the frame. So, we set it equal to nullptr and initialize
                 // it after we get the first frame.
@@ -67,6 +90,57 @@ namespace OT {
                 // We'll use a ContourFinder to do the actual extraction of contours from the image.
                 OT::ContourFinder contourFinder;
                 
+                contourFinder.setRunLabeling(parser.get<bool>("rl"));
+                
+                // Split the frame into tiles so that the tiles outside the region of interest
+                // can be skipped.
+                int tileSize = parser.get<int>("tl");
+                std::string roiPath = parser.get<std::string>("roi");
+                if (!roiPath.empty()) {
+                    if (!contourFinder.loadRegionOfInterest(roiPath)) {
+                        std::cerr << "Problem loading the region of interest from " << roiPath << std::endl;
+                    }
+                    if (tileSize == 0) {
+                        tileSize = 64;
+                    }
+                }
+                
+                // Decode with libav to get the motion vectors of the codec, and either only process
+                // the tiles where something moved (gate) or find the objects straight from the
+                // moving macroblocks (blocks). This only works for local files.
+                std::string motionMode = parser.get<std::string>("mv");
+                std::unique_ptr<OT::MotionVectorReader> motionReader = nullptr;
+                cv::Mat motionBlocks;
+                if (!motionMode.empty()) {
+                    if (motionMode != "gate" && motionMode != "blocks") {
+                        std::cerr << "Unknown motion vector mode " << motionMode << ", use gate or blocks" << std::endl;
+                    } else if (parser.get<int>("w") != -1
+                               || !parser.get<std::vector<int>>("p").empty()
+                               || !parser.get<std::string>("c").empty()) {
+                        std::cerr << "Motion vectors can't be used with a webcam, a perspective transform or a calibration" << std::endl;
+                    } else {
+                        motionReader = std::make_unique<OT::MotionVectorReader>();
+                        if (!motionReader->open(parser.get<std::string>("i"))) {
+                            std::cerr << "Problem decoding motion vectors, falling back to plain decoding" << std::endl;
+                            motionReader = nullptr;
+                        } else if (motionMode == "gate" && tileSize == 0) {
+                            tileSize = 64;
+                        }
+                    }
+                }
+                
+                // Learn which tiles ever have foreground, and skip the others.
+                std::string activityMapPath = parser.get<std::string>("am");
+                if (!activityMapPath.empty()) {
+                    contourFinder.setActivityMap(activityMapPath, parser.get<int>("aw"), parser.get<int>("ap"));
+                    if (tileSize == 0) {
+                        tileSize = 64;
+                    }
+                }
+                contourFinder.setTileSize(tileSize);
+                contourFinder.setUpdateInterval(parser.get<int>("bu"));
+                contourFinder.setCoarseScale(parser.get<int>("cs"));
+                
                 // We'll count the frame with this variable.
                 long frameNumber = 0;
                 
@@ -77,7 +151,9 @@ namespace OT {
                 int maxDimension = parser.get<int>("d");
                 
                 // Read from the webcam or the parser.
-                if (parser.get<int>("w") != -1) {
+                if (motionReader != nullptr) {
+                    // The motion vector reader does the decoding.
+                } else if (parser.get<int>("w") != -1) {
                     capture.open(parser.get<int>("w"));
                 } else {
                     capture.open(parser.get<std::string>("i"));
@@ -93,19 +169,102 @@ namespace OT {
                     perspectiveMatrix = OT::Perspective::getPerspectiveMatrix(points, perspectiveSize);
                 }
                 
+                // Correct the lens distortion, do the perspective transform and scale the frame
+                // in a single pass, if there's a calibration or a perspective transform.
+                OT::GeometryMap geometryMap;
+                std::string calibrationPath = parser.get<std::string>("c");
+                if (!calibrationPath.empty() && !geometryMap.loadCalibration(calibrationPath)) {
+                    std::cerr << "Problem loading the camera calibration from " << calibrationPath << std::endl;
+                }
+                if (!points.empty()) {
+                    geometryMap.setPerspective(perspectiveMatrix, perspectiveSize);
+                }
+                geometryMap.setMaxDimension(maxDimension);
+                
                 // Read the second positional command line argument and use that as the log
                 // for the output file.
                 std::string outputFilePath = parser.get<std::string>("s");
-                std::ofstream outputFile;
-                if (!outputFilePath.empty()) {
+                OT::AsyncIO::Sink outputFile;
+                
+                // Only keep the vertices needed to reconstruct each trajectory within the tolerance.
+                double simplifyTolerance = parser.get<double>("ts");
+                if (simplifyTolerance > 0) {
+                    trackerLog.setSimplification(simplifyTolerance, parser.get<int>("tw"));
+                }
+                
+                // With a retention policy, the log only keeps recent frames in memory and spills
+                // the rest to segment files next to the output file.
+                long retainFrames = parser.get<int>("rf");
+                size_t retainBytes = static_cast<size_t>(parser.get<int>("rm")) * 1024 * 1024;
+                bool hasRetention = retainFrames > 0 || retainBytes > 0;
+                if (!outputFilePath.empty() && hasRetention) {
+                    trackerLog.setRetention(retainFrames,
+                                            retainBytes,
+                                            outputFilePath,
+                                            static_cast<size_t>(parser.get<int>("sm")) * 1024 * 1024);
+                } else if (!outputFilePath.empty()) {
                     outputFile.open(outputFilePath);
                 }
                 
+                // Recover the journal left behind by a previous run (dropping any partial record),
+                // and keep appending to it.
+                std::string journalPath = parser.get<std::string>("j");
+                OT::TrackJournal journal(parser.get<int>("ji"));
+                std::vector<OT::Track> frameTracks;
+                if (!journalPath.empty()) {
+                    int journalWidth = 0;
+                    int journalHeight = 0;
+                    std::vector<OT::Track> recoveredTracks;
+                    frameNumber = OT::TrackJournal::recover(journalPath, recoveredTracks, journalWidth, journalHeight);
+                    if (!outputFilePath.empty()) {
+                        // The input may have nothing left after the journal, in which case
+                        // these are the only dimensions the log gets.
+                        if (journalWidth > 0 && journalHeight > 0) {
+                            trackerLog.setDimensions(journalWidth, journalHeight);
+                        }
+                        for (auto track : recoveredTracks) {
+                            trackerLog.addTrack(track.trackerId, track.x, track.y, track.frameNumber);
+                        }
+                    }
+                    if (frameNumber > 0) {
+                        std::cout << "Recovered the journal up to frame " << frameNumber << std::endl;
+                    }
+                    if (!journal.open(journalPath)) {
+                        std::cerr << "Problem opening journal " << journalPath << std::endl;
+                    }
+                }
+                
+                // The occupancy heatmap is also created once we know the frame size.
+                std::string heatmapPath = parser.get<std::string>("hm");
+                std::unique_ptr<OT::OccupancyMap> occupancyMap = nullptr;
+                
+                // So is the zone analyzer, which rasterizes the zones at the frame size.
+                std::string zonesPath = parser.get<std::string>("z");
+                std::unique_ptr<OT::ZoneAnalyzer> zoneAnalyzer = nullptr;
+                std::vector<OT::ZoneEvent> zoneEvents;
+                
                 // Ensure that the video has been opened correctly.
-                if(!capture.isOpened()) {
+                if(motionReader == nullptr && !capture.isOpened()) {
                     std::cerr << "Problem opening video source" << std::endl;
                 }
                 
+                // The journal already holds the frames up to frameNumber, so carry on from the
+                // next frame of a file instead of tracking it from the start again. A webcam
+                // just keeps counting.
+                if (frameNumber > 0 && parser.get<int>("w") == -1) {
+                    long skipped = 0;
+                    if (motionReader != nullptr) {
+                        while (skipped < frameNumber && motionReader->read(frame, motionBlocks)) {
+                            skipped++;
+                        }
+                    } else if (capture.isOpened()) {
+                        while (skipped < frameNumber && capture.grab()) {
+                            skipped++;
+                        }
+                    }
+                    std::cout << "Skipped the " << skipped << " frames of the input in the journal" << std::endl;
+                }
+                
                 // Set the mouse callback.
                 cv::namedWindow("Video");
                 cv::namedWindow("Original");
@@ -114,51 +273,153 @@ namespace OT {
                 
                 
                 // Repeat while the user has not pressed "q" and while there's another frame.
-                while(OT::Utils::hasFrame(capture)) {
-                    // Fetch the next frame.
+                // Fetch the next frame.
+                auto nextFrame = [&]() {
+                    OT::Instrumentation::StageScope scope(OT::Instrumentation::Capture);
+                    if (motionReader != nullptr) {
+                        return OT::Utils::hasFrame(*motionReader, frame, motionBlocks);
+                    }
+                    if (!OT::Utils::hasFrame(capture)) {
+                        return false;
+                    }
                     capture.retrieve(frame);
+                    return true;
+                };
+                
+                // Count the heap allocations of every stage, if the tracker was built to.
+                OT::Instrumentation::AllocationReport allocationReport;
+                OT::Instrumentation::PerfReport perfReport;
+                
+                // The results of every frame are broadcast to the sinks, which log and analyze
+                // them on their own threads, so that they don't hold up the frames.
+                OT::ResultBus resultBus(static_cast<size_t>(std::max(1, parser.get<int>("rb"))));
+                if (!outputFilePath.empty() || !journalPath.empty()) {
+                    resultBus.addSink("log sink", OT::ResultBus::Block, [&](const OT::ResultBatch& batch) {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Logging);
+                        trackerLog.setDimensions(batch.width, batch.height);
+                        frameTracks.clear();
+                        for (const auto& pred : batch.predictions) {
+                            // Update the tracker log.
+                            if (!outputFilePath.empty()) {
+                                trackerLog.addTrack(pred.id, pred.location.x, pred.location.y, batch.frameNumber);
+                            }
+                            frameTracks.push_back(OT::Track{pred.id, pred.location.x, pred.location.y, batch.frameNumber});
+                        }
+                        
+                        // Journal the tracks of this frame.
+                        if (!journalPath.empty()) {
+                            journal.append(batch.frameNumber, batch.width, batch.height, frameTracks);
+                        }
+                    });
+                }
+                
+                // Live analytics can afford to skip frames rather than slow the tracker down.
+                if (!heatmapPath.empty() || !zonesPath.empty()) {
+                    OT::ResultBus::Policy policy = parser.get<bool>("ad") ? OT::ResultBus::Drop : OT::ResultBus::Block;
+                    resultBus.addSink("analytics sink", policy, [&](const OT::ResultBatch& batch) {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Analytics);
+                        cv::Size frameSize(batch.width, batch.height);
+                        if (occupancyMap == nullptr && !heatmapPath.empty()) {
+                            occupancyMap = std::make_unique<OT::OccupancyMap>(frameSize,
+                                                                              parser.get<int>("hc"),
+                                                                              heatmapPath,
+                                                                              parser.get<int>("hi"));
+                        }
+                        if (zoneAnalyzer == nullptr && !zonesPath.empty()) {
+                            zoneAnalyzer = std::make_unique<OT::ZoneAnalyzer>(frameSize);
+                            if (!zoneAnalyzer->load(zonesPath)) {
+                                std::cerr << "Problem loading zones from " << zonesPath << std::endl;
+                            }
+                            std::string zoneEventsPath = parser.get<std::string>("ze");
+                            if (!zoneEventsPath.empty() && !zoneAnalyzer->openEventFile(zoneEventsPath)) {
+                                std::cerr << "Problem opening zone event file " << zoneEventsPath << std::endl;
+                            }
+                        }
+                        
+                        // Accumulate the heatmap.
+                        if (occupancyMap != nullptr) {
+                            occupancyMap->update(batch.predictions, batch.frameNumber);
+                        }
+                        
+                        // Find the zone and line events.
+                        if (zoneAnalyzer != nullptr) {
+                            zoneAnalyzer->update(batch.predictions, batch.frameNumber, zoneEvents);
+                        }
+                    });
+                }
+                
+                while(nextFrame()) {
+                    OT::Instrumentation::TraceScope frameTrace("frame");
                     frameNumber++;
                     
-                    imshow("Original", frame);
-                    
-                    // Do the perspective transform.
-                    if (!points.empty()) {
-                        cv::warpPerspective(frame, frame, perspectiveMatrix, perspectiveSize);
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Display);
+                        imshow("Original", frame);
                     }
                     
-                    // Scale the image.
-                    OT::Utils::scale(frame, maxDimension);
+                    // Correct the geometry of the frame, or just scale it.
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Correction);
+                        if (geometryMap.isEnabled()) {
+                            geometryMap.correct(frame);
+                        } else {
+                            OT::Utils::scale(frame, maxDimension);
+                        }
+                    }
                     
                     // Create the tracker if it isn't created yet.
                     if (tracker == nullptr) {
                         tracker = std::make_unique<OT::MultiObjectTracker>(cv::Size(frame.rows, frame.cols));
                     }
                     
-                    // Set the frame dimension.
-                    trackerLog.setDimensions(frame.cols, frame.rows);
-                    
                     // Find the contours.
                     std::vector<cv::Point2f> mc(contours.size());
                     std::vector<cv::Rect> boundRect(contours.size());
-                    contourFinder.findContours(frame, hierarchy, contours, mc, boundRect);
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Detection);
+                        if (motionReader != nullptr && motionMode == "blocks") {
+                            contourFinder.findMotionContours(motionBlocks, frame.size(), contours, mc, boundRect);
+                        } else {
+                            if (motionReader != nullptr) {
+                                contourFinder.setMotionBlocks(motionBlocks);
+                            }
+                            contourFinder.findContours(frame, hierarchy, contours, mc, boundRect);
+                        }
+                    }
                     
-                    OT::DrawUtils::contourShow("Contours", contours, boundRect, frame.size());
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Display);
+                        OT::DrawUtils::contourShow("Contours", contours, boundRect, frame.size());
+                    }
                     
                     // Update the predicted locations of the objects based on the observed
                     // mass centers.
                     std::vector<OT::TrackingOutput> predictions;
-                    tracker->update(mc, boundRect, predictions);
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Tracking);
+                        tracker->update(mc, boundRect, predictions);
+                    }
                     
-                    for (auto pred : predictions) {
-                        // Draw a cross at the location of the prediction.
-                        OT::DrawUtils::drawCross(frame, pred.location, pred.color, 5);
-                        
-                        // Draw the trajectory for the prediction.
-                        OT::DrawUtils::drawTrajectory(frame, pred.trajectory, pred.color);
-                        
-                        // Update the tracker log.
-                        if (!outputFilePath.empty()) {
-                            trackerLog.addTrack(pred.id, pred.location.x, pred.location.y, frameNumber);
+                    // Hand the results to the sinks, waiting for a blocking sink if it is a whole
+                    // result buffer behind.
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Logging);
+                        OT::ResultBatch& batch = resultBus.prepare();
+                        batch.frameNumber = frameNumber;
+                        batch.width = frame.cols;
+                        batch.height = frame.rows;
+                        batch.predictions = predictions;
+                        resultBus.publish();
+                    }
+                    
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Display);
+                        for (const auto& pred : predictions) {
+                            // Draw a cross at the location of the prediction.
+                            OT::DrawUtils::drawCross(frame, pred.location, pred.color, 5);
+                            
+                            // Draw the trajectory for the prediction.
+                            OT::DrawUtils::drawTrajectory(frame, pred.trajectory, pred.color);
                         }
                     }
                     
@@ -172,15 +433,59 @@ namespace OT {
                         contourFinder.suppressRectangle(cv::Rect(point1, point2));
                     }
                     
-                    imshow("Video", frame);
+                    {
+                        OT::Instrumentation::StageScope scope(OT::Instrumentation::Display);
+                        imshow("Video", frame);
+                    }
+                    
+                    allocationReport.nextFrame();
+                    perfReport.nextFrame();
+                    
+                    // Write the trace if it was asked for with SIGUSR1.
+                    OT::Instrumentation::pollTraceRequest();
+                }
+                
+                // Let the sinks catch up before their outputs are closed.
+                resultBus.close();
+                if (!resultBus.stats().empty()) {
+                    resultBus.print(std::cout);
+                }
+                
+                if (OT::Instrumentation::allocationTrackingEnabled()) {
+                    allocationReport.print(std::cout);
                 }
+                if (OT::Instrumentation::perfCountersEnabled()) {
+                    perfReport.print(std::cout);
+                }
+                
                 
+                journal.close();
+                contourFinder.saveActivityMap();
+                if (occupancyMap != nullptr) {
+                    occupancyMap->snapshot();
+                }
+                if (zoneAnalyzer != nullptr) {
+                    zoneAnalyzer->close();
+                    zoneAnalyzer->printSummary(std::cout);
+                }
                 
                 // Log the output file if we need to.
-                if (!outputFilePath.empty()) {
+                if (!outputFilePath.empty() && hasRetention) {
+                    trackerLog.flushToSegments();
+                    std::cout << "Wrote segments to " << outputFilePath
+                              << ".*.seg, run the merger mode to get the JSON" << std::endl;
+                } else if (!outputFilePath.empty()) {
                     trackerLog.logToFile(outputFile);
                     outputFile.close();
                 }
+                
+                if (!tracePath.empty()) {
+                    if (OT::Instrumentation::writeTrace()) {
+                        std::cout << "Wrote the trace to " << tracePath << std::endl;
+                    } else {
+                        std::cerr << "Problem writing the trace to " << tracePath << std::endl;
+                    }
+                }
             } // run
         } // Tracking
     } // Mode
@@ -0,0 +1,119 @@
+#include "tracker/activity_map.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lib/json.hpp"
+#include "utils/async_io.hpp"
+
+namespace OT {
+    ActivityMap::ActivityMap(const std::string& path,
+                             long warmupFrames,
+                             long probeInterval,
+                             double minActivity,
+                             long saveInterval) {
+        this->path = path;
+        this->saveInterval = saveInterval;
+        this->tileSize = 0;
+        this->numFrames = 0;
+        this->warmupFrames = warmupFrames;
+        this->probeInterval = std::max(1L, probeInterval);
+        this->minActivity = minActivity;
+    }
+    
+    void ActivityMap::reset(int tileSize, cv::Size frameSize, int numTiles) {
+        this->tileSize = tileSize;
+        this->frameSize = frameSize;
+        this->numFrames = 0;
+        this->observedFrames = std::vector<long>(numTiles, 0);
+        this->activeFrames = std::vector<long>(numTiles, 0);
+        if (this->load()) {
+            std::cout << "Loaded the activity map " << this->path << " after " << this->numFrames << " frames" << std::endl;
+        }
+    }
+    
+    bool ActivityMap::isDormant(int tile) const {
+        if (this->numFrames < this->warmupFrames) {
+            return false;
+        }
+        long observed = this->observedFrames[tile];
+        return observed > 0 && this->activeFrames[tile] <= this->minActivity * observed;
+    }
+    
+    bool ActivityMap::shouldProcess(int tile) const {
+        return !this->isDormant(tile) || this->numFrames % this->probeInterval == 0;
+    }
+    
+    void ActivityMap::record(int tile, bool hadForeground) {
+        this->observedFrames[tile]++;
+        if (hadForeground) {
+            this->activeFrames[tile]++;
+        }
+    }
+    
+    void ActivityMap::nextFrame() {
+        this->numFrames++;
+        if (this->saveInterval > 0 && this->numFrames % this->saveInterval == 0) {
+            this->save();
+        }
+    }
+    
+    bool ActivityMap::load() {
+        if (this->path.empty()) {
+            return false;
+        }
+        std::ifstream activityFile(this->path);
+        if (!activityFile.is_open()) {
+            return false;
+        }
+        nlohmann::json json;
+        try {
+            activityFile >> json;
+        } catch (const std::exception& e) {
+            std::cerr << "Problem parsing " << this->path << ": " << e.what() << std::endl;
+            return false;
+        }
+        
+        // The counts are only meaningful for the same tiles.
+        if (json["tileSize"].get<int>() != this->tileSize
+            || json["width"].get<int>() != this->frameSize.width
+            || json["height"].get<int>() != this->frameSize.height
+            || json["observedFrames"].size() != this->observedFrames.size()) {
+            std::cerr << "Ignoring the activity map " << this->path << ", which has a different tile layout" << std::endl;
+            return false;
+        }
+        this->numFrames = json["numFrames"].get<long>();
+        this->observedFrames = json["observedFrames"].get<std::vector<long>>();
+        this->activeFrames = json["activeFrames"].get<std::vector<long>>();
+        return true;
+    }
+    
+    void ActivityMap::save() const {
+        if (this->path.empty()) {
+            return;
+        }
+        nlohmann::json json;
+        json["tileSize"] = this->tileSize;
+        json["width"] = this->frameSize.width;
+        json["height"] = this->frameSize.height;
+        json["numFrames"] = this->numFrames;
+        json["observedFrames"] = this->observedFrames;
+        json["activeFrames"] = this->activeFrames;
+        
+        // Write to a temporary file and rename it, so a crash never leaves a partial map.
+        std::string temporaryPath = this->path + ".tmp";
+        OT::AsyncIO::Sink sink;
+        if (!sink.open(temporaryPath)) {
+            std::cerr << "Problem writing the activity map " << temporaryPath << std::endl;
+            return;
+        }
+        sink.write(json.dump());
+        if (sink.close()) {
+            std::rename(temporaryPath.c_str(), this->path.c_str());
+        }
+    }
+}
@@ -0,0 +1,355 @@
+#include "tracker/bit_mask.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace OT {
+    BitMask::BitMask(int rows, int cols) {
+        this->rows = rows;
+        this->cols = cols;
+        this->stride = (cols + 63) / 64;
+        this->words = std::vector<uint64_t>(static_cast<size_t>(rows) * this->stride, 0);
+    }
+    
+    int BitMask::getRows() const {
+        return this->rows;
+    }
+    
+    int BitMask::getCols() const {
+        return this->cols;
+    }
+    
+    cv::Size BitMask::size() const {
+        return cv::Size(this->cols, this->rows);
+    }
+    
+    const uint64_t* BitMask::row(int y) const {
+        return this->words.data() + static_cast<size_t>(y) * this->stride;
+    }
+    
+    uint64_t* BitMask::row(int y) {
+        return this->words.data() + static_cast<size_t>(y) * this->stride;
+    }
+    
+    int BitMask::wordsPerRow() const {
+        return this->stride;
+    }
+    
+    void BitMask::clearPadding() {
+        int tailBits = this->cols % 64;
+        if (tailBits == 0) {
+            return;
+        }
+        uint64_t keep = (uint64_t(1) << tailBits) - 1;
+        for (int y = 0; y < this->rows; y++) {
+            this->row(y)[this->stride - 1] &= keep;
+        }
+    }
+    
+    void BitMask::threshold(const cv::Mat& src, int thresh) {
+        CV_Assert(src.type() == CV_8UC1);
+        if (src.rows != this->rows || src.cols != this->cols) {
+            *this = BitMask(src.rows, src.cols);
+        }
+        for (int y = 0; y < this->rows; y++) {
+            const uint8_t* pixels = src.ptr<uint8_t>(y);
+            uint64_t* out = this->row(y);
+            std::fill(out, out + this->stride, 0);
+            int x = 0;
+#ifdef __SSE2__
+            // Compare 16 pixels at a time. SSE2 only has signed compares, so flip the sign bits.
+            const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+            const __m128i limit = _mm_set1_epi8(static_cast<char>(std::min(255, std::max(0, thresh)) ^ 0x80));
+            for (; x + 16 <= this->cols; x += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x));
+                __m128i greater = _mm_cmpgt_epi8(_mm_xor_si128(v, flip), limit);
+                uint64_t bits = static_cast<uint16_t>(_mm_movemask_epi8(greater));
+                out[x / 64] |= bits << (x % 64);
+            }
+#endif
+            for (; x < this->cols; x++) {
+                if (pixels[x] > thresh) {
+                    out[x / 64] |= uint64_t(1) << (x % 64);
+                }
+            }
+        }
+    }
+    
+    // The bits of a row combined with their left and right neighbours. Bits past either
+    // end of the row count as fill (all ones or all zeros).
+    template <bool IsDilate>
+    static inline uint64_t combineNeighbours(const uint64_t* row, int i, int stride, uint64_t fill) {
+        uint64_t word = row[i];
+        uint64_t previous = i > 0 ? row[i - 1] : fill;
+        uint64_t next = i + 1 < stride ? row[i + 1] : fill;
+        uint64_t left = (word << 1) | (previous >> 63);
+        uint64_t right = (word >> 1) | (next << 63);
+        return IsDilate ? (word | left | right) : (word & left & right);
+    }
+    
+    // A 3x3 dilation or erosion. It is separable, so combine each row horizontally and
+    // then combine the rows above and below.
+    template <bool IsDilate>
+    static void morph3x3(const BitMask& src, BitMask& dst, int cols) {
+        int rows = src.getRows();
+        int stride = src.wordsPerRow();
+        if (dst.getRows() != rows || dst.getCols() != cols) {
+            dst = BitMask(rows, cols);
+        }
+        if (rows == 0 || stride == 0) {
+            return;
+        }
+        
+        // Outside the image, the erosion treats pixels as set. The padding bits of the
+        // last word are zero, so set them while combining.
+        uint64_t fill = IsDilate ? 0 : ~uint64_t(0);
+        int tailBits = cols % 64;
+        uint64_t padding = (IsDilate || tailBits == 0) ? 0 : ~((uint64_t(1) << tailBits) - 1);
+        
+        std::vector<uint64_t> above(stride), current(stride), below(stride), padded(stride);
+        auto horizontal = [&](int y, std::vector<uint64_t>& out) {
+            if (y < 0 || y >= rows) {
+                std::fill(out.begin(), out.end(), fill);
+                return;
+            }
+            std::copy(src.row(y), src.row(y) + stride, padded.begin());
+            padded[stride - 1] |= padding;
+            for (int i = 0; i < stride; i++) {
+                out[i] = combineNeighbours<IsDilate>(padded.data(), i, stride, fill);
+            }
+        };
+        horizontal(-1, above);
+        horizontal(0, current);
+        for (int y = 0; y < rows; y++) {
+            horizontal(y + 1, below);
+            uint64_t* out = dst.row(y);
+            for (int i = 0; i < stride; i++) {
+                out[i] = IsDilate ? (above[i] | current[i] | below[i]) : (above[i] & current[i] & below[i]);
+            }
+            std::swap(above, current);
+            std::swap(current, below);
+        }
+        if (tailBits != 0) {
+            uint64_t keep = (uint64_t(1) << tailBits) - 1;
+            for (int y = 0; y < rows; y++) {
+                dst.row(y)[stride - 1] &= keep;
+            }
+        }
+    }
+    
+    void BitMask::dilate(BitMask& dst) const {
+        morph3x3<true>(*this, dst, this->cols);
+    }
+    
+    void BitMask::erode(BitMask& dst) const {
+        morph3x3<false>(*this, dst, this->cols);
+    }
+    
+    // Add a one-bit number to each lane of a bit-sliced counter.
+    static inline void addBit(uint64_t* planes, int numPlanes, uint64_t bit) {
+        for (int i = 0; i < numPlanes && bit != 0; i++) {
+            uint64_t carry = planes[i] & bit;
+            planes[i] ^= bit;
+            bit = carry;
+        }
+    }
+    
+    void BitMask::majority(BitMask& dst, int size) const {
+        CV_Assert(size % 2 == 1 && size > 0 && size < 64);
+        if (dst.rows != this->rows || dst.cols != this->cols) {
+            dst = BitMask(this->rows, this->cols);
+        }
+        if (this->rows == 0 || this->cols == 0) {
+            return;
+        }
+        int radius = size / 2;
+        int threshold = (size * size + 1) / 2;
+        
+        // The column sums hold up to size (< 64) per lane, so at most 6 planes, and the
+        // window sums up to size^2 (< 4096), so at most 12 planes. Only use as many planes
+        // as the size needs.
+        const int kColumnPlanes = 6;
+        const int kWindowPlanes = 12;
+        int columnPlanes = 0;
+        while ((size >> columnPlanes) != 0) {
+            columnPlanes++;
+        }
+        int windowPlanes = 0;
+        while (((size * size) >> windowPlanes) != 0) {
+            windowPlanes++;
+        }
+        
+        // The column sums of a row, bit-sliced, with a word of padding on each side that
+        // replicates the first and last columns.
+        int paddedStride = this->stride + 2;
+        std::vector<uint64_t> columnSums(static_cast<size_t>(kColumnPlanes) * paddedStride);
+        int lastBit = (this->cols - 1) % 64;
+        
+        for (int y = 0; y < this->rows; y++) {
+            // Sum each column over the rows of the window, replicating the top and bottom rows.
+            std::fill(columnSums.begin(), columnSums.end(), 0);
+            for (int dy = -radius; dy <= radius; dy++) {
+                const uint64_t* src = this->row(std::min(this->rows - 1, std::max(0, y + dy)));
+                for (int i = 0; i < this->stride; i++) {
+                    uint64_t planes[kColumnPlanes];
+                    for (int p = 0; p < columnPlanes; p++) {
+                        planes[p] = columnSums[p * paddedStride + i + 1];
+                    }
+                    addBit(planes, columnPlanes, src[i]);
+                    for (int p = 0; p < columnPlanes; p++) {
+                        columnSums[p * paddedStride + i + 1] = planes[p];
+                    }
+                }
+            }
+            
+            // Replicate the first and last columns into the padding, including the bits past
+            // the last column.
+            for (int p = 0; p < columnPlanes; p++) {
+                uint64_t* plane = columnSums.data() + p * paddedStride;
+                uint64_t first = plane[1] & 1 ? ~uint64_t(0) : 0;
+                uint64_t last = (plane[this->stride] >> lastBit) & 1 ? ~uint64_t(0) : 0;
+                plane[0] = first;
+                plane[this->stride + 1] = last;
+                if (lastBit != 63) {
+                    uint64_t keep = (uint64_t(1) << (lastBit + 1)) - 1;
+                    plane[this->stride] = (plane[this->stride] & keep) | (last & ~keep);
+                }
+            }
+            
+            // Add up the column sums across the window, one shifted copy at a time, with a
+            // bit-sliced ripple-carry adder.
+            uint64_t* out = dst.row(y);
+            for (int i = 0; i < this->stride; i++) {
+                uint64_t sum[kWindowPlanes] = {0};
+                for (int dx = -radius; dx <= radius; dx++) {
+                    uint64_t carry = 0;
+                    for (int p = 0; p < windowPlanes; p++) {
+                        uint64_t addend = 0;
+                        if (p < columnPlanes) {
+                            // The column sums of pixels x + dx, lined up with pixels x.
+                            const uint64_t* plane = columnSums.data() + p * paddedStride + i + 1;
+                            if (dx > 0) {
+                                addend = (plane[0] >> dx) | (plane[1] << (64 - dx));
+                            } else if (dx < 0) {
+                                addend = (plane[0] << -dx) | (plane[-1] >> (64 + dx));
+                            } else {
+                                addend = plane[0];
+                            }
+                        }
+                        uint64_t a = sum[p];
+                        sum[p] = a ^ addend ^ carry;
+                        carry = (a & addend) | (carry & (a ^ addend));
+                    }
+                }
+                
+                // Compare each lane's sum with the threshold, from the most significant bit.
+                uint64_t greater = 0;
+                uint64_t equal = ~uint64_t(0);
+                for (int p = windowPlanes - 1; p >= 0; p--) {
+                    if ((threshold >> p) & 1) {
+                        equal &= sum[p];
+                    } else {
+                        greater |= equal & sum[p];
+                        equal &= ~sum[p];
+                    }
+                }
+                out[i] = greater | equal;
+            }
+        }
+        dst.clearPadding();
+    }
+    
+    void BitMask::andWith(const BitMask& other) {
+        CV_Assert(other.rows == this->rows && other.cols == this->cols);
+        for (size_t i = 0; i < this->words.size(); i++) {
+            this->words[i] &= other.words[i];
+        }
+    }
+    
+    void BitMask::clearRect(cv::Rect rect) {
+        rect &= cv::Rect(0, 0, this->cols, this->rows);
+        if (rect.width <= 0 || rect.height <= 0) {
+            return;
+        }
+        for (int y = rect.y; y < rect.y + rect.height; y++) {
+            uint64_t* words = this->row(y);
+            for (int x = rect.x; x < rect.x + rect.width;) {
+                // Clear as much of the rectangle as falls in this word.
+                int bit = x % 64;
+                int n = std::min(64 - bit, rect.x + rect.width - x);
+                uint64_t bits = n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1) << bit;
+                words[x / 64] &= ~bits;
+                x += n;
+            }
+        }
+    }
+    
+    bool BitMask::anyIn(cv::Rect rect) const {
+        rect &= cv::Rect(0, 0, this->cols, this->rows);
+        if (rect.width <= 0 || rect.height <= 0) {
+            return false;
+        }
+        for (int y = rect.y; y < rect.y + rect.height; y++) {
+            const uint64_t* words = this->row(y);
+            for (int x = rect.x; x < rect.x + rect.width;) {
+                int bit = x % 64;
+                int n = std::min(64 - bit, rect.x + rect.width - x);
+                uint64_t bits = n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1) << bit;
+                if (words[x / 64] & bits) {
+                    return true;
+                }
+                x += n;
+            }
+        }
+        return false;
+    }
+    
+    long BitMask::count() const {
+        long total = 0;
+        for (uint64_t word : this->words) {
+            total += __builtin_popcountll(word);
+        }
+        return total;
+    }
+    
+    void BitMask::toMat(cv::Mat& dst) const {
+        dst.create(this->rows, this->cols, CV_8UC1);
+        
+        // Expand a byte of bits into eight bytes of pixels with a table. The words are read
+        // byte by byte, which puts the pixels in order on little-endian machines.
+        static const std::vector<uint64_t> expand = []() {
+            std::vector<uint64_t> table(256);
+            for (int b = 0; b < 256; b++) {
+                uint64_t pixels = 0;
+                for (int bit = 0; bit < 8; bit++) {
+                    if ((b >> bit) & 1) {
+                        pixels |= uint64_t(0xff) << (8 * bit);
+                    }
+                }
+                table[b] = pixels;
+            }
+            return table;
+        }();
+        
+        for (int y = 0; y < this->rows; y++) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(this->row(y));
+            uint8_t* pixels = dst.ptr<uint8_t>(y);
+            int x = 0;
+            for (; x + 8 <= this->cols; x += 8) {
+                uint64_t expanded = expand[bytes[x / 8]];
+                std::memcpy(pixels + x, &expanded, 8);
+            }
+            for (; x < this->cols; x++) {
+                pixels[x] = (this->row(y)[x / 64] >> (x % 64)) & 1 ? 255 : 0;
+            }
+        }
+    }
+}
@@ -1,12 +1,19 @@
 #include "tracker/contour_finder.hpp"
 
+#include <algorithm>
+#include <fstream>
+#include <iostream>
 #include <numeric>
+#include <string>
 #include <unordered_map>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/video/tracking.hpp>
 
 #include "lib/disjoint_set.hpp"
+#include "lib/json.hpp"
+#include "tracker/contour_stats.hpp"
+#include "utils/instrumentation.hpp"
 
 namespace OT {
     ContourFinder::ContourFinder(int history,
@@ -14,15 +21,255 @@ namespace OT {
                                  float contourSizeThreshold,
                                  int medianFilterSize,
                                  float contourMergeThreshold) {
-        this->bg = cv::createBackgroundSubtractorMOG2();
-        this->bg->setHistory(history);
-        this->bg->setNMixtures(nMixtures);
-        this->bg->setDetectShadows(true);
-        this->bg->setShadowThreshold(0.7);
+        this->history = history;
+        this->nMixtures = nMixtures;
+        this->tileSize = 0;
+        this->updateInterval = 1;
+        this->coarseScale = 1;
+        this->fineFrames = 0;
+        this->fineThreshold = 30;
         this->suppressRectangles = std::vector<cv::Rect>();
         this->contourSizeThreshold = contourSizeThreshold;
         this->medianFilterSize = medianFilterSize;
         this->contourMergeThreshold = contourMergeThreshold;
+        this->useRunLabeling = false;
+        this->showForeground = true;
+        this->bandRows = 0;
+    }
+    
+    cv::Ptr<cv::BackgroundSubtractorMOG2> ContourFinder::createModel() const {
+        auto bg = cv::createBackgroundSubtractorMOG2();
+        bg->setHistory(this->history);
+        bg->setNMixtures(this->nMixtures);
+        bg->setDetectShadows(true);
+        bg->setShadowThreshold(0.7);
+        return bg;
+    }
+    
+    void ContourFinder::setupTiles(cv::Size size) {
+        this->frameSize = size;
+        this->tiles.clear();
+        this->tileModels.clear();
+        int step = this->tileSize > 0 ? std::max(16, this->tileSize / this->coarseScale) : std::max(size.width, size.height);
+        for (int y = 0; y < size.height; y += step) {
+            for (int x = 0; x < size.width; x += step) {
+                this->tiles.push_back(cv::Rect(x, y, std::min(step, size.width - x), std::min(step, size.height - y)));
+                this->tileModels.push_back(this->createModel());
+            }
+        }
+        this->tileFrames = std::vector<long>(this->tiles.size(), 0);
+        this->tileBackgrounds = std::vector<cv::Mat>(this->tiles.size());
+        this->tileUpdateFrames = std::vector<cv::Mat>(this->tiles.size());
+        this->tileUpdateForegrounds = std::vector<cv::Mat>(this->tiles.size());
+        this->bandRows = this->tiles.size() > 1 ? step : 0;
+        
+        // Only the tiles that touch the region of interest are ever processed.
+        this->roiPixels = cv::Mat();
+        if (!this->roiPolygons.empty()) {
+            // The polygons are given in pixels of the full frame.
+            std::vector<std::vector<cv::Point>> polygons = this->roiPolygons;
+            for (auto& polygon : polygons) {
+                for (auto& pt : polygon) {
+                    pt = cv::Point(pt.x / this->coarseScale, pt.y / this->coarseScale);
+                }
+            }
+            this->roiPixels = cv::Mat::zeros(size, CV_8U);
+            cv::fillPoly(this->roiPixels, polygons, cv::Scalar::all(255));
+        }
+        this->tileInRoi = std::vector<bool>(this->tiles.size(), true);
+        for (size_t i = 0; i < this->tiles.size(); i++) {
+            if (!this->roiPixels.empty()) {
+                this->tileInRoi[i] = cv::countNonZero(this->roiPixels(this->tiles[i])) > 0;
+            }
+        }
+        this->tileActive = this->tileInRoi;
+        if (this->activityMap != nullptr) {
+            this->activityMap->reset(this->tileSize, size, static_cast<int>(this->tiles.size()));
+        }
+        this->foreground = cv::Mat::zeros(size, CV_8U);
+        this->updateActiveRect();
+    }
+    
+    void ContourFinder::updateActiveRect() {
+        this->activeRect = cv::Rect();
+        for (size_t i = 0; i < this->tiles.size(); i++) {
+            if (this->tileActive[i]) {
+                this->activeRect = this->activeRect.area() > 0 ? (this->activeRect | this->tiles[i]) : this->tiles[i];
+            }
+        }
+        if (this->activeRect.area() == 0) {
+            return;
+        }
+        
+        // Pad the region by how far the median filter and the dilations reach, so that the
+        // filters give the same result as they would over the whole frame.
+        int margin = this->medianFilterSize / 2 + 4;
+        this->activeRect = cv::Rect(this->activeRect.x - margin,
+                                    this->activeRect.y - margin,
+                                    this->activeRect.width + 2 * margin,
+                                    this->activeRect.height + 2 * margin);
+        this->activeRect &= cv::Rect(cv::Point(0, 0), this->frameSize);
+        
+        if (!this->roiPixels.empty()) {
+            this->roiMask.threshold(this->roiPixels(this->activeRect), 0);
+        }
+        this->filtered = cv::Mat::zeros(this->frameSize, CV_8U);
+    }
+    
+    /**
+     * MOG2's own learning rate after n frames is 1 / min(2n, history). Scale it by the
+     * update interval so that a model that is only updated every interval frames still
+     * adapts as fast per frame of video.
+     */
+    double scaledLearningRate(long n, int updateInterval, int history) {
+        long window = std::min(2 * n, static_cast<long>(history));
+        return std::min(1.0, static_cast<double>(updateInterval) / window);
+    }
+    
+    double ContourFinder::learningRate(size_t tile) {
+        long n = ++this->tileFrames[tile];
+        if (this->updateInterval == 1) {
+            // Let MOG2 pick its own rate.
+            return -1;
+        }
+        
+        // Spread the updates over the frames by offsetting each tile's turn by its index.
+        // The first frame always initializes the model.
+        if (n > 1 && (n + static_cast<long>(tile)) % this->updateInterval != 0) {
+            return 0;
+        }
+        return scaledLearningRate(n, this->updateInterval, this->history);
+    }
+    
+    void ContourFinder::classifyTile(size_t tile, const cv::Mat& frame, cv::Mat& foreground) const {
+        const cv::Mat& background = this->tileBackgrounds[tile];
+        const cv::Mat& updateFrame = this->tileUpdateFrames[tile];
+        const cv::Mat& updateForeground = this->tileUpdateForegrounds[tile];
+        const cv::Ptr<cv::BackgroundSubtractorMOG2>& model = this->tileModels[tile];
+        
+        // Two colors match if their squared distance is within varThreshold times the
+        // variance a new Gaussian starts with, which is how MOG2 matches a pixel to a
+        // Gaussian. The background image is the mean of the background Gaussians, so it
+        // only stands in for the model where the pixel has changed.
+        int threshold = static_cast<int>(model->getVarThreshold() * model->getVarInit());
+        double shadowThreshold = model->getShadowThreshold();
+        for (int y = 0; y < frame.rows; y++) {
+            const uchar* pixel = frame.ptr<uchar>(y);
+            const uchar* mean = background.ptr<uchar>(y);
+            const uchar* previous = updateFrame.ptr<uchar>(y);
+            const uchar* previousClass = updateForeground.ptr<uchar>(y);
+            uchar* out = foreground.ptr<uchar>(y);
+            for (int x = 0; x < frame.cols; x++, pixel += 3, mean += 3, previous += 3) {
+                int c0 = pixel[0] - previous[0];
+                int c1 = pixel[1] - previous[1];
+                int c2 = pixel[2] - previous[2];
+                if (c0 * c0 + c1 * c1 + c2 * c2 <= threshold) {
+                    out[x] = previousClass[x];
+                    continue;
+                }
+                int d0 = pixel[0] - mean[0];
+                int d1 = pixel[1] - mean[1];
+                int d2 = pixel[2] - mean[2];
+                if (d0 * d0 + d1 * d1 + d2 * d2 <= threshold) {
+                    out[x] = 0;
+                    continue;
+                }
+                
+                // A shadow is the background scaled down by a factor between the shadow
+                // threshold and 1, within the same distance.
+                int dot = pixel[0] * mean[0] + pixel[1] * mean[1] + pixel[2] * mean[2];
+                int norm = mean[0] * mean[0] + mean[1] * mean[1] + mean[2] * mean[2];
+                out[x] = 255;
+                if (norm > 0 && dot <= norm && dot >= shadowThreshold * norm) {
+                    double a = static_cast<double>(dot) / norm;
+                    double e0 = a * mean[0] - pixel[0];
+                    double e1 = a * mean[1] - pixel[1];
+                    double e2 = a * mean[2] - pixel[2];
+                    if (e0 * e0 + e1 * e1 + e2 * e2 < threshold * a * a) {
+                        out[x] = 127;
+                    }
+                }
+            }
+        }
+    }
+    
+    bool ContourFinder::tileHasMotion(size_t tile) const {
+        return this->motionPixels.empty() || cv::countNonZero(this->motionPixels(this->tiles[tile])) > 0;
+    }
+    
+    void ContourFinder::setMotionBlocks(const cv::Mat& blocks) {
+        this->motionBlocks = blocks;
+    }
+    
+    void ContourFinder::findMotionContours(const cv::Mat& blocks,
+                                           cv::Size size,
+                                           std::vector<std::vector<cv::Point>>& contours,
+                                           std::vector<cv::Point2f>& massCenters,
+                                           std::vector<cv::Rect>& boundingBoxes) {
+        this->diagonal = std::sqrt(size.width * size.width + size.height * size.height);
+        
+        // The blocks are traced at the size of the frame, so the contours are in its pixels.
+        cv::resize(blocks, this->motionPixels, size, 0, 0, cv::INTER_NEAREST);
+        cv::findContours(this->motionPixels, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+        this->motionPixels = cv::Mat();
+        
+        this->filterOutBadContours(contours);
+        this->getCentersAndBoundingBoxes(contours, massCenters, boundingBoxes);
+        this->suppressMassCenters(contours, massCenters, boundingBoxes);
+        this->mergeContours(contours, massCenters, boundingBoxes);
+        this->getCentersAndBoundingBoxes(contours, massCenters, boundingBoxes);
+    }
+    
+    void ContourFinder::setActivityMap(const std::string& path, long warmupFrames, long probeInterval) {
+        this->activityMap = std::make_unique<ActivityMap>(path, warmupFrames, probeInterval);
+        this->frameSize = cv::Size();
+    }
+    
+    void ContourFinder::saveActivityMap() const {
+        if (this->activityMap != nullptr) {
+            this->activityMap->save();
+        }
+    }
+    
+    void ContourFinder::setUpdateInterval(int updateInterval) {
+        this->updateInterval = std::max(1, updateInterval);
+    }
+    
+    void ContourFinder::setCoarseScale(int coarseScale) {
+        this->coarseScale = std::max(1, coarseScale);
+        this->frameSize = cv::Size();
+    }
+    
+    void ContourFinder::setTileSize(int tileSize) {
+        this->tileSize = tileSize;
+    }
+    
+    void ContourFinder::setRegionOfInterest(const std::vector<std::vector<cv::Point>>& polygons) {
+        this->roiPolygons = polygons;
+        this->frameSize = cv::Size();
+    }
+    
+    bool ContourFinder::loadRegionOfInterest(const std::string& path) {
+        std::ifstream roiFile(path);
+        if (!roiFile.is_open()) {
+            return false;
+        }
+        nlohmann::json json;
+        try {
+            roiFile >> json;
+        } catch (const std::exception& e) {
+            std::cerr << "Problem parsing " << path << ": " << e.what() << std::endl;
+            return false;
+        }
+        std::vector<std::vector<cv::Point>> polygons;
+        for (const auto& polygon : json["polygons"]) {
+            polygons.push_back(std::vector<cv::Point>());
+            for (const auto& pt : polygon) {
+                polygons.back().push_back(cv::Point(pt[0].get<int>(), pt[1].get<int>()));
+            }
+        }
+        this->setRegionOfInterest(polygons);
+        return true;
     }
     
     cv::Point translate(cv::Rect rect, std::pair<int, int> widthHeight) {
@@ -95,24 +342,183 @@ namespace OT {
         contours.clear();
         hierarchy.clear();
         
-        // Find the foreground.
-        this->bg->apply(frame, this->foreground);
-        cv::threshold(this->foreground, this->foreground, 130, 255, CV_THRESH_BINARY);
+        // In multi-scale mode, everything up to the blobs runs on a downscaled frame.
+        const cv::Mat* modelFrame = &frame;
+        if (this->coarseScale > 1) {
+            cv::resize(frame,
+                       this->coarseFrame,
+                       cv::Size(frame.cols / this->coarseScale, frame.rows / this->coarseScale),
+                       0,
+                       0,
+                       cv::INTER_AREA);
+            modelFrame = &this->coarseFrame;
+        }
+        
+        // Lay out the tiles once we know the frame size.
+        if (modelFrame->size() != this->frameSize) {
+            this->setupTiles(modelFrame->size());
+        }
+        
+        // Let the activity map and the motion of the codec decide which tiles are worth
+        // processing on this frame. The tiles that are dropped are cleared so that they
+        // don't leave stale foreground.
+        if (!this->motionBlocks.empty()) {
+            cv::resize(this->motionBlocks, this->motionPixels, this->frameSize, 0, 0, cv::INTER_NEAREST);
+        }
+        if (this->activityMap != nullptr || !this->motionBlocks.empty()) {
+            bool changed = false;
+            for (size_t i = 0; i < this->tiles.size(); i++) {
+                bool process = this->tileInRoi[i]
+                    && (this->activityMap == nullptr || this->activityMap->shouldProcess(static_cast<int>(i)))
+                    && this->tileHasMotion(i);
+                if (process != this->tileActive[i]) {
+                    this->tileActive[i] = process;
+                    changed = true;
+                    if (!process) {
+                        this->foreground(this->tiles[i]).setTo(cv::Scalar::all(0));
+                    }
+                }
+            }
+            if (changed) {
+                this->updateActiveRect();
+            }
+        }
+        if (this->activeRect.area() == 0) {
+            if (this->activityMap != nullptr) {
+                this->activityMap->nextFrame();
+            }
+            massCenters.clear();
+            boundingBoxes.clear();
+            return;
+        }
+        
+        // Find the foreground of each active tile. The other tiles are never modelled and
+        // stay empty.
+        // The tiles are independent, so they are modelled in parallel, and the workers count
+        // towards the stage of the caller.
+        {
+            Instrumentation::TraceScope trace("background");
+            Instrumentation::Stage stage = Instrumentation::currentStage();
+            cv::parallel_for_(cv::Range(0, static_cast<int>(this->tiles.size())), [this, modelFrame, stage](const cv::Range& range) {
+                Instrumentation::StageScope scope(stage);
+                Instrumentation::TraceScope trace("tiles");
+                for (int i = range.start; i < range.end; i++) {
+                    if (!this->tileActive[i]) {
+                        continue;
+                    }
+                    cv::Mat tileFrame = (*modelFrame)(this->tiles[i]);
+                    cv::Mat tileForeground = this->foreground(this->tiles[i]);
+                    double rate = this->learningRate(i);
+                    bool cached = !this->tileBackgrounds[i].empty() && tileFrame.type() == CV_8UC3;
+                    if (rate == 0 && cached) {
+                        this->classifyTile(i, tileFrame, tileForeground);
+                        continue;
+                    }
+                    this->tileModels[i]->apply(tileFrame, tileForeground, rate);
+                    if (this->updateInterval > 1) {
+                        this->tileModels[i]->getBackgroundImage(this->tileBackgrounds[i]);
+                        tileFrame.copyTo(this->tileUpdateFrames[i]);
+                        tileForeground.copyTo(this->tileUpdateForegrounds[i]);
+                    }
+                }
+            });
+        }
+        
+        // Threshold the active region into a bit mask (dropping the shadows), and clear
+        // whatever is outside the region of interest.
+        cv::Mat activeForeground = this->foreground(this->activeRect);
+        {
+            Instrumentation::TraceScope trace("threshold");
+            this->mask.threshold(activeForeground, 130);
+            if (!this->roiPolygons.empty()) {
+                this->mask.andWith(this->roiMask);
+            }
+        }
         
         // Get rid little specks of noise by doing a median blur.
         // The median blur is good for salt-and-pepper noise, not Gaussian noise.
-        cv::medianBlur(this->foreground, this->foreground, this->medianFilterSize);
+        // On a binary mask, the median is a majority vote.
+        {
+            Instrumentation::TraceScope trace("median");
+            this->mask.majority(this->scratchMask, this->medianFilterSize);
+        }
+        
+        // Record which tiles still have foreground once the noise is gone. Dormant tiles
+        // that are only being probed have stale models, so their foreground only counts
+        // towards waking them up, not as detections.
+        if (this->activityMap != nullptr) {
+            for (size_t i = 0; i < this->tiles.size(); i++) {
+                if (this->tileActive[i]) {
+                    cv::Rect tile = this->tiles[i] - this->activeRect.tl();
+                    bool probing = this->activityMap->isDormant(static_cast<int>(i));
+                    this->activityMap->record(static_cast<int>(i), this->scratchMask.anyIn(tile));
+                    if (probing) {
+                        this->scratchMask.clearRect(tile);
+                    }
+                }
+            }
+            this->activityMap->nextFrame();
+        }
         
         // Dilate the image to make the blobs larger.
-        cv::dilate(this->foreground, this->foreground, cv::Mat());
-        cv::dilate(this->foreground, this->foreground, cv::Mat());
-        cv::dilate(this->foreground, this->foreground, cv::Mat());
-        cv::dilate(this->foreground, this->foreground, cv::Mat());
+        cv::Mat activeFiltered = this->filtered(this->activeRect);
+        {
+            Instrumentation::TraceScope trace("dilate");
+            this->scratchMask.dilate(this->mask);
+            this->mask.dilate(this->scratchMask);
+            this->scratchMask.dilate(this->mask);
+            this->mask.dilate(this->scratchMask);
+            this->scratchMask.toMat(activeFiltered);
+        }
         
-        cv::imshow("foreground", this->foreground);
+        if (this->showForeground) {
+            cv::imshow("foreground", this->filtered);
+        }
+        
+        if (this->coarseScale > 1) {
+            this->updateFineBackground(frame);
+            
+            // Only the bounding boxes of the coarse blobs are needed.
+            std::vector<cv::Rect> coarseBoxes;
+            if (this->useRunLabeling) {
+                Instrumentation::TraceScope trace("labeling");
+                this->labeler.label(this->scratchMask, this->blobs, this->bandRows);
+                for (auto& blob : this->blobs) {
+                    blob.translate(this->activeRect.tl());
+                    coarseBoxes.push_back(blob.box);
+                }
+            } else {
+                Instrumentation::TraceScope trace("contours");
+                cv::findContours(activeFiltered, contours, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, this->activeRect.tl());
+                this->filterOutBadContours(contours);
+                for (const auto& contour : contours) {
+                    coarseBoxes.push_back(cv::boundingRect(contour));
+                }
+            }
+            
+            // Refine them at full resolution, and carry on with the fine contours.
+            {
+                Instrumentation::TraceScope trace("refine");
+                this->refineBlobs(frame, coarseBoxes, contours);
+            }
+            this->filterOutBadContours(contours);
+            this->getCentersAndBoundingBoxes(contours, massCenters, boundingBoxes);
+            this->suppressMassCenters(contours, massCenters, boundingBoxes);
+            this->mergeContours(contours, massCenters, boundingBoxes);
+            this->getCentersAndBoundingBoxes(contours, massCenters, boundingBoxes);
+            return;
+        }
+        
+        if (this->useRunLabeling) {
+            this->findBlobs(this->scratchMask, this->activeRect.tl(), contours, massCenters, boundingBoxes);
+            return;
+        }
         
         // Find the contours.
-        cv::findContours(this->foreground, contours, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+        {
+            Instrumentation::TraceScope trace("contours");
+            cv::findContours(activeFiltered, contours, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, this->activeRect.tl());
+        }
         
         // Keep only those contours that are sufficiently large.
         this->filterOutBadContours(contours);
@@ -124,12 +530,198 @@ namespace OT {
         this->suppressMassCenters(contours, massCenters, boundingBoxes);
         
         // Merge nearby contours.
-        this->mergeContours(contours, massCenters, boundingBoxes);
+        {
+            Instrumentation::TraceScope trace("merge");
+            this->mergeContours(contours, massCenters, boundingBoxes);
+        }
         
         // Now find the mass centers and bounding boxes again.
         this->getCentersAndBoundingBoxes(contours, massCenters, boundingBoxes);
     }
     
+    void ContourFinder::updateFineBackground(const cv::Mat& frame) {
+        long n = ++this->fineFrames;
+        if (this->fineBackground.size() != frame.size() || this->fineBackground.channels() != frame.channels()) {
+            frame.convertTo(this->fineBackground, CV_32F);
+            this->fineFrames = 1;
+            return;
+        }
+        
+        // Follow the same cadence as the background models.
+        if (n % this->updateInterval != 0) {
+            return;
+        }
+        
+        // Leave out whatever the coarse pass thinks is foreground, so the objects don't
+        // fade into the background.
+        cv::resize(this->filtered, this->coarseMaskUp, frame.size(), 0, 0, cv::INTER_NEAREST);
+        cv::bitwise_not(this->coarseMaskUp, this->fineScratch);
+        cv::accumulateWeighted(frame,
+                               this->fineBackground,
+                               scaledLearningRate(n, this->updateInterval, this->history),
+                               this->fineScratch);
+    }
+    
+    void ContourFinder::refineBlobs(const cv::Mat& frame,
+                                    const std::vector<cv::Rect>& coarseBoxes,
+                                    std::vector<std::vector<cv::Point>>& contours) {
+        contours.clear();
+        
+        // Pad each box by a coarse pixel, and combine the regions that overlap so that no
+        // part of the frame is looked at twice.
+        cv::Rect coarseFrameRect(cv::Point(0, 0), this->frameSize);
+        std::vector<cv::Rect> regions;
+        for (const auto& box : coarseBoxes) {
+            regions.push_back(cv::Rect(box.x - 1, box.y - 1, box.width + 2, box.height + 2) & coarseFrameRect);
+        }
+        for (bool merged = true; merged; ) {
+            merged = false;
+            for (size_t i = 0; i < regions.size() && !merged; i++) {
+                for (size_t j = i + 1; j < regions.size() && !merged; j++) {
+                    if ((regions[i] & regions[j]).area() > 0) {
+                        regions[i] |= regions[j];
+                        regions.erase(regions.begin() + j);
+                        merged = true;
+                    }
+                }
+            }
+        }
+        
+        cv::Rect fineFrameRect(cv::Point(0, 0), frame.size());
+        int scale = this->coarseScale;
+        std::vector<std::vector<cv::Point>> regionContours;
+        for (const auto& region : regions) {
+            cv::Rect fineRegion = cv::Rect(region.x * scale, region.y * scale, region.width * scale, region.height * scale) & fineFrameRect;
+            if (fineRegion.area() == 0) {
+                continue;
+            }
+            
+            // The pixels that differ enough from the fine background.
+            this->fineBackground(fineRegion).convertTo(this->fineScratch, CV_8U);
+            cv::absdiff(frame(fineRegion), this->fineScratch, this->fineScratch);
+            if (this->fineScratch.channels() == 3) {
+                cv::cvtColor(this->fineScratch, this->fineScratch, cv::COLOR_BGR2GRAY);
+            }
+            cv::threshold(this->fineScratch, this->fineMask, this->fineThreshold, 255, cv::THRESH_BINARY);
+            cv::medianBlur(this->fineMask, this->fineMask, 5);
+            
+            // Keep them within the (dilated) coarse foreground, which also drops the shadows
+            // and whatever is outside the region of interest.
+            cv::resize(this->filtered(region), this->coarseMaskUp, cv::Size(), scale, scale, cv::INTER_NEAREST);
+            cv::bitwise_and(this->fineMask,
+                            this->coarseMaskUp(cv::Rect(0, 0, fineRegion.width, fineRegion.height)),
+                            this->fineMask);
+            
+            regionContours.clear();
+            cv::findContours(this->fineMask, regionContours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, fineRegion.tl());
+            
+            // Specks smaller than a coarse pixel are noise.
+            bool found = false;
+            for (auto& contour : regionContours) {
+                if (cv::contourArea(contour) >= scale * scale) {
+                    contours.push_back(std::move(contour));
+                    found = true;
+                }
+            }
+            
+            // If the fine pass finds nothing (e.g. the background hasn't settled yet), fall
+            // back to the coarse region.
+            if (!found) {
+                contours.push_back({fineRegion.tl(),
+                                    cv::Point(fineRegion.x + fineRegion.width - 1, fineRegion.y),
+                                    cv::Point(fineRegion.x + fineRegion.width - 1, fineRegion.y + fineRegion.height - 1),
+                                    cv::Point(fineRegion.x, fineRegion.y + fineRegion.height - 1)});
+            }
+        }
+    }
+    
+    void ContourFinder::findBlobs(const BitMask& mask,
+                                  cv::Point offset,
+                                  std::vector<std::vector<cv::Point>>& contours,
+                                  std::vector<cv::Point2f>& massCenters,
+                                  std::vector<cv::Rect>& boundingBoxes) {
+        {
+            Instrumentation::TraceScope trace("labeling");
+            this->labeler.label(mask, this->blobs, this->bandRows);
+        }
+        for (auto& blob : this->blobs) {
+            blob.translate(offset);
+        }
+        
+        // Remove blobs whose area is <= contourSizeThreshold * area of largest blob.
+        double maxArea = 0;
+        for (const auto& blob : this->blobs) {
+            maxArea = std::max(maxArea, blob.m00);
+        }
+        int threshold = this->contourSizeThreshold * maxArea;
+        auto removeThese = std::remove_if(this->blobs.begin(), this->blobs.end(), [threshold](const Blob& blob) {
+            return blob.m00 <= threshold;
+        });
+        this->blobs.erase(removeThese, this->blobs.end());
+        
+        // Remove blobs whose mass centers are in the suppressed rectangles.
+        removeThese = std::remove_if(this->blobs.begin(), this->blobs.end(), [this](const Blob& blob) {
+            for (const auto& rect : this->suppressRectangles) {
+                if (rect.contains(blob.center())) {
+                    return true;
+                }
+            }
+            return false;
+        });
+        this->blobs.erase(removeThese, this->blobs.end());
+        
+        // Merge nearby blobs, like mergeContours(). Sweep over the blobs from left to right:
+        // once a blob starts more than the merge distance to the right of another one's box,
+        // none of their corners can be close enough, and neither can any blob after it.
+        float mergeDistance = this->contourMergeThreshold * this->diagonal;
+        std::vector<int> byX(this->blobs.size());
+        std::iota(byX.begin(), byX.end(), 0);
+        std::sort(byX.begin(), byX.end(), [this](int a, int b) {
+            return this->blobs[a].box.x < this->blobs[b].box.x;
+        });
+        DisjointSets sets(this->blobs.size());
+        for (size_t i = 0; i < byX.size(); i++) {
+            const cv::Rect& box = this->blobs[byX[i]].box;
+            for (size_t j = i + 1; j < byX.size() && this->blobs[byX[j]].box.x - (box.x + box.width) < mergeDistance; j++) {
+                if (distanceBetweenRects(box, this->blobs[byX[j]].box) < mergeDistance) {
+                    sets.Union(byX[i], byX[j]);
+                }
+            }
+        }
+        std::vector<int> mergedForSet(this->blobs.size(), -1);
+        std::vector<Blob> merged;
+        for (size_t i = 0; i < this->blobs.size(); i++) {
+            int set = sets.FindSet(i);
+            if (mergedForSet[set] < 0) {
+                mergedForSet[set] = merged.size();
+                merged.push_back(this->blobs[i]);
+            } else {
+                merged[mergedForSet[set]].merge(this->blobs[i]);
+            }
+        }
+        
+        contours.clear();
+        massCenters.clear();
+        boundingBoxes.clear();
+        for (const auto& blob : merged) {
+            const cv::Rect& box = blob.box;
+            contours.push_back({box.tl(),
+                                cv::Point(box.x + box.width - 1, box.y),
+                                cv::Point(box.x + box.width - 1, box.y + box.height - 1),
+                                cv::Point(box.x, box.y + box.height - 1)});
+            massCenters.push_back(blob.center());
+            boundingBoxes.push_back(box);
+        }
+    }
+    
+    void ContourFinder::setRunLabeling(bool enabled) {
+        this->useRunLabeling = enabled;
+    }
+    
+    void ContourFinder::setShowForeground(bool enabled) {
+        this->showForeground = enabled;
+    }
+    
     void ContourFinder::mergeContours(std::vector<std::vector<cv::Point> > &contours,
                                       const std::vector<cv::Point2f>& massCenters,
                                       const std::vector<cv::Rect>& boundingBoxes) {
@@ -189,19 +781,12 @@ namespace OT {
         massCenters.clear();
         boundingBoxes.clear();
         
-        // Create local variables.
-        cv::Moments contourMoments;
-        std::vector<std::vector<cv::Point> > contourPolygons(contours.size());
-        
         // Iterate through every contour.
         for (size_t i = 0; i < contours.size(); i++) {
-            // Compute the center of mass.
-            contourMoments = cv::moments(contours[i], false);
-            massCenters.push_back(cv::Point2f(contourMoments.m10/contourMoments.m00, contourMoments.m01/contourMoments.m00));
-            
-            // Compute the polygon represented by the contour, and then compute the bounding box around that polygon.
-            cv::approxPolyDP(cv::Mat(contours[i]), contourPolygons[i], 3, true);
-            boundingBoxes.push_back(cv::boundingRect(cv::Mat(contourPolygons[i])));
+            // Compute the center of mass and the bounding box in one pass over the points.
+            Blob stats = contourStats(contours[i]);
+            massCenters.push_back(stats.center());
+            boundingBoxes.push_back(stats.box);
         }
     }
     
@@ -0,0 +1,56 @@
+#include "tracker/contour_stats.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace OT {
+    Blob contourStats(const std::vector<cv::Point>& contour) {
+        Blob stats{0, 0, 0, cv::Rect()};
+        size_t n = contour.size();
+        if (n == 0) {
+            return stats;
+        }
+        
+        // Green's theorem over the edges (previous point -> point), starting with the edge
+        // that closes the polygon.
+        int64_t a00 = 0;
+        int64_t a10 = 0;
+        int64_t a01 = 0;
+        int minX = contour[0].x;
+        int minY = contour[0].y;
+        int maxX = contour[0].x;
+        int maxY = contour[0].y;
+        int64_t previousX = contour[n - 1].x;
+        int64_t previousY = contour[n - 1].y;
+        for (size_t i = 0; i < n; i++) {
+            int64_t x = contour[i].x;
+            int64_t y = contour[i].y;
+            int64_t cross = previousX * y - x * previousY;
+            a00 += cross;
+            a10 += cross * (previousX + x);
+            a01 += cross * (previousY + y);
+            minX = std::min(minX, contour[i].x);
+            minY = std::min(minY, contour[i].y);
+            maxX = std::max(maxX, contour[i].x);
+            maxY = std::max(maxY, contour[i].y);
+            previousX = x;
+            previousY = y;
+        }
+        
+        // Like cv::moments, a degenerate polygon has no area, and the moments of a clockwise
+        // polygon are negated so that the area is positive.
+        if (std::fabs(static_cast<double>(a00)) > FLT_EPSILON) {
+            double sign = a00 > 0 ? 1 : -1;
+            stats.m00 = sign * a00 / 2.0;
+            stats.m10 = sign * a10 / 6.0;
+            stats.m01 = sign * a01 / 6.0;
+        }
+        stats.box = cv::Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+        return stats;
+    }
+}
@@ -26,6 +26,7 @@ namespace OT {
         this->numFramesWithoutUpdate = 0;
         this->prediction = startPt;
         this->lifetime = 0;
+        this->measurement = cv::Mat_<float>::zeros(2, 1);
         
         // Initialize filter with 4 dynamic parameters (x, y, x velocity, y
         // velocity), 2 measurement parameters (x, y), and no control parameters.
@@ -56,10 +57,9 @@ namespace OT {
     }
     
     cv::Point KalmanTracker::correct(cv::Point pt) {
-        cv::Mat_<float> measurement = cv::Mat_<float>::zeros(2, 1);
-        measurement(0) = pt.x;
-        measurement(1) = pt.y;
-        cv::Mat estimated = this->kf->correct(measurement);
+        this->measurement(0) = pt.x;
+        this->measurement(1) = pt.y;
+        cv::Mat estimated = this->kf->correct(this->measurement);
         cv::Point statePt(estimated.at<float>(0), estimated.at<float>(1));
         this->prediction.x = statePt.x;
         this->prediction.y = statePt.y;
@@ -107,13 +107,16 @@ namespace OT {
         this->numFramesWithoutUpdate = 0;
     }
     
-    OT::TrackingOutput KalmanTracker::latestTrackingOutput() {
+    OT::TrackingOutput KalmanTracker::latestTrackingOutput(bool withTrajectory) {
         auto output = OT::TrackingOutput{
             this->id,
             this->latestPrediction(),
             this->color,
             std::vector<cv::Point>()
         };
+        if (!withTrajectory) {
+            return output;
+        }
         std::copy(this->trajectory->cbegin(),
                   this->trajectory->cend(),
                   std::back_inserter(output.trajectory));
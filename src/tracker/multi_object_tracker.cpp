@@ -8,6 +8,7 @@
 
 #include "tracker/kalman_tracker.hpp"
 #include "lib/hungarian.hpp"
+#include "utils/instrumentation.hpp"
 
 namespace OT {
     MultiObjectTracker::MultiObjectTracker(cv::Size frameSize,
@@ -29,11 +30,16 @@ namespace OT {
         this->distanceSuppressionThreshold = distanceSuppressionThreshold;
         this->ageSuppressionThreshold = ageSuppressionThreshold;
         this->dt = dt;
+        this->solver = std::make_unique<AssignmentProblemSolver>();
+    }
+    
+    MultiObjectTracker::~MultiObjectTracker() {
     }
     
     void MultiObjectTracker::update(const std::vector<cv::Point2f>& massCenters,
                                     const std::vector<cv::Rect>& boundingRects,
-                                    std::vector<OT::TrackingOutput>& trackingOutputs) {
+                                    std::vector<OT::TrackingOutput>& trackingOutputs,
+                                    bool withTrajectories) {
         trackingOutputs.clear();
         
         // If we haven't found any mass centers, just update all the Kalman filters and return their predictions.
@@ -52,7 +58,7 @@ namespace OT {
             for (size_t i = 0; i < this->kalmanTrackers.size(); i++) {
                 if (this->kalmanTrackers[i].getLifetime() > lifetimeThreshold) {
                     this->kalmanTrackers[i].predict();
-                    trackingOutputs.push_back(this->kalmanTrackers[i].latestTrackingOutput());
+                    trackingOutputs.push_back(this->kalmanTrackers[i].latestTrackingOutput(withTrajectories));
                 }
             }
             return;
@@ -71,15 +77,12 @@ namespace OT {
         size_t numKalmans = this->kalmanTrackers.size();
         size_t numCenters = massCenters.size();
         
-        std::vector<std::vector<double>> costMatrix(numKalmans, std::vector<double>(numCenters));
-    
-        std::vector<int> assignment;
-        
+        this->costMatrix.resize(numKalmans * numCenters);
         
         // Get the latest prediction for the Kalman filters.
-        std::vector<cv::Point2f> predictions(this->kalmanTrackers.size());
+        this->predictions.resize(this->kalmanTrackers.size());
         for (size_t i = 0; i < this->kalmanTrackers.size(); i++) {
-            predictions[i] = this->kalmanTrackers[i].latestPrediction();
+            this->predictions[i] = this->kalmanTrackers[i].latestPrediction();
         }
         
         // We need to associate each of the mass centers to their corresponding Kalman filter. First,
@@ -87,23 +90,26 @@ namespace OT {
         // of the frame to ensure that it is between 0 and 1.
         cv::Point framePoint = cv::Point(this->frameSize.width, this->frameSize.height);
         double frameDiagonal = std::sqrt(framePoint.dot(framePoint));
-        for (size_t i = 0; i < predictions.size(); i++) {
+        for (size_t i = 0; i < this->predictions.size(); i++) {
             for (size_t j = 0; j < massCenters.size(); j++) {
-                costMatrix[i][j] = cv::norm(predictions[i] - massCenters[j]) / frameDiagonal;
+                this->costMatrix[i * numCenters + j] = cv::norm(this->predictions[i] - massCenters[j]) / frameDiagonal;
             }
         }
         
         // Assign Kalman trackers to mass centers with the Hungarian algorithm.
-        AssignmentProblemSolver solver;
-        solver.Solve(costMatrix, assignment, AssignmentProblemSolver::optimal);
+        {
+            Instrumentation::TraceScope trace("association");
+            this->solver->Solve(this->costMatrix, (int)numKalmans, (int)numCenters, this->assignment,
+                                AssignmentProblemSolver::optimal);
+        }
         
         // Unassign any Kalman trackers whose distance to their assignment is too large.
-        std::vector<int> kalmansWithoutCenters;
-        for (size_t i = 0; i < assignment.size(); i++) {
-            if (assignment[i] != -1) {
-                if (costMatrix[i][assignment[i]] > this->distanceThreshold) {
-                    assignment[i] = -1;
-                    kalmansWithoutCenters.push_back(i);
+        this->kalmansWithoutCenters.clear();
+        for (size_t i = 0; i < this->assignment.size(); i++) {
+            if (this->assignment[i] != -1) {
+                if (this->costMatrix[i * numCenters + this->assignment[i]] > this->distanceThreshold) {
+                    this->assignment[i] = -1;
+                    this->kalmansWithoutCenters.push_back(i);
                 }
             } else {
                 this->kalmanTrackers[i].noUpdateThisFrame();
@@ -113,7 +119,7 @@ namespace OT {
         // If a Kalman tracker is contained in a bounding box and shares its
         // bounding box with another tracker, remove its assignment and mark it
         // as updated.
-        for (size_t i = 0; i < assignment.size(); i++) {
+        for (size_t i = 0; i < this->assignment.size(); i++) {
             for (size_t j = 0; j < boundingRects.size(); j++) {
                 if (boundingRects[j].contains(this->kalmanTrackers[i].latestPrediction())
                     && this->sharesBoundingRect(i, boundingRects[j])) {
@@ -127,31 +133,31 @@ namespace OT {
         for (int i = 0; i < this->kalmanTrackers.size(); i++) {
             if (this->kalmanTrackers[i].getNumFramesWithoutUpdate() > this->missedFramesThreshold) {
                 this->kalmanTrackers.erase(this->kalmanTrackers.begin() + i);
-                assignment.erase(assignment.begin() + i);
+                this->assignment.erase(this->assignment.begin() + i);
                 i--;
             }
         }
         
         // Find unassigned mass centers.
-        std::vector<int> centersWithoutKalman;
+        this->centersWithoutKalman.clear();
         std::vector<int>::iterator it;
         for (size_t i = 0; i < massCenters.size(); i++) {
-            it = std::find(assignment.begin(), assignment.end(), i);
-            if (it == assignment.end()) {
-                centersWithoutKalman.push_back(i);
+            it = std::find(this->assignment.begin(), this->assignment.end(), i);
+            if (it == this->assignment.end()) {
+                this->centersWithoutKalman.push_back(i);
             }
         }
         
         // Create new trackers for the unassigned mass centers.
-        for (size_t i = 0; i < centersWithoutKalman.size(); i++) {
-            this->kalmanTrackers.push_back(OT::KalmanTracker(massCenters[centersWithoutKalman[i]]));
+        for (size_t i = 0; i < this->centersWithoutKalman.size(); i++) {
+            this->kalmanTrackers.push_back(OT::KalmanTracker(massCenters[this->centersWithoutKalman[i]]));
         }
         
         // Update the Kalman filters.
-        for (size_t i = 0; i < assignment.size(); i++) {
+        for (size_t i = 0; i < this->assignment.size(); i++) {
             this->kalmanTrackers[i].predict();
-            if (assignment[i] != -1) {
-                this->kalmanTrackers[i].correct(massCenters[assignment[i]]);
+            if (this->assignment[i] != -1) {
+                this->kalmanTrackers[i].correct(massCenters[this->assignment[i]]);
                 this->kalmanTrackers[i].gotUpdate();
             }
         }
@@ -167,7 +173,7 @@ namespace OT {
         // Now update the predictions.
         for (size_t i = 0; i < this->kalmanTrackers.size(); i++) {
             if (this->kalmanTrackers[i].getLifetime() > this->lifetimeThreshold) {
-                trackingOutputs.push_back(this->kalmanTrackers[i].latestTrackingOutput());
+                trackingOutputs.push_back(this->kalmanTrackers[i].latestTrackingOutput(withTrajectories));
             }
         }
     }
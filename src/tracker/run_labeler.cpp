@@ -0,0 +1,217 @@
+#include "tracker/run_labeler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace OT {
+    cv::Point2f Blob::center() const {
+        return cv::Point2f(this->m10 / this->m00, this->m01 / this->m00);
+    }
+    
+    void Blob::merge(const Blob& other) {
+        this->m00 += other.m00;
+        this->m10 += other.m10;
+        this->m01 += other.m01;
+        int x0 = std::min(this->box.x, other.box.x);
+        int y0 = std::min(this->box.y, other.box.y);
+        int x1 = std::max(this->box.x + this->box.width, other.box.x + other.box.width);
+        int y1 = std::max(this->box.y + this->box.height, other.box.y + other.box.height);
+        this->box = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+    }
+    
+    void Blob::translate(cv::Point offset) {
+        this->m10 += offset.x * this->m00;
+        this->m01 += offset.y * this->m00;
+        this->box.x += offset.x;
+        this->box.y += offset.y;
+    }
+    
+    void RunLabeler::extractRuns(const BitMask& mask, int y0, int y1,
+                                 std::vector<Run>& runs,
+                                 std::vector<int>& rowStart) {
+        int stride = mask.wordsPerRow();
+        for (int y = y0; y < y1; y++) {
+            rowStart.push_back(static_cast<int>(runs.size()));
+            const uint64_t* words = mask.row(y);
+            
+            // The start of a run that continues past the end of the previous word, or -1.
+            int open = -1;
+            for (int i = 0; i < stride; i++) {
+                uint64_t bits = words[i];
+                int base = i * 64;
+                if (open >= 0) {
+                    // Find where the open run ends: the first clear bit.
+                    if (bits == ~uint64_t(0)) {
+                        continue;
+                    }
+                    int end = __builtin_ctzll(~bits);
+                    runs.push_back(Run{y, open, base + end});
+                    open = -1;
+                    bits &= ~uint64_t(0) << end;
+                }
+                while (bits != 0) {
+                    int start = __builtin_ctzll(bits);
+                    uint64_t rest = ~bits & (~uint64_t(0) << start);
+                    if (rest == 0) {
+                        // The run reaches the end of the word.
+                        open = base + start;
+                        break;
+                    }
+                    int end = __builtin_ctzll(rest);
+                    runs.push_back(Run{y, base + start, base + end});
+                    bits &= ~uint64_t(0) << end;
+                }
+            }
+            if (open >= 0) {
+                runs.push_back(Run{y, open, mask.getCols()});
+            }
+        }
+    }
+    
+    int RunLabeler::find(std::vector<int>& parent, int element) {
+        // Path halving.
+        while (parent[element] != element) {
+            parent[element] = parent[parent[element]];
+            element = parent[element];
+        }
+        return element;
+    }
+    
+    void RunLabeler::unite(std::vector<int>& parent, int a, int b) {
+        a = find(parent, a);
+        b = find(parent, b);
+        if (a < b) {
+            parent[b] = a;
+        } else if (b < a) {
+            parent[a] = b;
+        }
+    }
+    
+    void RunLabeler::labelBand(const BitMask& mask, Band& band) {
+        band.runs.clear();
+        band.rowStart.clear();
+        band.blobs.clear();
+        extractRuns(mask, band.y0, band.y1, band.runs, band.rowStart);
+        band.rowStart.push_back(static_cast<int>(band.runs.size()));
+        
+        size_t numRuns = band.runs.size();
+        band.parent.resize(numRuns);
+        for (size_t i = 0; i < numRuns; i++) {
+            band.parent[i] = static_cast<int>(i);
+        }
+        
+        // Join the runs that touch a run of the row above, including diagonally. Both rows
+        // are sorted, so walk them together.
+        for (int row = 1; row < band.y1 - band.y0; row++) {
+            int above = band.rowStart[row - 1];
+            int aboveEnd = band.rowStart[row];
+            for (int i = band.rowStart[row]; i < band.rowStart[row + 1]; i++) {
+                const Run& run = band.runs[i];
+                while (above < aboveEnd && band.runs[above].end < run.start) {
+                    above++;
+                }
+                for (int j = above; j < aboveEnd && band.runs[j].start <= run.end; j++) {
+                    unite(band.parent, i, j);
+                }
+            }
+        }
+        
+        // Accumulate the moments and bounding boxes of the runs into their blobs. A root is
+        // always the first run of its blob, so it gets its blob before the other runs.
+        band.blobForRun.assign(numRuns, -1);
+        for (size_t i = 0; i < numRuns; i++) {
+            const Run& run = band.runs[i];
+            int root = find(band.parent, static_cast<int>(i));
+            double length = run.end - run.start;
+            Blob runBlob{length,
+                         length * (run.start + run.end - 1) / 2.0,
+                         length * run.y,
+                         cv::Rect(run.start, run.y, run.end - run.start, 1)};
+            if (band.blobForRun[root] < 0) {
+                band.blobForRun[root] = static_cast<int>(band.blobs.size());
+                band.blobs.push_back(runBlob);
+            } else {
+                band.blobs[band.blobForRun[root]].merge(runBlob);
+            }
+            band.blobForRun[i] = band.blobForRun[root];
+        }
+    }
+    
+    void RunLabeler::label(const BitMask& mask, std::vector<Blob>& blobs, int bandRows) {
+        blobs.clear();
+        int rows = mask.getRows();
+        if (bandRows <= 0 || bandRows >= rows) {
+            bandRows = std::max(rows, 1);
+        }
+        int numBands = (rows + bandRows - 1) / bandRows;
+        this->bands.resize(numBands);
+        for (int b = 0; b < numBands; b++) {
+            this->bands[b].y0 = b * bandRows;
+            this->bands[b].y1 = std::min(rows, (b + 1) * bandRows);
+        }
+        if (numBands == 0) {
+            return;
+        }
+        if (numBands == 1) {
+            labelBand(mask, this->bands[0]);
+            blobs.swap(this->bands[0].blobs);
+            return;
+        }
+        
+        // Label the bands independently.
+        cv::parallel_for_(cv::Range(0, numBands), [this, &mask](const cv::Range& range) {
+            for (int b = range.start; b < range.end; b++) {
+                labelBand(mask, this->bands[b]);
+            }
+        });
+        
+        // Number the blobs of every band one after the other.
+        std::vector<int> firstBlob(numBands + 1, 0);
+        for (int b = 0; b < numBands; b++) {
+            firstBlob[b + 1] = firstBlob[b] + static_cast<int>(this->bands[b].blobs.size());
+        }
+        this->blobParent.resize(firstBlob[numBands]);
+        for (int i = 0; i < firstBlob[numBands]; i++) {
+            this->blobParent[i] = i;
+        }
+        
+        // Join the blobs whose runs touch across a seam: the last row of a band and the
+        // first row of the next one.
+        for (int b = 0; b + 1 < numBands; b++) {
+            const Band& upper = this->bands[b];
+            const Band& lower = this->bands[b + 1];
+            int above = upper.rowStart[upper.y1 - upper.y0 - 1];
+            int aboveEnd = upper.rowStart[upper.y1 - upper.y0];
+            for (int i = lower.rowStart[0]; i < lower.rowStart[1]; i++) {
+                const Run& run = lower.runs[i];
+                while (above < aboveEnd && upper.runs[above].end < run.start) {
+                    above++;
+                }
+                for (int j = above; j < aboveEnd && upper.runs[j].start <= run.end; j++) {
+                    unite(this->blobParent,
+                          firstBlob[b] + upper.blobForRun[j],
+                          firstBlob[b + 1] + lower.blobForRun[i]);
+                }
+            }
+        }
+        
+        // Merge the stitched blobs. The bands are in raster order and the root of each set
+        // is its earliest blob, so the blobs come out in the same order as a single pass.
+        this->stitchedBlob.assign(firstBlob[numBands], -1);
+        for (int b = 0; b < numBands; b++) {
+            for (size_t k = 0; k < this->bands[b].blobs.size(); k++) {
+                int root = find(this->blobParent, firstBlob[b] + static_cast<int>(k));
+                const Blob& blob = this->bands[b].blobs[k];
+                if (this->stitchedBlob[root] < 0) {
+                    this->stitchedBlob[root] = static_cast<int>(blobs.size());
+                    blobs.push_back(blob);
+                } else {
+                    blobs[this->stitchedBlob[root]].merge(blob);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,253 @@
+#include "tracker/track_journal.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace OT {
+    namespace {
+        // Cut the journal at path down to length bytes. Returns false, after saying why, if
+        // it can't be.
+        bool truncateJournal(const std::string& path, off_t length) {
+            if (::truncate(path.c_str(), length) != 0) {
+                std::cerr << "Problem truncating journal " << path << " to " << length << " bytes: "
+                          << std::strerror(errno) << std::endl;
+                return false;
+            }
+            return true;
+        }
+    }
+    
+    // The journal file starts with this magic and version.
+    const char kJournalMagic[4] = {'O', 'T', 'J', 'L'};
+    const uint32_t kJournalVersion = 1;
+    
+    // Every record is a header followed by a payload of:
+    //   int64 frame, int32 width, int32 height, uint32 count, count * (int32 id, int32 x, int32 y)
+    struct RecordHeader {
+        uint32_t payloadBytes;
+        uint32_t checksum;
+    };
+    
+    // Reject records claiming to be larger than this, since they must be garbage.
+    const uint32_t kMaxPayloadBytes = 64 * 1024 * 1024;
+    
+    uint32_t crc32(const char* data, size_t length) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t;
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+        
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < length; i++) {
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+    
+    template <typename T>
+    void putRaw(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    
+    template <typename T>
+    T getRaw(const char*& p) {
+        T value;
+        std::memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return value;
+    }
+    
+    // The bytes every journal starts with.
+    std::string journalHeader() {
+        std::string header(kJournalMagic, 4);
+        putRaw(header, kJournalVersion);
+        return header;
+    }
+    
+    // Whether the start of a file is the start of a journal header that a crash cut short,
+    // which is safe to throw away.
+    bool isTornHeader(const std::string& start) {
+        std::string header = journalHeader();
+        return start.size() < header.size() && std::equal(start.begin(), start.end(), header.begin());
+    }
+    
+    TrackJournal::TrackJournal(int commitIntervalMs, size_t maxBufferBytes) {
+        this->commitInterval = std::chrono::milliseconds(commitIntervalMs);
+        this->maxBufferBytes = maxBufferBytes;
+        this->lastCommit = std::chrono::steady_clock::now();
+    }
+    
+    TrackJournal::~TrackJournal() {
+        this->close();
+    }
+    
+    bool TrackJournal::open(const std::string& path) {
+        this->close();
+        
+        // Start over from a header that was cut short, but don't append to anything that
+        // isn't a journal, since it could never be read again.
+        std::string header = journalHeader();
+        std::ifstream file(path, std::ios::binary);
+        if (file.is_open()) {
+            std::string start(header.size(), '\0');
+            file.read(&start[0], start.size());
+            start.resize(static_cast<size_t>(file.gcount()));
+            file.close();
+            if (isTornHeader(start)) {
+                if (!truncateJournal(path, 0)) {
+                    return false;
+                }
+            } else if (start != header) {
+                return false;
+            }
+        }
+        if (!this->sink.open(path, true)) {
+            return false;
+        }
+        
+        // Write the file header if this is a new journal.
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && st.st_size == 0) {
+            this->sink.write(header);
+            this->sink.sync();
+        }
+        this->lastCommit = std::chrono::steady_clock::now();
+        return true;
+    }
+    
+    void TrackJournal::append(long frameNumber, int width, int height, const std::vector<Track>& tracks) {
+        if (!this->sink.isOpen()) {
+            return;
+        }
+        
+        // Reserve the header and fill it in once the payload is known.
+        size_t start = this->buffer.size();
+        this->buffer.resize(start + sizeof(RecordHeader));
+        putRaw<int64_t>(this->buffer, frameNumber);
+        putRaw<int32_t>(this->buffer, width);
+        putRaw<int32_t>(this->buffer, height);
+        putRaw<uint32_t>(this->buffer, tracks.size());
+        for (auto track : tracks) {
+            putRaw<int32_t>(this->buffer, track.trackerId);
+            putRaw<int32_t>(this->buffer, track.x);
+            putRaw<int32_t>(this->buffer, track.y);
+        }
+        const char* payload = this->buffer.data() + start + sizeof(RecordHeader);
+        size_t payloadBytes = this->buffer.size() - start - sizeof(RecordHeader);
+        RecordHeader header{static_cast<uint32_t>(payloadBytes), crc32(payload, payloadBytes)};
+        std::memcpy(&this->buffer[start], &header, sizeof(header));
+        
+        // Group commit: sync once per interval instead of once per frame.
+        auto now = std::chrono::steady_clock::now();
+        if (now - this->lastCommit >= this->commitInterval || this->buffer.size() >= this->maxBufferBytes) {
+            this->commit();
+        }
+    }
+    
+    void TrackJournal::commit() {
+        if (this->sink.isOpen() && !this->buffer.empty()) {
+            this->sink.write(this->buffer);
+            this->sink.sync();
+            this->buffer.clear();
+        }
+        this->lastCommit = std::chrono::steady_clock::now();
+    }
+    
+    void TrackJournal::close() {
+        if (!this->sink.isOpen()) {
+            return;
+        }
+        this->commit();
+        this->sink.close();
+    }
+    
+    bool TrackJournal::isJournal(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        char magic[4];
+        return file.read(magic, 4) && std::equal(magic, magic + 4, kJournalMagic);
+    }
+    
+    long TrackJournal::recover(const std::string& path,
+                               std::vector<Track>& tracks,
+                               int& width,
+                               int& height,
+                               bool truncate) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return 0;
+        }
+        std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+        
+        // A header cut short by a crash holds nothing, so drop it and let open() write a
+        // new one.
+        std::string header = journalHeader();
+        if (isTornHeader(contents)) {
+            if (truncate && !contents.empty()) {
+                truncateJournal(path, 0);
+            }
+            return 0;
+        }
+        if (contents.compare(0, header.size(), header) != 0) {
+            return 0;
+        }
+        const size_t headerBytes = header.size();
+        
+        // Walk the records until one is incomplete or fails its checksum.
+        long lastFrame = 0;
+        size_t offset = headerBytes;
+        while (offset + sizeof(RecordHeader) <= contents.size()) {
+            RecordHeader header;
+            std::memcpy(&header, contents.data() + offset, sizeof(header));
+            const char* payload = contents.data() + offset + sizeof(header);
+            if (header.payloadBytes > kMaxPayloadBytes
+                || header.payloadBytes < sizeof(int64_t) + 3 * sizeof(int32_t)
+                || offset + sizeof(header) + header.payloadBytes > contents.size()
+                || crc32(payload, header.payloadBytes) != header.checksum) {
+                break;
+            }
+            
+            const char* p = payload;
+            long frame = getRaw<int64_t>(p);
+            width = getRaw<int32_t>(p);
+            height = getRaw<int32_t>(p);
+            uint32_t count = getRaw<uint32_t>(p);
+            if (sizeof(int64_t) + 3 * sizeof(int32_t) + count * 3 * sizeof(int32_t) != header.payloadBytes) {
+                break;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                int id = getRaw<int32_t>(p);
+                int x = getRaw<int32_t>(p);
+                int y = getRaw<int32_t>(p);
+                tracks.push_back(Track{id, x, y, frame});
+            }
+            lastFrame = frame;
+            offset += sizeof(header) + header.payloadBytes;
+        }
+        
+        // Drop the partial record left behind by a crash.
+        if (truncate && offset < contents.size()) {
+            truncateJournal(path, static_cast<off_t>(offset));
+        }
+        return lastFrame;
+    }
+}
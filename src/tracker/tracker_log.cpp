@@ -4,23 +4,76 @@
 #include <vector>
 #include <fstream>
 #include <algorithm>
+#include <iostream>
 
 #include "lib/json.hpp"
+#include "tracker/trajectory_simplifier.hpp"
 
 namespace OT {
+    namespace {
+        // The memory a tracker takes up in the maps, besides its vectors: a node in each
+        // map, holding the value, the next pointer and the hash.
+        const size_t kTrackerBytes = sizeof(std::pair<const int, std::vector<Track>>)
+            + sizeof(std::pair<const int, long>)
+            + sizeof(std::pair<const int, std::vector<long>>)
+            + 3 * (sizeof(void*) + sizeof(size_t));
+    }
+    
     TrackerLog::TrackerLog(bool compress) {
         this->tracksForTrackerId = std::unordered_map<int, std::vector<OT::Track>>();
         this->numFrames = 0;
         this->birthFrameForTrackerId = std::unordered_map<int, long>();
         this->compress = compress;
+        this->width = 0;
+        this->height = 0;
+        this->spill = nullptr;
+        this->maxFramesInMemory = 0;
+        this->maxBytesInMemory = 0;
+        this->numTracksInMemory = 0;
+        this->bytesInMemory = 0;
+        this->oldestFrameInMemory = 0;
+        this->simplifier = nullptr;
+        this->simplified = false;
     }
     
+    TrackerLog::~TrackerLog() {}
+    
     void TrackerLog::addTrack(int trackerId, int x, int y, long frameNumber) {
+        if (this->simplifier == nullptr) {
+            this->storeTrack(OT::Track{trackerId, x, y, frameNumber});
+            return;
+        }
+        
+        // Every so often, end the trajectories of trackers that have gone away so that
+        // their windows don't linger.
+        if (frameNumber > this->numFrames && frameNumber % 100 == 0) {
+            this->simplifier->finishBefore(frameNumber - 1, this->vertices);
+        }
+        this->numFrames = std::max(this->numFrames, frameNumber);
+        
+        // Only the vertices that the simplifier has settled on are stored.
+        if (this->simplifier->add(OT::Track{trackerId, x, y, frameNumber}, this->vertices)) {
+            this->markTrajectoryStart(trackerId, frameNumber);
+        }
+        for (const auto& vertex : this->vertices) {
+            this->storeTrack(vertex);
+        }
+        this->vertices.clear();
+    }
+    
+    void TrackerLog::storeTrack(const Track& newTrack) {
+        int trackerId = newTrack.trackerId;
+        long frameNumber = newTrack.frameNumber;
+        
         // Add the track.
         if (this->tracksForTrackerId.find(trackerId) == this->tracksForTrackerId.end()) {
             this->tracksForTrackerId[trackerId] = std::vector<OT::Track>();
+            this->bytesInMemory += kTrackerBytes;
         }
-        this->tracksForTrackerId[trackerId].push_back(OT::Track{trackerId, x, y, frameNumber});
+        std::vector<OT::Track>& tracks = this->tracksForTrackerId[trackerId];
+        size_t capacity = tracks.capacity();
+        tracks.push_back(newTrack);
+        this->bytesInMemory += (tracks.capacity() - capacity) * sizeof(OT::Track);
         
         // Update the birth frame.
         if (this->birthFrameForTrackerId.find(trackerId) == this->birthFrameForTrackerId.end()) {
@@ -30,14 +83,139 @@ namespace OT {
         
         // Update the number of frames.
         this->numFrames = std::max(this->numFrames, frameNumber);
+        
+        // Enforce the retention policy, if there is one.
+        if (this->numTracksInMemory == 0) {
+            this->oldestFrameInMemory = frameNumber;
+        }
+        this->numTracksInMemory++;
+        if (this->spill == nullptr) {
+            return;
+        }
+        long window = this->numFrames - this->oldestFrameInMemory + 1;
+        bool tooManyFrames = this->maxFramesInMemory > 0 && window > this->maxFramesInMemory;
+        bool tooManyBytes = this->maxBytesInMemory > 0 && this->bytesInMemory > this->maxBytesInMemory;
+        if (tooManyFrames || tooManyBytes) {
+            // Spill the older half of the window at once so that spills are rare.
+            this->spillTracksBefore(this->oldestFrameInMemory + std::max(1L, window / 2));
+        }
+    }
+    
+    void TrackerLog::setRetention(long maxFrames,
+                                  size_t maxBytes,
+                                  const std::string& segmentPrefix,
+                                  size_t maxSegmentBytes) {
+        this->maxFramesInMemory = maxFrames;
+        this->maxBytesInMemory = maxBytes;
+        this->spill = std::make_unique<LogSegment::Writer>(segmentPrefix,
+                                                           this->simplified ? LogSegment::SimplifiedTracks : LogSegment::Tracks,
+                                                           maxSegmentBytes);
+        this->spill->setDimensions(this->width, this->height);
+    }
+    
+    void TrackerLog::spillTracksBefore(long cutoffFrame) {
+        std::vector<LogSegment::Record> chunk;
+        
+        // Move the old tracks of every tracker into the chunk. Each tracker's tracks are
+        // in frame order, so the old ones form a prefix.
+        for (auto it = this->tracksForTrackerId.begin(); it != this->tracksForTrackerId.end();) {
+            auto& tracks = it->second;
+            auto firstKept = std::find_if(tracks.begin(), tracks.end(), [cutoffFrame](const OT::Track& track) {
+                return track.frameNumber >= cutoffFrame;
+            });
+            std::vector<long>& starts = this->startsForTrackerId[it->first];
+            for (auto track = tracks.begin(); track != firstKept; track++) {
+                bool startsTrajectory = std::find(starts.begin(), starts.end(), track->frameNumber) != starts.end();
+                chunk.push_back(LogSegment::Record{track->frameNumber, track->trackerId, track->x, track->y, startsTrajectory});
+            }
+            tracks.erase(tracks.begin(), firstKept);
+            starts.erase(starts.begin(), std::lower_bound(starts.begin(), starts.end(), cutoffFrame));
+            
+            // Erasing keeps the capacity, so give back the memory of what was spilled.
+            tracks.shrink_to_fit();
+            starts.shrink_to_fit();
+            
+            // Forget trackers that have nothing left in memory. The merger recovers their
+            // birth frames from the segments.
+            if (tracks.empty()) {
+                this->birthFrameForTrackerId.erase(it->first);
+                this->startsForTrackerId.erase(it->first);
+                it = this->tracksForTrackerId.erase(it);
+            } else {
+                it++;
+            }
+        }
+        
+        // Write the chunk in frame order.
+        std::sort(chunk.begin(), chunk.end(), [](const LogSegment::Record& a, const LogSegment::Record& b) {
+            return a.frame != b.frame ? a.frame < b.frame : a.id < b.id;
+        });
+        this->spill->writeChunk(chunk);
+        
+        this->numTracksInMemory -= chunk.size();
+        this->oldestFrameInMemory = cutoffFrame;
+        this->recountBytesInMemory();
+    }
+    
+    void TrackerLog::recountBytesInMemory() {
+        this->bytesInMemory = (this->tracksForTrackerId.bucket_count()
+                               + this->birthFrameForTrackerId.bucket_count()
+                               + this->startsForTrackerId.bucket_count()) * sizeof(void*);
+        for (const auto& entry : this->tracksForTrackerId) {
+            this->bytesInMemory += kTrackerBytes + entry.second.capacity() * sizeof(OT::Track);
+        }
+        for (const auto& entry : this->startsForTrackerId) {
+            this->bytesInMemory += entry.second.capacity() * sizeof(long);
+        }
     }
     
-    void TrackerLog::logToFile(std::ofstream& outputStream) {
+    void TrackerLog::flushToSegments() {
+        if (this->spill == nullptr) {
+            return;
+        }
+        this->finishSimplification();
+        this->spillTracksBefore(this->numFrames + 1);
+        this->spill->close();
+    }
+    
+    void TrackerLog::setSimplification(double tolerance, size_t maxWindow) {
+        this->simplifier = std::make_unique<TrajectorySimplifier>(tolerance, maxWindow);
+        this->simplified = true;
+    }
+    
+    void TrackerLog::markSimplified() {
+        this->simplified = true;
+    }
+    
+    void TrackerLog::markTrajectoryStart(int trackerId, long frameNumber) {
+        std::vector<long>& starts = this->startsForTrackerId[trackerId];
+        size_t capacity = starts.capacity();
+        starts.push_back(frameNumber);
+        this->bytesInMemory += (starts.capacity() - capacity) * sizeof(long);
+    }
+    
+    void TrackerLog::finishSimplification() {
+        if (this->simplifier == nullptr) {
+            return;
+        }
+        this->simplifier->finish(this->vertices);
+        for (const auto& vertex : this->vertices) {
+            this->storeTrack(vertex);
+        }
+        this->vertices.clear();
+    }
+    
+    void TrackerLog::logToFile(AsyncIO::Sink& outputFile) {
+        this->finishSimplification();
+        
         // Sort the trackers by birth frame number.
         nlohmann::json json;
         json["numFrames"] = this->numFrames;
         json["width"] = this->width;
         json["height"] = this->height;
+        if (this->simplified) {
+            json["simplified"] = true;
+        }
         
         
         // Create a vector of pairs.
@@ -59,8 +237,19 @@ namespace OT {
             json["trackers"][i]["birth"] = idBirthPairs[i].second;
             json["trackers"][i]["trackerId"] = idBirthPairs[i].first;
             
+            // The first trajectory obviously starts at the first vertex, so only the ones
+            // after it are listed.
+            const std::vector<OT::Track>& tracks = this->tracksForTrackerId[idBirthPairs[i].first];
+            if (this->simplified && !tracks.empty()) {
+                for (long start : this->startsForTrackerId[idBirthPairs[i].first]) {
+                    if (start > tracks.front().frameNumber) {
+                        json["trackers"][i]["starts"].push_back(start);
+                    }
+                }
+            }
+            
             // Iterate through each track for the tracker.
-            for (auto track : this->tracksForTrackerId[idBirthPairs[i].first]) {
+            for (auto track : tracks) {
                 if (this->compress) {
                     json["trackers"][i]["track"].push_back({track.x, track.y, track.frameNumber});
                 } else {
@@ -70,11 +259,76 @@ namespace OT {
         }
         
         auto output = this->compress ? json.dump() : json.dump(2);
-        outputStream << output << std::endl;
+        outputFile.write(output);
+        outputFile.write("\n", 1);
     }
     
     void TrackerLog::setDimensions(int width, int height) {
         this->width = width;
         this->height = height;
+        if (this->spill != nullptr) {
+            this->spill->setDimensions(width, height);
+        }
+    }
+    
+    bool TrackerLog::readFromFile(const std::string& path,
+                                  std::vector<Track>& tracks,
+                                  int& width,
+                                  int& height,
+                                  bool interpolate,
+                                  std::vector<bool>* startsTrajectory) {
+        std::ifstream inputFile(path);
+        if (!inputFile.is_open()) {
+            return false;
+        }
+        nlohmann::json json;
+        try {
+            inputFile >> json;
+        } catch (const std::exception& e) {
+            std::cerr << "Problem parsing " << path << ": " << e.what() << std::endl;
+            return false;
+        }
+        width = json["width"].get<int>();
+        height = json["height"].get<int>();
+        bool isSimplified = json.value("simplified", false);
+        
+        std::vector<Track> trackerTracks;
+        std::vector<long> starts;
+        for (const auto& tracker : json["trackers"]) {
+            int trackerId = tracker["trackerId"].get<int>();
+            trackerTracks.clear();
+            starts.clear();
+            if (tracker.count("starts") > 0) {
+                starts = tracker["starts"].get<std::vector<long>>();
+            }
+            for (const auto& entry : tracker["track"]) {
+                // Compressed logs store [x, y, frame].
+                if (entry.is_array()) {
+                    trackerTracks.push_back(Track{trackerId, entry[0].get<int>(), entry[1].get<int>(), entry[2].get<long>()});
+                } else {
+                    trackerTracks.push_back(Track{trackerId, entry["x"].get<int>(), entry["y"].get<int>(), entry["frame"].get<long>()});
+                }
+            }
+            size_t firstTrack = tracks.size();
+            if (isSimplified && interpolate) {
+                TrajectorySimplifier::interpolate(trackerTracks, starts, tracks);
+            } else {
+                tracks.insert(tracks.end(), trackerTracks.begin(), trackerTracks.end());
+            }
+            if (startsTrajectory != nullptr) {
+                for (size_t i = firstTrack; i < tracks.size(); i++) {
+                    bool isStart;
+                    if (i == firstTrack) {
+                        isStart = true;
+                    } else if (isSimplified) {
+                        isStart = std::find(starts.begin(), starts.end(), tracks[i].frameNumber) != starts.end();
+                    } else {
+                        isStart = tracks[i].frameNumber > tracks[i - 1].frameNumber + 1;
+                    }
+                    startsTrajectory->push_back(isStart);
+                }
+            }
+        }
+        return true;
     }
 }
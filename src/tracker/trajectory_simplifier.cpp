@@ -0,0 +1,115 @@
+#include "tracker/trajectory_simplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace OT {
+    TrajectorySimplifier::TrajectorySimplifier(double tolerance, size_t maxWindow) {
+        this->tolerance = tolerance;
+        this->maxWindow = std::max<size_t>(1, maxWindow);
+    }
+    
+    bool TrajectorySimplifier::fits(const Track& anchor, const Track& end, const std::vector<Track>& points) const {
+        double frames = end.frameNumber - anchor.frameNumber;
+        double toleranceSquared = this->tolerance * this->tolerance;
+        for (const auto& point : points) {
+            // Where the segment says the tracker was on the point's frame, rounded the way
+            // interpolate() rounds it.
+            double t = frames > 0 ? (point.frameNumber - anchor.frameNumber) / frames : 0;
+            double dx = std::lround(anchor.x + t * (end.x - anchor.x)) - point.x;
+            double dy = std::lround(anchor.y + t * (end.y - anchor.y)) - point.y;
+            if (dx * dx + dy * dy > toleranceSquared) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool TrajectorySimplifier::add(const Track& track, std::vector<Track>& vertices) {
+        auto it = this->windowForTrackerId.find(track.trackerId);
+        
+        // Nothing was seen of the tracker in a gap, so a point after one starts a new
+        // trajectory rather than being joined to the last one.
+        if (it != this->windowForTrackerId.end()) {
+            const Window& window = it->second;
+            const Track& last = window.points.empty() ? window.anchor : window.points.back();
+            if (track.frameNumber > last.frameNumber + 1) {
+                if (!window.points.empty()) {
+                    vertices.push_back(window.points.back());
+                }
+                this->windowForTrackerId.erase(it);
+                it = this->windowForTrackerId.end();
+            }
+        }
+        
+        // The first point of a trajectory is always a vertex.
+        if (it == this->windowForTrackerId.end()) {
+            this->windowForTrackerId[track.trackerId] = Window{track, std::vector<Track>()};
+            vertices.push_back(track);
+            return true;
+        }
+        
+        Window& window = it->second;
+        if (window.points.size() < this->maxWindow && this->fits(window.anchor, track, window.points)) {
+            window.points.push_back(track);
+            return false;
+        }
+        
+        // The window can't grow, so its last point becomes a vertex and starts the next one.
+        window.anchor = window.points.back();
+        vertices.push_back(window.anchor);
+        window.points.clear();
+        window.points.push_back(track);
+        return false;
+    }
+    
+    void TrajectorySimplifier::finishBefore(long frameNumber, std::vector<Track>& vertices) {
+        for (auto it = this->windowForTrackerId.begin(); it != this->windowForTrackerId.end();) {
+            const Window& window = it->second;
+            const Track& last = window.points.empty() ? window.anchor : window.points.back();
+            if (last.frameNumber >= frameNumber) {
+                it++;
+                continue;
+            }
+            if (!window.points.empty()) {
+                vertices.push_back(window.points.back());
+            }
+            it = this->windowForTrackerId.erase(it);
+        }
+    }
+    
+    void TrajectorySimplifier::finish(std::vector<Track>& vertices) {
+        for (const auto& kv : this->windowForTrackerId) {
+            if (!kv.second.points.empty()) {
+                vertices.push_back(kv.second.points.back());
+            }
+        }
+        this->windowForTrackerId.clear();
+    }
+    
+    void TrajectorySimplifier::interpolate(const std::vector<Track>& vertices,
+                                           const std::vector<long>& starts,
+                                           std::vector<Track>& tracks) {
+        for (size_t i = 0; i < vertices.size(); i++) {
+            const Track& from = vertices[i];
+            
+            // Only fill in the frames between the vertices of one trajectory.
+            if (i + 1 == vertices.size()
+                || std::find(starts.begin(), starts.end(), vertices[i + 1].frameNumber) != starts.end()) {
+                tracks.push_back(from);
+                continue;
+            }
+            const Track& to = vertices[i + 1];
+            double frames = to.frameNumber - from.frameNumber;
+            for (long frame = from.frameNumber; frame < to.frameNumber; frame++) {
+                double t = (frame - from.frameNumber) / frames;
+                tracks.push_back(Track{from.trackerId,
+                                       static_cast<int>(std::lround(from.x + t * (to.x - from.x))),
+                                       static_cast<int>(std::lround(from.y + t * (to.y - from.y))),
+                                       frame});
+            }
+        }
+    }
+}
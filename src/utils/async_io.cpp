@@ -0,0 +1,626 @@
+#include "utils/async_io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/instrumentation.hpp"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace OT {
+    namespace AsyncIO {
+        // The size of the shared buffer pool.
+        const size_t kNumBuffers = 16;
+        const size_t kBufferSize = 256 * 1024;
+        
+        // Whether useThreadPool() was called.
+        bool forceThreadPool = false;
+        
+        // Carry out a request synchronously. Used by the thread pool backend.
+        bool perform(const Request& request) {
+            Instrumentation::TraceScope trace(request.type == Request::Sync ? "sync" : "write");
+            if (request.type == Request::Sync) {
+                return fdatasync(request.fd) == 0;
+            }
+            const char* data = request.buffer->data;
+            size_t remaining = request.length;
+            off_t offset = request.offset;
+            while (remaining > 0) {
+                ssize_t written = pwrite(request.fd, data, remaining, offset);
+                if (written < 0) {
+                    return false;
+                }
+                data += written;
+                offset += written;
+                remaining -= written;
+            }
+            return true;
+        }
+        
+        /**
+         * Runs requests on a few worker threads. Requests are routed to a worker by file
+         * descriptor, so the requests of one file are carried out in order.
+         */
+        class ThreadPoolBackend : public Backend {
+        private:
+            struct Worker {
+                std::thread thread;
+                std::mutex mutex;
+                std::condition_variable condition;
+                std::deque<Request> queue;
+                bool stopping = false;
+            };
+            
+            Service& service;
+            std::vector<std::unique_ptr<Worker>> workers;
+            
+            void run(Worker& worker) {
+                Instrumentation::setThreadName("io worker");
+                std::unique_lock<std::mutex> lock(worker.mutex);
+                while (true) {
+                    worker.condition.wait(lock, [&worker] {
+                        return worker.stopping || !worker.queue.empty();
+                    });
+                    if (worker.queue.empty()) {
+                        return;
+                    }
+                    Request request = worker.queue.front();
+                    worker.queue.pop_front();
+                    lock.unlock();
+                    this->service.complete(request, perform(request));
+                    lock.lock();
+                }
+            }
+        public:
+            ThreadPoolBackend(Service& service, size_t numWorkers) : service(service) {
+                for (size_t i = 0; i < numWorkers; i++) {
+                    this->workers.push_back(std::make_unique<Worker>());
+                }
+                for (auto& worker : this->workers) {
+                    Worker* w = worker.get();
+                    w->thread = std::thread([this, w] { this->run(*w); });
+                }
+            }
+            
+            ~ThreadPoolBackend() {
+                for (auto& worker : this->workers) {
+                    {
+                        std::lock_guard<std::mutex> lock(worker->mutex);
+                        worker->stopping = true;
+                    }
+                    worker->condition.notify_one();
+                    worker->thread.join();
+                }
+            }
+            
+            void submit(const Request& request) override {
+                Worker& worker = *this->workers[request.fd % this->workers.size()];
+                {
+                    std::lock_guard<std::mutex> lock(worker.mutex);
+                    worker.queue.push_back(request);
+                }
+                worker.condition.notify_one();
+            }
+            
+            void flush() override {
+            }
+            
+            const char* name() const override {
+                return "thread pool";
+            }
+        };
+
+#ifdef __linux__
+        /**
+         * Runs requests through an io_uring. Submitted requests are queued and handed to
+         * the kernel in batches by a single I/O thread, which also reaps the completions.
+         * Writes use the registered buffers when registration succeeded, and syncs are
+         * drained behind every earlier request so they land after the writes they cover.
+         */
+        class IoUringBackend : public Backend {
+        private:
+            Service& service;
+            
+            // The ring.
+            int ringFd;
+            unsigned entries;
+            void* sqRing;
+            void* cqRing;
+            size_t sqRingSize;
+            size_t cqRingSize;
+            io_uring_sqe* sqes;
+            size_t sqesSize;
+            
+            // Pointers into the mapped rings.
+            unsigned* sqTail;
+            unsigned* sqMask;
+            unsigned* sqArray;
+            unsigned* cqHead;
+            unsigned* cqTail;
+            unsigned* cqMask;
+            io_uring_cqe* cqes;
+            
+            // Whether the pool buffers are registered with the ring.
+            bool registeredBuffers;
+            
+            // Start the I/O thread once this many requests are queued.
+            size_t batchSize;
+            
+            // Requests that have been submitted to us but not to the kernel, and the
+            // requests the kernel is working on (indexed by the SQE user data).
+            std::mutex mutex;
+            std::condition_variable condition;
+            std::deque<Request> pending;
+            std::vector<Request> slots;
+            std::vector<unsigned> freeSlots;
+            unsigned inflight;
+            bool flushRequested;
+            bool stopping;
+            std::thread thread;
+            
+            static int setup(unsigned entries, io_uring_params* params) {
+                return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+            }
+            
+            static int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+                return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+            }
+            
+            static int registerBuffers(int fd, const std::vector<iovec>& iovecs) {
+                return static_cast<int>(syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                                                iovecs.data(), static_cast<unsigned>(iovecs.size())));
+            }
+            
+            // Fill the next SQE with the request stored in the given slot.
+            void prepare(unsigned slot) {
+                const Request& request = this->slots[slot];
+                unsigned tail = *this->sqTail;
+                unsigned index = tail & *this->sqMask;
+                io_uring_sqe* sqe = &this->sqes[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->fd = request.fd;
+                sqe->user_data = slot;
+                if (request.type == Request::Sync) {
+                    sqe->opcode = IORING_OP_FSYNC;
+                    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                    sqe->flags = IOSQE_IO_DRAIN;
+                } else {
+                    // Buffers allocated outside the pool aren't registered.
+                    bool fixed = this->registeredBuffers && request.buffer->index >= 0;
+                    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+                    sqe->addr = reinterpret_cast<uint64_t>(request.buffer->data);
+                    sqe->len = static_cast<uint32_t>(request.length);
+                    sqe->off = static_cast<uint64_t>(request.offset);
+                    if (fixed) {
+                        sqe->buf_index = static_cast<uint16_t>(request.buffer->index);
+                    }
+                }
+                this->sqArray[index] = index;
+                __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+            }
+            
+            // Reap every available completion, returning how many there were.
+            unsigned reap() {
+                unsigned head = *this->cqHead;
+                unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+                unsigned count = 0;
+                for (; head != tail; head++, count++) {
+                    io_uring_cqe* cqe = &this->cqes[head & *this->cqMask];
+                    unsigned slot = static_cast<unsigned>(cqe->user_data);
+                    Request request = this->slots[slot];
+                    bool succeeded = cqe->res >= 0;
+                    
+                    // Finish short writes synchronously rather than requeueing them.
+                    if (succeeded && request.type == Request::Write
+                        && static_cast<size_t>(cqe->res) < request.length) {
+                        Request rest = request;
+                        rest.length -= cqe->res;
+                        rest.offset += cqe->res;
+                        Buffer shifted = *request.buffer;
+                        shifted.data += cqe->res;
+                        rest.buffer = &shifted;
+                        succeeded = perform(rest);
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        this->freeSlots.push_back(slot);
+                    }
+                    this->service.complete(request, succeeded);
+                }
+                __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+                return count;
+            }
+            
+            void run() {
+                Instrumentation::setThreadName("io_uring");
+                std::unique_lock<std::mutex> lock(this->mutex);
+                while (true) {
+                    this->condition.wait(lock, [this] {
+                        return this->stopping || this->flushRequested || this->inflight > 0
+                            || this->pending.size() >= this->batchSize;
+                    });
+                    if (this->stopping && this->pending.empty() && this->inflight == 0) {
+                        return;
+                    }
+                    this->flushRequested = false;
+                    
+                    // Move as many queued requests into the ring as there is room for.
+                    unsigned toSubmit = 0;
+                    while (!this->pending.empty() && !this->freeSlots.empty()) {
+                        unsigned slot = this->freeSlots.back();
+                        this->freeSlots.pop_back();
+                        this->slots[slot] = this->pending.front();
+                        this->pending.pop_front();
+                        this->prepare(slot);
+                        toSubmit++;
+                    }
+                    this->inflight += toSubmit;
+                    
+                    // Block for a completion unless there is more we could submit right away.
+                    bool canSubmitMore = !this->pending.empty() && !this->freeSlots.empty();
+                    unsigned minComplete = this->inflight > 0 && !canSubmitMore ? 1 : 0;
+                    lock.unlock();
+                    int submitted;
+                    {
+                        Instrumentation::TraceScope trace("io_uring_enter");
+                        submitted = enter(this->ringFd, toSubmit, minComplete, IORING_ENTER_GETEVENTS);
+                    }
+                    if (submitted < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+                        std::cerr << "io_uring_enter failed: " << std::strerror(errno) << std::endl;
+                    }
+                    unsigned completed = this->reap();
+                    lock.lock();
+                    this->inflight -= completed;
+                }
+            }
+        public:
+            IoUringBackend(Service& service) : service(service) {
+                this->ringFd = -1;
+                this->sqRing = MAP_FAILED;
+                this->cqRing = MAP_FAILED;
+                this->sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+                this->registeredBuffers = false;
+                this->batchSize = 8;
+                this->inflight = 0;
+                this->flushRequested = false;
+                this->stopping = false;
+            }
+            
+            ~IoUringBackend() {
+                if (this->thread.joinable()) {
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        this->stopping = true;
+                    }
+                    this->condition.notify_one();
+                    this->thread.join();
+                }
+                if (this->sqes != MAP_FAILED) {
+                    munmap(this->sqes, this->sqesSize);
+                }
+                if (this->cqRing != MAP_FAILED && this->cqRing != this->sqRing) {
+                    munmap(this->cqRing, this->cqRingSize);
+                }
+                if (this->sqRing != MAP_FAILED) {
+                    munmap(this->sqRing, this->sqRingSize);
+                }
+                if (this->ringFd >= 0) {
+                    close(this->ringFd);
+                }
+            }
+            
+            // Set up the ring and register the buffers. Returns false if io_uring is unavailable.
+            bool init(unsigned entries, const std::vector<Buffer>& buffers) {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+                this->ringFd = setup(entries, &params);
+                if (this->ringFd < 0) {
+                    return false;
+                }
+                this->entries = params.sq_entries;
+                
+                // Map the submission and completion rings, and the SQEs.
+                this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (singleMmap) {
+                    this->sqRingSize = this->cqRingSize = std::max(this->sqRingSize, this->cqRingSize);
+                }
+                this->sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_SQ_RING);
+                if (this->sqRing == MAP_FAILED) {
+                    return false;
+                }
+                if (singleMmap) {
+                    this->cqRing = this->sqRing;
+                } else {
+                    this->cqRing = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_CQ_RING);
+                    if (this->cqRing == MAP_FAILED) {
+                        return false;
+                    }
+                }
+                this->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+                this->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE,
+                                                             MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_SQES));
+                if (this->sqes == MAP_FAILED) {
+                    return false;
+                }
+                
+                char* sq = static_cast<char*>(this->sqRing);
+                char* cq = static_cast<char*>(this->cqRing);
+                this->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                this->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                this->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                this->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                this->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                this->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                this->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+                
+                // Registering the buffers can fail (e.g. RLIMIT_MEMLOCK), in which case we fall
+                // back to plain writes from the same buffers.
+                std::vector<iovec> iovecs;
+                for (auto buffer : buffers) {
+                    iovecs.push_back(iovec{buffer.data, buffer.capacity});
+                }
+                this->registeredBuffers = registerBuffers(this->ringFd, iovecs) == 0;
+                
+                this->slots.resize(this->entries);
+                for (unsigned i = 0; i < this->entries; i++) {
+                    this->freeSlots.push_back(this->entries - 1 - i);
+                }
+                this->thread = std::thread([this] { this->run(); });
+                return true;
+            }
+            
+            void submit(const Request& request) override {
+                bool wake;
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->pending.push_back(request);
+                    wake = this->pending.size() >= this->batchSize;
+                }
+                if (wake) {
+                    this->condition.notify_one();
+                }
+            }
+            
+            void flush() override {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->flushRequested = true;
+                }
+                this->condition.notify_one();
+            }
+            
+            const char* name() const override {
+                return this->registeredBuffers ? "io_uring (registered buffers)" : "io_uring";
+            }
+        };
+#endif
+
+        Service::Service(size_t numBuffers, size_t bufferSize) {
+            this->bufferSize = bufferSize;
+            this->buffersInFlight = 0;
+            this->memory = std::unique_ptr<char[]>(new char[numBuffers * bufferSize]);
+            for (size_t i = 0; i < numBuffers; i++) {
+                this->buffers.push_back(Buffer{this->memory.get() + i * bufferSize, bufferSize, static_cast<int>(i)});
+            }
+            for (auto& buffer : this->buffers) {
+                this->freeBuffers.push_back(&buffer);
+            }
+
+#ifdef __linux__
+            if (!forceThreadPool) {
+                auto ring = std::make_unique<IoUringBackend>(*this);
+                if (ring->init(64, this->buffers)) {
+                    this->backend = std::move(ring);
+                }
+            }
+#endif
+            if (this->backend == nullptr) {
+                this->backend = std::make_unique<ThreadPoolBackend>(*this, 2);
+            }
+        }
+        
+        Service::~Service() {
+            // Stop the backend first, which finishes every outstanding request.
+            this->backend.reset();
+        }
+        
+        Service& Service::shared() {
+            static Service service(kNumBuffers, kBufferSize);
+            return service;
+        }
+        
+        void Service::useThreadPool(bool enabled) {
+            forceThreadPool = enabled;
+        }
+        
+        Buffer* Service::acquire() {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->freeBuffers.empty()) {
+                // Make sure the buffers in flight are actually being written.
+                lock.unlock();
+                this->backend->flush();
+                lock.lock();
+                Instrumentation::TraceScope trace("wait for buffer");
+                this->condition.wait(lock, [this] {
+                    return !this->freeBuffers.empty() || this->buffersInFlight == 0;
+                });
+            }
+            
+            // Every buffer is held by a sink that is still filling it (e.g. many segment
+            // writers between chunks), so none will come back by waiting.
+            if (this->freeBuffers.empty()) {
+                return new Buffer{new char[this->bufferSize], this->bufferSize, -1};
+            }
+            Buffer* buffer = this->freeBuffers.back();
+            this->freeBuffers.pop_back();
+            return buffer;
+        }
+        
+        void Service::submit(const Request& request) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                request.sink->inflight++;
+                if (request.buffer != nullptr) {
+                    this->buffersInFlight++;
+                }
+            }
+            this->backend->submit(request);
+        }
+        
+        void Service::flush() {
+            this->backend->flush();
+        }
+        
+        void Service::complete(const Request& request, bool succeeded) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (request.buffer != nullptr) {
+                    this->buffersInFlight--;
+                    if (request.buffer->index >= 0) {
+                        this->freeBuffers.push_back(&this->buffers[request.buffer->index]);
+                    } else {
+                        delete[] request.buffer->data;
+                        delete request.buffer;
+                    }
+                }
+                request.sink->inflight--;
+                if (!succeeded) {
+                    request.sink->failed = true;
+                }
+            }
+            this->condition.notify_all();
+        }
+        
+        void Service::waitFor(Sink* sink) {
+            this->backend->flush();
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->condition.wait(lock, [sink] { return sink->inflight == 0; });
+        }
+        
+        const char* Service::backendName() const {
+            return this->backend->name();
+        }
+        
+        Sink::Sink() {
+            this->fd = -1;
+            this->offset = 0;
+            this->current = nullptr;
+            this->used = 0;
+            this->inflight = 0;
+            this->failed = false;
+        }
+        
+        Sink::~Sink() {
+            this->close();
+        }
+        
+        bool Sink::open(const std::string& path, bool append) {
+            this->close();
+            this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+            if (this->fd < 0) {
+                return false;
+            }
+            
+            // Writes carry explicit offsets, so start appending at the current end of file.
+            struct stat st;
+            this->offset = (append && fstat(this->fd, &st) == 0) ? st.st_size : 0;
+            this->failed = false;
+            return true;
+        }
+        
+        bool Sink::isOpen() const {
+            return this->fd >= 0;
+        }
+        
+        void Sink::write(const char* data, size_t length) {
+            if (this->fd < 0) {
+                return;
+            }
+            while (length > 0) {
+                if (this->current == nullptr) {
+                    this->current = Service::shared().acquire();
+                    this->used = 0;
+                }
+                size_t n = std::min(length, this->current->capacity - this->used);
+                std::memcpy(this->current->data + this->used, data, n);
+                this->used += n;
+                data += n;
+                length -= n;
+                if (this->used == this->current->capacity) {
+                    this->submitCurrent();
+                }
+            }
+        }
+        
+        void Sink::write(const std::string& data) {
+            this->write(data.data(), data.size());
+        }
+        
+        void Sink::submitCurrent() {
+            if (this->current == nullptr) {
+                return;
+            }
+            Service::shared().submit(Request{Request::Write, this->fd, this->current, this->used, this->offset, this});
+            this->offset += this->used;
+            this->current = nullptr;
+            this->used = 0;
+        }
+        
+        void Sink::flush() {
+            if (this->fd < 0) {
+                return;
+            }
+            this->submitCurrent();
+            Service::shared().flush();
+        }
+        
+        void Sink::sync() {
+            if (this->fd < 0) {
+                return;
+            }
+            this->submitCurrent();
+            Service::shared().submit(Request{Request::Sync, this->fd, nullptr, 0, 0, this});
+            Service::shared().flush();
+        }
+        
+        void Sink::wait() {
+            if (this->fd < 0) {
+                return;
+            }
+            this->submitCurrent();
+            Service::shared().waitFor(this);
+        }
+        
+        bool Sink::close() {
+            if (this->fd < 0) {
+                return !this->failed;
+            }
+            this->wait();
+            ::close(this->fd);
+            this->fd = -1;
+            return !this->failed;
+        }
+    }
+}
@@ -0,0 +1,179 @@
+#include "utils/deadline_scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace OT {
+    namespace {
+        // The frame rate assumed for streams that don't know theirs.
+        const double kDefaultFps = 30;
+        
+        DeadlineScheduler::Clock::duration toDuration(double seconds) {
+            return std::chrono::duration_cast<DeadlineScheduler::Clock::duration>(std::chrono::duration<double>(seconds));
+        }
+    }
+    
+    DeadlineScheduler::DeadlineScheduler(size_t window, double maxMissRate, int maxDetectionInterval) {
+        this->window = std::max<size_t>(1, window);
+        this->maxMissRate = maxMissRate;
+        this->maxDetectionInterval = std::max(1, maxDetectionInterval);
+    }
+    
+    DeadlineScheduler::Stream* DeadlineScheduler::find(int id) {
+        for (auto& stream : this->streams) {
+            if (stream.id == id) {
+                return &stream;
+            }
+        }
+        return nullptr;
+    }
+    
+    const DeadlineScheduler::Stream* DeadlineScheduler::find(int id) const {
+        for (const auto& stream : this->streams) {
+            if (stream.id == id) {
+                return &stream;
+            }
+        }
+        return nullptr;
+    }
+    
+    void DeadlineScheduler::addStream(int id, double fps, double latencyMs, double weight) {
+        Stream stream;
+        stream.id = id;
+        stream.frameInterval = Clock::duration::zero();
+        stream.latency = Clock::duration::zero();
+        stream.weight = 1;
+        stream.start = Clock::now();
+        stream.nextFrame = 0;
+        stream.running = false;
+        stream.active = true;
+        stream.detectionInterval = 1;
+        stream.stats = StreamStats{0, 0, 0, 0, 0, 0, 1};
+        this->streams.push_back(stream);
+        this->updateStream(id, fps, latencyMs, weight);
+    }
+    
+    void DeadlineScheduler::updateStream(int id, double fps, double latencyMs, double weight) {
+        Stream* stream = this->find(id);
+        if (stream == nullptr) {
+            return;
+        }
+        
+        // Keep the release time of the next frame where it is when the rate changes.
+        Clock::time_point nextRelease = this->release(*stream);
+        stream->frameInterval = toDuration(1 / (fps > 0 ? fps : kDefaultFps));
+        stream->latency = toDuration(std::max(0.0, latencyMs) / 1000);
+        stream->weight = weight > 0 ? weight : 1;
+        stream->start = nextRelease - stream->frameInterval * stream->nextFrame;
+    }
+    
+    void DeadlineScheduler::deactivate(int id) {
+        Stream* stream = this->find(id);
+        if (stream != nullptr) {
+            stream->active = false;
+        }
+    }
+    
+    void DeadlineScheduler::removeStream(int id) {
+        this->streams.erase(std::remove_if(this->streams.begin(), this->streams.end(), [id](const Stream& stream) {
+            return stream.id == id;
+        }), this->streams.end());
+    }
+    
+    DeadlineScheduler::Clock::time_point DeadlineScheduler::release(const Stream& stream) const {
+        return stream.start + stream.frameInterval * stream.nextFrame;
+    }
+    
+    DeadlineScheduler::Clock::time_point DeadlineScheduler::priority(const Stream& stream) const {
+        return this->release(stream) + toDuration(std::chrono::duration<double>(stream.latency).count() / stream.weight);
+    }
+    
+    bool DeadlineScheduler::next(Task& task, Clock::time_point now) {
+        Stream* best = nullptr;
+        for (auto& stream : this->streams) {
+            if (!stream.active || stream.running) {
+                continue;
+            }
+            
+            // A stream that is more than a few latency targets (or a second) behind would keep
+            // the earliest deadline for as long as it stays behind, so count from now instead.
+            Clock::duration maxBehind = std::max<Clock::duration>(stream.latency * 4, std::chrono::seconds(1));
+            if (now - (this->release(stream) + stream.latency) > maxBehind) {
+                stream.start = now - stream.frameInterval * stream.nextFrame;
+                stream.stats.resets++;
+            }
+            
+            // Frames aren't taken before they are released.
+            if (this->release(stream) > now) {
+                continue;
+            }
+            if (best == nullptr || this->priority(stream) < this->priority(*best)) {
+                best = &stream;
+            }
+        }
+        if (best == nullptr) {
+            return false;
+        }
+        
+        task.stream = best->id;
+        task.frame = best->nextFrame;
+        task.detect = best->nextFrame % best->detectionInterval == 0;
+        task.deadline = this->release(*best) + best->latency;
+        best->nextFrame++;
+        best->running = true;
+        return true;
+    }
+    
+    DeadlineScheduler::Clock::time_point DeadlineScheduler::nextRelease() const {
+        Clock::time_point earliest = Clock::time_point::max();
+        for (const auto& stream : this->streams) {
+            if (stream.active && !stream.running) {
+                earliest = std::min(earliest, this->release(stream));
+            }
+        }
+        return earliest;
+    }
+    
+    void DeadlineScheduler::complete(const Task& task, Clock::time_point finished) {
+        Stream* stream = this->find(task.stream);
+        if (stream == nullptr) {
+            return;
+        }
+        stream->running = false;
+        
+        StreamStats& stats = stream->stats;
+        bool missed = finished > task.deadline;
+        stats.frames++;
+        if (task.detect) {
+            stats.detected++;
+        }
+        if (missed) {
+            stats.misses++;
+        }
+        stats.lastLatenessMs = std::chrono::duration<double, std::milli>(finished - task.deadline).count();
+        
+        stream->recent.push_back(missed);
+        long recentMisses = std::count(stream->recent.begin(), stream->recent.end(), true);
+        stats.recentMissRate = static_cast<double>(recentMisses) / stream->recent.size();
+        
+        // Once there are enough frames to tell, shed load if too many missed, and take it
+        // back once none do.
+        if (stream->recent.size() >= this->window) {
+            if (stats.recentMissRate > this->maxMissRate) {
+                stream->detectionInterval = std::min(this->maxDetectionInterval, stream->detectionInterval * 2);
+            } else if (recentMisses == 0) {
+                stream->detectionInterval = std::max(1, stream->detectionInterval / 2);
+            }
+            stream->recent.clear();
+        }
+        stats.detectionInterval = stream->detectionInterval;
+    }
+    
+    DeadlineScheduler::StreamStats DeadlineScheduler::stats(int id) const {
+        const Stream* stream = this->find(id);
+        if (stream == nullptr) {
+            return StreamStats{0, 0, 0, 0, 0, 0, 1};
+        }
+        return stream->stats;
+    }
+}
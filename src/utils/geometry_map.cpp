@@ -0,0 +1,194 @@
+#include "utils/geometry_map.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "lib/json.hpp"
+#include "utils/async_io.hpp"
+
+namespace OT {
+    // The cache file starts with this magic, followed by the number of parameters, the
+    // parameters, and the two tables.
+    const char kGeometryMapMagic[4] = {'O', 'T', 'G', 'M'};
+    
+    GeometryMap::GeometryMap() {
+        this->cameraMatrix = cv::Matx33d::eye();
+        this->perspective = cv::Matx33d::eye();
+        this->maxDimension = -1;
+    }
+    
+    bool GeometryMap::loadCalibration(const std::string& path) {
+        std::ifstream calibrationFile(path);
+        if (!calibrationFile.is_open()) {
+            return false;
+        }
+        nlohmann::json json;
+        try {
+            calibrationFile >> json;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    this->cameraMatrix(i, j) = json["camera_matrix"][i][j].get<double>();
+                }
+            }
+            this->distortion = json["distortion_coefficients"].get<std::vector<double>>();
+            this->calibrationSize = cv::Size(json["image_width"].get<int>(), json["image_height"].get<int>());
+        } catch (const std::exception& e) {
+            std::cerr << "Problem parsing " << path << ": " << e.what() << std::endl;
+            return false;
+        }
+        this->cachePath = path + ".map";
+        return true;
+    }
+    
+    void GeometryMap::setPerspective(const cv::Mat& matrix, cv::Size size) {
+        cv::Mat converted;
+        matrix.convertTo(converted, CV_64F);
+        this->perspective = cv::Matx33d(converted.ptr<double>());
+        this->perspectiveSize = size;
+    }
+    
+    void GeometryMap::setMaxDimension(int maxDimension) {
+        this->maxDimension = maxDimension;
+    }
+    
+    std::vector<double> GeometryMap::parameters() const {
+        std::vector<double> values = {
+            static_cast<double>(this->inputSize.width),
+            static_cast<double>(this->inputSize.height),
+            static_cast<double>(this->outputSize.width),
+            static_cast<double>(this->outputSize.height),
+            static_cast<double>(this->calibrationSize.width),
+            static_cast<double>(this->calibrationSize.height)
+        };
+        values.insert(values.end(), this->cameraMatrix.val, this->cameraMatrix.val + 9);
+        values.insert(values.end(), this->perspective.val, this->perspective.val + 9);
+        values.insert(values.end(), this->distortion.begin(), this->distortion.end());
+        return values;
+    }
+    
+    bool GeometryMap::isEnabled() const {
+        return this->calibrationSize.area() > 0 || this->perspectiveSize.area() > 0;
+    }
+    
+    void GeometryMap::prepare(cv::Size inputSize) {
+        this->inputSize = inputSize;
+        
+        // The calibration holds for the same camera at other resolutions, scaled.
+        cv::Matx33d camera = this->cameraMatrix;
+        if (this->calibrationSize.area() > 0 && this->calibrationSize != inputSize) {
+            double sx = static_cast<double>(inputSize.width) / this->calibrationSize.width;
+            double sy = static_cast<double>(inputSize.height) / this->calibrationSize.height;
+            camera = cv::Matx33d(sx, 0, 0, 0, sy, 0, 0, 0, 1) * this->cameraMatrix;
+        }
+        
+        // The size after the perspective transform, and after the scaling (computed the
+        // same way as Utils::scale()).
+        cv::Size size = this->perspectiveSize.area() > 0 ? this->perspectiveSize : inputSize;
+        this->outputSize = size;
+        if (this->maxDimension != -1 && (this->maxDimension < size.height || this->maxDimension < size.width)) {
+            double scale = (1.0 * this->maxDimension) / size.height;
+            if (size.width > size.height) {
+                scale = (1.0 * this->maxDimension) / size.width;
+            }
+            this->outputSize = cv::Size(static_cast<int>(size.width * scale), static_cast<int>(size.height * scale));
+        }
+        
+        if (!this->cachePath.empty() && this->loadCache(this->cachePath)) {
+            return;
+        }
+        
+        // The scaling, with the pixel centers lined up the way cv::resize() does.
+        double sx = static_cast<double>(this->outputSize.width) / size.width;
+        double sy = static_cast<double>(this->outputSize.height) / size.height;
+        cv::Matx33d scaling(sx, 0, 0.5 * sx - 0.5,
+                            0, sy, 0.5 * sy - 0.5,
+                            0, 0, 1);
+        
+        // initUndistortRectifyMap maps each output pixel p to the ray (newCamera * R)^-1 p,
+        // distorts it and projects it with the camera matrix. With R = I, choosing
+        // newCamera = scaling * perspective * camera sends p back through the scaling and
+        // the perspective transform to the undistorted frame, then to the distorted input.
+        cv::Matx33d composed = scaling * this->perspective * camera;
+        cv::initUndistortRectifyMap(camera,
+                                    this->distortion,
+                                    cv::Matx33d::eye(),
+                                    composed,
+                                    this->outputSize,
+                                    CV_16SC2,
+                                    this->map1,
+                                    this->map2);
+        if (!this->cachePath.empty()) {
+            this->saveCache(this->cachePath);
+        }
+    }
+    
+    void GeometryMap::correct(cv::Mat& frame) {
+        if (this->map1.empty() || frame.size() != this->inputSize) {
+            this->prepare(frame.size());
+        }
+        
+        // The remap can't be done in place, so swap the buffers instead.
+        cv::remap(frame, this->corrected, this->map1, this->map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+        std::swap(frame, this->corrected);
+    }
+    
+    bool GeometryMap::loadCache(const std::string& path) {
+        std::ifstream cacheFile(path, std::ios::binary);
+        if (!cacheFile.is_open()) {
+            return false;
+        }
+        char magic[4];
+        uint32_t numParameters = 0;
+        if (!cacheFile.read(magic, sizeof(magic))
+            || !std::equal(kGeometryMapMagic, kGeometryMapMagic + 4, magic)
+            || !cacheFile.read(reinterpret_cast<char*>(&numParameters), sizeof(numParameters))) {
+            return false;
+        }
+        std::vector<double> expected = this->parameters();
+        std::vector<double> cached(numParameters);
+        if (numParameters != expected.size()
+            || !cacheFile.read(reinterpret_cast<char*>(cached.data()), numParameters * sizeof(double))
+            || cached != expected) {
+            return false;
+        }
+        
+        cv::Mat map1(this->outputSize, CV_16SC2);
+        cv::Mat map2(this->outputSize, CV_16UC1);
+        if (!cacheFile.read(reinterpret_cast<char*>(map1.data), map1.total() * map1.elemSize())
+            || !cacheFile.read(reinterpret_cast<char*>(map2.data), map2.total() * map2.elemSize())) {
+            return false;
+        }
+        this->map1 = map1;
+        this->map2 = map2;
+        return true;
+    }
+    
+    void GeometryMap::saveCache(const std::string& path) const {
+        std::vector<double> parameters = this->parameters();
+        uint32_t numParameters = static_cast<uint32_t>(parameters.size());
+        
+        // Write to a temporary file and rename it, so a crash never leaves a partial table.
+        std::string temporaryPath = path + ".tmp";
+        OT::AsyncIO::Sink sink;
+        if (!sink.open(temporaryPath)) {
+            std::cerr << "Problem writing the geometry map " << temporaryPath << std::endl;
+            return;
+        }
+        sink.write(kGeometryMapMagic, sizeof(kGeometryMapMagic));
+        sink.write(reinterpret_cast<const char*>(&numParameters), sizeof(numParameters));
+        sink.write(reinterpret_cast<const char*>(parameters.data()), parameters.size() * sizeof(double));
+        sink.write(reinterpret_cast<const char*>(this->map1.data), this->map1.total() * this->map1.elemSize());
+        sink.write(reinterpret_cast<const char*>(this->map2.data), this->map2.total() * this->map2.elemSize());
+        if (sink.close()) {
+            std::rename(temporaryPath.c_str(), path.c_str());
+        }
+    }
+}
@@ -0,0 +1,589 @@
+#include "utils/instrumentation.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <iostream>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "utils/async_io.hpp"
+#include "utils/perf_counters.hpp"
+
+namespace OT {
+    namespace Instrumentation {
+        // The stage of each thread.
+        thread_local Stage threadStage = Other;
+        
+        // The allocation counts of a thread, per stage.
+        struct ThreadAllocations {
+            std::atomic<uint64_t> allocations[NumStages];
+            std::atomic<uint64_t> bytes[NumStages];
+            std::atomic<uint64_t> frees[NumStages];
+        };
+        
+        // The allocation counts of every thread, so that the reports can add them up. A
+        // thread takes a slot on its first allocation and keeps it, so the counts outlive
+        // the thread, and threads beyond the last slot share it. This is all static, so
+        // counting from operator new never allocates.
+        const int kAllocationSlots = 256;
+        ThreadAllocations allocationSlots[kAllocationSlots];
+        std::atomic<int> allocationSlotsTaken(0);
+        thread_local ThreadAllocations* threadAllocations = nullptr;
+        
+        ThreadAllocations& currentThreadAllocations() {
+            if (threadAllocations == nullptr) {
+                int slot = allocationSlotsTaken.fetch_add(1, std::memory_order_relaxed);
+                threadAllocations = &allocationSlots[std::min(slot, kAllocationSlots - 1)];
+            }
+            return *threadAllocations;
+        }
+        
+        AllocationCounts slotCounts(const ThreadAllocations& slot, Stage stage) {
+            return AllocationCounts{
+                slot.allocations[stage].load(std::memory_order_relaxed),
+                slot.bytes[stage].load(std::memory_order_relaxed),
+                slot.frees[stage].load(std::memory_order_relaxed)
+            };
+        }
+        
+        const char* stageName(Stage stage) {
+            switch (stage) {
+                case Other: return "other";
+                case Capture: return "capture";
+                case Correction: return "correction";
+                case Detection: return "detection";
+                case Tracking: return "tracking";
+                case Analytics: return "analytics";
+                case Logging: return "logging";
+                case Display: return "display";
+                default: return "unknown";
+            }
+        }
+        
+        Stage currentStage() {
+            return threadStage;
+        }
+        
+        // A complete trace event, in nanoseconds since tracing started.
+        struct TraceEvent {
+            const char* name;
+            int64_t start;
+            int64_t duration;
+        };
+        
+        // The trace events of one thread. Only the thread itself appends to it: it fills in
+        // an event and then publishes it by bumping the count, so the writer can read every
+        // published event without a lock.
+        struct ThreadTrace {
+            int tid;
+            std::atomic<const char*> name;
+            std::unique_ptr<TraceEvent[]> events;
+            size_t capacity;
+            std::atomic<size_t> count;
+            std::atomic<size_t> dropped;
+        };
+        
+        std::atomic<bool> tracing(false);
+        std::string tracePath;
+        size_t traceCapacity = 0;
+        std::chrono::steady_clock::time_point traceStart;
+        
+        // Every thread's trace. They are never freed, so they outlive their threads.
+        std::mutex traceMutex;
+        std::vector<std::unique_ptr<ThreadTrace>> threadTraces;
+        
+        // The trace and the name of the calling thread.
+        thread_local ThreadTrace* threadTrace = nullptr;
+        thread_local const char* threadName = nullptr;
+        
+        // Set by the SIGUSR1 handler.
+        volatile std::sig_atomic_t traceRequested = 0;
+        
+        int64_t traceNow() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+        }
+        
+        ThreadTrace* currentThreadTrace() {
+            if (threadTrace == nullptr) {
+                std::unique_ptr<ThreadTrace> trace(new ThreadTrace());
+                trace->name = threadName;
+                trace->events.reset(new TraceEvent[traceCapacity]);
+                trace->capacity = traceCapacity;
+                trace->count = 0;
+                trace->dropped = 0;
+                
+                std::lock_guard<std::mutex> lock(traceMutex);
+                trace->tid = static_cast<int>(threadTraces.size()) + 1;
+                threadTrace = trace.get();
+                threadTraces.push_back(std::move(trace));
+            }
+            return threadTrace;
+        }
+        
+        void recordEvent(const char* name, int64_t start) {
+            int64_t end = traceNow();
+            ThreadTrace* trace = currentThreadTrace();
+            size_t index = trace->count.load(std::memory_order_relaxed);
+            if (index >= trace->capacity) {
+                trace->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            trace->events[index] = TraceEvent{name, start, end - start};
+            trace->count.store(index + 1, std::memory_order_release);
+        }
+        
+        // The hardware counters of a thread, and the time and the counts at its last change
+        // of stage.
+        struct ThreadCounters {
+            PerfCounters counters;
+            std::chrono::steady_clock::time_point lastMarkTime;
+            uint64_t lastMarkEvents[PerfCounters::NumEvents];
+        };
+        
+        // Every thread that works in a stage counts its own events, and adds them and its
+        // time to the totals of the stage. Only the thread that started counting adds the
+        // time outside of the stages, as the other threads are idle or not part of the
+        // pipeline then.
+        std::atomic<bool> perfEnabled(false);
+        thread_local std::unique_ptr<ThreadCounters> threadCounters;
+        thread_local bool threadCountsOther = false;
+        std::atomic<uint64_t> stageNanoseconds[NumStages];
+        std::atomic<uint64_t> stageEvents[NumStages][PerfCounters::NumEvents];
+        
+        // The events the thread that started counting could count, which the others can too.
+        bool eventAvailable[PerfCounters::NumEvents];
+        
+        // Open the counters of the calling thread. Returns false if none are available.
+        bool openThreadCounters() {
+            std::unique_ptr<ThreadCounters> counters(new ThreadCounters());
+            bool opened = counters->counters.open();
+            counters->counters.read(counters->lastMarkEvents);
+            counters->lastMarkTime = std::chrono::steady_clock::now();
+            threadCounters = std::move(counters);
+            return opened;
+        }
+        
+        // Add the time and the events of the calling thread since its last change of stage
+        // to the stage. The first time, this opens the counters of the thread instead.
+        void markStage(Stage stage) {
+            if (threadCounters == nullptr) {
+                openThreadCounters();
+                return;
+            }
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            uint64_t events[PerfCounters::NumEvents];
+            threadCounters->counters.read(events);
+            
+            bool counted = stage != Other || threadCountsOther;
+            if (counted) {
+                uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now - threadCounters->lastMarkTime).count();
+                stageNanoseconds[stage].fetch_add(nanoseconds, std::memory_order_relaxed);
+            }
+            for (int i = 0; i < PerfCounters::NumEvents; i++) {
+                if (counted && events[i] > threadCounters->lastMarkEvents[i]) {
+                    stageEvents[stage][i].fetch_add(events[i] - threadCounters->lastMarkEvents[i], std::memory_order_relaxed);
+                }
+                threadCounters->lastMarkEvents[i] = events[i];
+            }
+            threadCounters->lastMarkTime = now;
+        }
+        
+        StageScope::StageScope(Stage stage) {
+            this->stage = stage;
+            this->previous = threadStage;
+            this->start = tracing.load(std::memory_order_relaxed) ? traceNow() : -1;
+            if (perfEnabled.load(std::memory_order_relaxed)) {
+                markStage(threadStage);
+            }
+            threadStage = stage;
+        }
+        
+        StageScope::~StageScope() {
+            if (perfEnabled.load(std::memory_order_relaxed)) {
+                markStage(threadStage);
+            }
+            threadStage = this->previous;
+            if (this->start >= 0) {
+                recordEvent(stageName(this->stage), this->start);
+            }
+        }
+        
+        TraceScope::TraceScope(const char* name) {
+            this->name = name;
+            this->start = tracing.load(std::memory_order_relaxed) ? traceNow() : -1;
+        }
+        
+        TraceScope::~TraceScope() {
+            if (this->start >= 0) {
+                recordEvent(this->name, this->start);
+            }
+        }
+        
+        void requestTrace(int) {
+            traceRequested = 1;
+        }
+        
+        void startTracing(const std::string& path, size_t eventsPerThread) {
+            tracePath = path;
+            traceCapacity = eventsPerThread;
+            traceStart = std::chrono::steady_clock::now();
+            tracing.store(true);
+            std::signal(SIGUSR1, requestTrace);
+        }
+        
+        bool tracingEnabled() {
+            return tracing.load(std::memory_order_relaxed);
+        }
+        
+        void setThreadName(const char* name) {
+            threadName = name;
+            if (threadTrace != nullptr) {
+                threadTrace->name = name;
+            }
+        }
+        
+        bool writeTrace() {
+            if (!tracingEnabled()) {
+                return false;
+            }
+            
+            // Take the threads under the lock, but don't hold it while writing: the writes go
+            // through the I/O threads, which may need it to start their own traces.
+            std::vector<ThreadTrace*> traces;
+            {
+                std::lock_guard<std::mutex> lock(traceMutex);
+                for (auto& trace : threadTraces) {
+                    traces.push_back(trace.get());
+                }
+            }
+            
+            std::string temporaryPath = tracePath + ".tmp";
+            OT::AsyncIO::Sink sink;
+            if (!sink.open(temporaryPath)) {
+                return false;
+            }
+            sink.write("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+            char line[256];
+            bool first = true;
+            size_t dropped = 0;
+            for (ThreadTrace* trace : traces) {
+                const char* name = trace->name.load();
+                std::snprintf(line, sizeof(line),
+                              "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                              first ? "" : ",\n",
+                              trace->tid,
+                              name != nullptr ? name : "thread");
+                sink.write(line);
+                first = false;
+                
+                size_t count = trace->count.load(std::memory_order_acquire);
+                for (size_t i = 0; i < count; i++) {
+                    const TraceEvent& event = trace->events[i];
+                    std::snprintf(line, sizeof(line),
+                                  ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                                  event.name,
+                                  trace->tid,
+                                  event.start / 1000.0,
+                                  event.duration / 1000.0);
+                    sink.write(line);
+                }
+                dropped += trace->dropped.load(std::memory_order_relaxed);
+            }
+            sink.write("\n]}\n");
+            if (!sink.close() || std::rename(temporaryPath.c_str(), tracePath.c_str()) != 0) {
+                return false;
+            }
+            if (dropped > 0) {
+                std::cerr << "The trace buffers were full, " << dropped << " events were dropped" << std::endl;
+            }
+            return true;
+        }
+        
+        void pollTraceRequest() {
+            if (traceRequested) {
+                traceRequested = 0;
+                if (writeTrace()) {
+                    std::cout << "Wrote the trace to " << tracePath << std::endl;
+                }
+            }
+        }
+        
+        bool startPerfCounters() {
+            if (perfEnabled.load()) {
+                return true;
+            }
+            if (!openThreadCounters()) {
+                threadCounters.reset();
+                return false;
+            }
+            for (int i = 0; i < PerfCounters::NumEvents; i++) {
+                eventAvailable[i] = threadCounters->counters.isAvailable(static_cast<PerfCounters::Event>(i));
+            }
+            threadCountsOther = true;
+            perfEnabled.store(true);
+            return true;
+        }
+        
+        bool perfCountersEnabled() {
+            return perfEnabled.load();
+        }
+        
+        StageCounts stageCounts(Stage stage) {
+            StageCounts counts;
+            counts.nanoseconds = stageNanoseconds[stage].load(std::memory_order_relaxed);
+            for (int i = 0; i < PerfCounters::NumEvents; i++) {
+                counts.events[i] = stageEvents[stage][i].load(std::memory_order_relaxed);
+            }
+            return counts;
+        }
+        
+        PerfReport::PerfReport() {
+            this->numFrames = 0;
+            for (int stage = 0; stage < NumStages; stage++) {
+                this->previous[stage] = stageCounts(static_cast<Stage>(stage));
+                this->totals[stage] = StageCounts{};
+                this->longest[stage] = 0;
+            }
+        }
+        
+        void PerfReport::nextFrame() {
+            if (perfEnabled.load(std::memory_order_relaxed)) {
+                markStage(threadStage);
+            }
+            this->numFrames++;
+            for (int stage = 0; stage < NumStages; stage++) {
+                StageCounts current = stageCounts(static_cast<Stage>(stage));
+                uint64_t nanoseconds = current.nanoseconds - this->previous[stage].nanoseconds;
+                this->totals[stage].nanoseconds += nanoseconds;
+                for (int i = 0; i < PerfCounters::NumEvents; i++) {
+                    this->totals[stage].events[i] += current.events[i] - this->previous[stage].events[i];
+                }
+                this->longest[stage] = std::max(this->longest[stage], nanoseconds);
+                this->previous[stage] = current;
+            }
+        }
+        
+        void PerfReport::print(std::ostream& out) const {
+            if (!perfEnabled.load()) {
+                out << "Hardware events were not counted" << std::endl;
+                return;
+            }
+            char line[160];
+            std::snprintf(line, sizeof(line), "%-12s %10s %10s %14s %8s %18s %18s",
+                          "stage", "ms/frame", "max ms", "Mcycles/frame", "IPC", "cache misses/frame", "branch misses/frame");
+            out << "Stages over " << this->numFrames << " frames:" << std::endl << line << std::endl;
+            double frames = this->numFrames > 0 ? this->numFrames : 1;
+            
+            // Counters the machine doesn't have are shown as -.
+            auto column = [](char* text, size_t size, bool available, double value, const char* format) {
+                if (available) {
+                    std::snprintf(text, size, format, value);
+                } else {
+                    std::snprintf(text, size, "-");
+                }
+            };
+            for (int stage = 0; stage < NumStages; stage++) {
+                const StageCounts& totals = this->totals[stage];
+                double cycles = static_cast<double>(totals.events[PerfCounters::Cycles]);
+                double instructions = static_cast<double>(totals.events[PerfCounters::Instructions]);
+                char cyclesText[32];
+                char ipcText[32];
+                char cacheText[32];
+                char branchText[32];
+                column(cyclesText, sizeof(cyclesText), eventAvailable[PerfCounters::Cycles],
+                       cycles / frames / 1e6, "%.2f");
+                column(ipcText, sizeof(ipcText),
+                       eventAvailable[PerfCounters::Cycles] && eventAvailable[PerfCounters::Instructions] && cycles > 0,
+                       instructions / (cycles > 0 ? cycles : 1), "%.2f");
+                column(cacheText, sizeof(cacheText), eventAvailable[PerfCounters::CacheMisses],
+                       totals.events[PerfCounters::CacheMisses] / frames, "%.0f");
+                column(branchText, sizeof(branchText), eventAvailable[PerfCounters::BranchMisses],
+                       totals.events[PerfCounters::BranchMisses] / frames, "%.0f");
+                std::snprintf(line, sizeof(line), "%-12s %10.3f %10.3f %14s %8s %18s %18s",
+                              stageName(static_cast<Stage>(stage)),
+                              totals.nanoseconds / frames / 1e6,
+                              this->longest[stage] / 1e6,
+                              cyclesText,
+                              ipcText,
+                              cacheText,
+                              branchText);
+                out << line << std::endl;
+            }
+            out << "The times and events are summed over the threads working in each stage" << std::endl;
+        }
+        
+        bool allocationTrackingEnabled() {
+#ifdef OT_ALLOC_TRACKING
+            return true;
+#else
+            return false;
+#endif
+        }
+        
+        AllocationCounts allocations(Stage stage) {
+            return slotCounts(currentThreadAllocations(), stage);
+        }
+        
+        AllocationCounts allocations() {
+            AllocationCounts sum = {0, 0, 0};
+            for (int stage = 0; stage < NumStages; stage++) {
+                AllocationCounts counts = allocations(static_cast<Stage>(stage));
+                sum.allocations += counts.allocations;
+                sum.bytes += counts.bytes;
+                sum.frees += counts.frees;
+            }
+            return sum;
+        }
+        
+        AllocationCounts allThreadAllocations(Stage stage) {
+            AllocationCounts sum = {0, 0, 0};
+            int slots = std::min(allocationSlotsTaken.load(std::memory_order_relaxed), kAllocationSlots);
+            for (int i = 0; i < slots; i++) {
+                AllocationCounts counts = slotCounts(allocationSlots[i], stage);
+                sum.allocations += counts.allocations;
+                sum.bytes += counts.bytes;
+                sum.frees += counts.frees;
+            }
+            return sum;
+        }
+        
+        AllocationReport::AllocationReport() {
+            this->numFrames = 0;
+            for (int stage = 0; stage < NumStages; stage++) {
+                this->previous[stage] = allThreadAllocations(static_cast<Stage>(stage));
+                this->last[stage] = AllocationCounts{0, 0, 0};
+                this->totals[stage] = AllocationCounts{0, 0, 0};
+                this->most[stage] = AllocationCounts{0, 0, 0};
+                this->lastAllocatingFrame[stage] = 0;
+            }
+        }
+        
+        void AllocationReport::nextFrame() {
+            this->numFrames++;
+            for (int stage = 0; stage < NumStages; stage++) {
+                AllocationCounts current = allThreadAllocations(static_cast<Stage>(stage));
+                AllocationCounts& frame = this->last[stage];
+                frame.allocations = current.allocations - this->previous[stage].allocations;
+                frame.bytes = current.bytes - this->previous[stage].bytes;
+                frame.frees = current.frees - this->previous[stage].frees;
+                this->previous[stage] = current;
+                
+                this->totals[stage].allocations += frame.allocations;
+                this->totals[stage].bytes += frame.bytes;
+                this->totals[stage].frees += frame.frees;
+                if (frame.allocations > this->most[stage].allocations) {
+                    this->most[stage].allocations = frame.allocations;
+                }
+                if (frame.bytes > this->most[stage].bytes) {
+                    this->most[stage].bytes = frame.bytes;
+                }
+                if (frame.frees > this->most[stage].frees) {
+                    this->most[stage].frees = frame.frees;
+                }
+                if (frame.allocations > 0) {
+                    this->lastAllocatingFrame[stage] = this->numFrames;
+                }
+            }
+        }
+        
+        AllocationCounts AllocationReport::lastFrame(Stage stage) const {
+            return this->last[stage];
+        }
+        
+        void AllocationReport::print(std::ostream& out) const {
+            if (!allocationTrackingEnabled()) {
+                out << "Allocations were not counted (build with OT_ALLOC_TRACKING)" << std::endl;
+                return;
+            }
+            char line[160];
+            std::snprintf(line, sizeof(line), "%-12s %14s %14s %12s %14s %18s",
+                          "stage", "allocs/frame", "bytes/frame", "max allocs", "max bytes", "last allocating");
+            out << "Heap allocations over " << this->numFrames << " frames:" << std::endl << line << std::endl;
+            double frames = this->numFrames > 0 ? this->numFrames : 1;
+            for (int stage = 0; stage < NumStages; stage++) {
+                std::snprintf(line, sizeof(line), "%-12s %14.1f %14.0f %12llu %14llu %18ld",
+                              stageName(static_cast<Stage>(stage)),
+                              this->totals[stage].allocations / frames,
+                              this->totals[stage].bytes / frames,
+                              static_cast<unsigned long long>(this->most[stage].allocations),
+                              static_cast<unsigned long long>(this->most[stage].bytes),
+                              this->lastAllocatingFrame[stage]);
+                out << line << std::endl;
+            }
+        }
+    }
+}
+
+#ifdef OT_ALLOC_TRACKING
+namespace {
+    // Count an allocation against the stage of the calling thread.
+    void* countedAllocation(std::size_t size) {
+        OT::Instrumentation::ThreadAllocations& counts = OT::Instrumentation::currentThreadAllocations();
+        OT::Instrumentation::Stage stage = OT::Instrumentation::threadStage;
+        counts.allocations[stage].fetch_add(1, std::memory_order_relaxed);
+        counts.bytes[stage].fetch_add(size, std::memory_order_relaxed);
+        return std::malloc(size == 0 ? 1 : size);
+    }
+    
+    void countedFree(void* pointer) {
+        if (pointer != nullptr) {
+            OT::Instrumentation::ThreadAllocations& counts = OT::Instrumentation::currentThreadAllocations();
+            counts.frees[OT::Instrumentation::threadStage].fetch_add(1, std::memory_order_relaxed);
+            std::free(pointer);
+        }
+    }
+}
+
+void* operator new(std::size_t size) {
+    void* pointer = countedAllocation(size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    countedFree(pointer);
+}
+#endif
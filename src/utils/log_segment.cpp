@@ -0,0 +1,200 @@
+#include "utils/log_segment.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace OT {
+    namespace LogSegment {
+        // Every segment file starts with this header.
+        struct Header {
+            char magic[4];
+            uint32_t version;
+            uint32_t kind;
+            int32_t width;
+            int32_t height;
+        };
+        
+        // Every chunk starts with this header, followed by payloadBytes of records.
+        struct ChunkHeader {
+            uint32_t numRecords;
+            uint32_t payloadBytes;
+        };
+        
+        const char kMagic[4] = {'O', 'T', 'S', 'G'};
+        // Version 2 added the flags of every record.
+        const uint32_t kVersion = 2;
+        
+        void putVarint(std::string& out, uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+        
+        void putSigned(std::string& out, int64_t value) {
+            // Zigzag encode so small negative numbers stay small.
+            putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+        }
+        
+        bool getVarint(const char*& p, const char* end, uint64_t& value) {
+            value = 0;
+            for (int shift = 0; shift < 64 && p < end; shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(*p++);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        bool getSigned(const char*& p, const char* end, int64_t& value) {
+            uint64_t raw;
+            if (!getVarint(p, end, raw)) {
+                return false;
+            }
+            value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+            return true;
+        }
+        
+        std::string segmentPath(const std::string& prefix, int index) {
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), ".%06d.seg", index);
+            return prefix + suffix;
+        }
+        
+        Writer::Writer(const std::string& prefix, Kind kind, size_t maxSegmentBytes) {
+            this->prefix = prefix;
+            this->kind = kind;
+            this->maxSegmentBytes = maxSegmentBytes;
+            this->segmentIndex = -1;
+            this->segmentBytes = 0;
+            this->width = 0;
+            this->height = 0;
+        }
+        
+        void Writer::setDimensions(int width, int height) {
+            this->width = width;
+            this->height = height;
+        }
+        
+        void Writer::rotate() {
+            this->segment.close();
+            
+            // The segments of an earlier, longer run with the same prefix would be read as
+            // if they followed this one, so remove them before writing the first segment.
+            if (this->segmentIndex < 0) {
+                for (int index = 0; std::remove(segmentPath(this->prefix, index).c_str()) == 0; index++) {
+                }
+            }
+            this->segmentIndex++;
+            this->segment.open(segmentPath(this->prefix, this->segmentIndex));
+            
+            Header header;
+            std::copy(kMagic, kMagic + 4, header.magic);
+            header.version = kVersion;
+            header.kind = this->kind;
+            header.width = this->width;
+            header.height = this->height;
+            this->segment.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            this->segmentBytes = sizeof(header);
+        }
+        
+        void Writer::writeChunk(const std::vector<Record>& records) {
+            if (records.empty()) {
+                return;
+            }
+            if (!this->segment.isOpen() || this->segmentBytes >= this->maxSegmentBytes) {
+                this->rotate();
+            }
+            
+            // Encode the records. Frames are stored as deltas from the previous record.
+            this->buffer.clear();
+            long previousFrame = 0;
+            for (auto record : records) {
+                putSigned(this->buffer, record.frame - previousFrame);
+                putSigned(this->buffer, record.id);
+                putSigned(this->buffer, record.x);
+                putSigned(this->buffer, record.y);
+                putVarint(this->buffer, record.startsTrajectory ? 1 : 0);
+                previousFrame = record.frame;
+            }
+            
+            ChunkHeader header{static_cast<uint32_t>(records.size()),
+                               static_cast<uint32_t>(this->buffer.size())};
+            this->segment.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            this->segment.write(this->buffer.data(), this->buffer.size());
+            this->segmentBytes += sizeof(header) + this->buffer.size();
+            
+            // Chunks are already batched, so write each one out rather than keeping a pooled
+            // buffer until the next one, which may be a long time coming.
+            this->segment.flush();
+        }
+        
+        void Writer::close() {
+            // A log that never spilled still gets an (empty) segment, so it can be read.
+            if (this->segmentIndex < 0) {
+                this->rotate();
+            }
+            this->segment.close();
+        }
+        
+        bool readAll(const std::string& prefix,
+                     Kind& kind,
+                     int& width,
+                     int& height,
+                     std::vector<Record>& records) {
+            int index = 0;
+            std::string payload;
+            for (;; index++) {
+                std::ifstream segment(segmentPath(prefix, index), std::ios::binary);
+                if (!segment.is_open()) {
+                    break;
+                }
+                
+                Header header;
+                if (!segment.read(reinterpret_cast<char*>(&header), sizeof(header))
+                    || !std::equal(kMagic, kMagic + 4, header.magic)
+                    || header.version < 1 || header.version > kVersion) {
+                    return false;
+                }
+                kind = static_cast<Kind>(header.kind);
+                width = header.width;
+                height = header.height;
+                
+                ChunkHeader chunk;
+                while (segment.read(reinterpret_cast<char*>(&chunk), sizeof(chunk))) {
+                    payload.resize(chunk.payloadBytes);
+                    if (!segment.read(&payload[0], chunk.payloadBytes)) {
+                        return false;
+                    }
+                    
+                    const char* p = payload.data();
+                    const char* end = p + payload.size();
+                    long previousFrame = 0;
+                    for (uint32_t i = 0; i < chunk.numRecords; i++) {
+                        int64_t frameDelta, id, x, y;
+                        uint64_t flags = 0;
+                        if (!getSigned(p, end, frameDelta) || !getSigned(p, end, id)
+                            || !getSigned(p, end, x) || !getSigned(p, end, y)
+                            || (header.version >= 2 && !getVarint(p, end, flags))) {
+                            return false;
+                        }
+                        previousFrame += frameDelta;
+                        records.push_back(Record{previousFrame,
+                                                 static_cast<int>(id),
+                                                 static_cast<int>(x),
+                                                 static_cast<int>(y),
+                                                 (flags & 1) != 0});
+                    }
+                }
+            }
+            return index > 0;
+        }
+    }
+}
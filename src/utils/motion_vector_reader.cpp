@@ -0,0 +1,218 @@
+#include "utils/motion_vector_reader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#ifdef OT_WITH_LIBAV
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+#include <libavutil/motion_vector.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+namespace OT {
+    MotionVectorReader::MotionVectorReader(int blockSize, double minMotion) {
+        this->format = nullptr;
+        this->decoder = nullptr;
+        this->streamIndex = -1;
+        this->packet = nullptr;
+        this->decoded = nullptr;
+        this->converter = nullptr;
+        this->draining = false;
+        this->blockSize = blockSize;
+        this->minMotion = minMotion;
+    }
+    
+    MotionVectorReader::~MotionVectorReader() {
+        this->close();
+    }
+
+#ifdef OT_WITH_LIBAV
+    bool MotionVectorReader::open(const std::string& path) {
+        this->close();
+        
+        // Only read local files, never anything over the network.
+        AVDictionary* formatOptions = nullptr;
+        av_dict_set(&formatOptions, "protocol_whitelist", "file", 0);
+        int opened = avformat_open_input(&this->format, path.c_str(), nullptr, &formatOptions);
+        av_dict_free(&formatOptions);
+        if (opened < 0) {
+            return false;
+        }
+        if (avformat_find_stream_info(this->format, nullptr) < 0) {
+            this->close();
+            return false;
+        }
+        
+        this->streamIndex = av_find_best_stream(this->format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (this->streamIndex < 0) {
+            this->close();
+            return false;
+        }
+        AVCodecParameters* parameters = this->format->streams[this->streamIndex]->codecpar;
+        const AVCodec* codec = avcodec_find_decoder(parameters->codec_id);
+        if (codec == nullptr) {
+            this->close();
+            return false;
+        }
+        this->decoder = avcodec_alloc_context3(codec);
+        if (this->decoder == nullptr || avcodec_parameters_to_context(this->decoder, parameters) < 0) {
+            this->close();
+            return false;
+        }
+        
+        // Have the decoder attach the motion vectors to every frame.
+        AVDictionary* decoderOptions = nullptr;
+        av_dict_set(&decoderOptions, "flags2", "+export_mvs", 0);
+        opened = avcodec_open2(this->decoder, codec, &decoderOptions);
+        av_dict_free(&decoderOptions);
+        if (opened < 0) {
+            this->close();
+            return false;
+        }
+        
+        this->packet = av_packet_alloc();
+        this->decoded = av_frame_alloc();
+        this->draining = false;
+        this->motion = cv::Mat();
+        return this->packet != nullptr && this->decoded != nullptr;
+    }
+    
+    bool MotionVectorReader::decodeNext() {
+        while (true) {
+            int result = avcodec_receive_frame(this->decoder, this->decoded);
+            if (result == 0) {
+                return true;
+            }
+            if (result != AVERROR(EAGAIN) || this->draining) {
+                return false;
+            }
+            
+            // Feed the decoder the next packet of the video, or drain it at the end. Corrupt
+            // packets are skipped.
+            if (av_read_frame(this->format, this->packet) < 0) {
+                this->draining = true;
+                avcodec_send_packet(this->decoder, nullptr);
+                continue;
+            }
+            if (this->packet->stream_index == this->streamIndex) {
+                avcodec_send_packet(this->decoder, this->packet);
+            }
+            av_packet_unref(this->packet);
+        }
+    }
+    
+    void MotionVectorReader::updateMotion() {
+        int rows = (this->decoded->height + this->blockSize - 1) / this->blockSize;
+        int cols = (this->decoded->width + this->blockSize - 1) / this->blockSize;
+        
+        // Key frames have no motion vectors, so keep the map of the previous frame.
+        AVFrameSideData* sideData = av_frame_get_side_data(this->decoded, AV_FRAME_DATA_MOTION_VECTORS);
+        if (sideData == nullptr) {
+            if (this->motion.rows != rows || this->motion.cols != cols) {
+                this->motion = cv::Mat::zeros(rows, cols, CV_8U);
+            }
+            return;
+        }
+        
+        // Mark the blocks covered by every vector that is long enough. A vector describes
+        // a w x h block centered on (dst_x, dst_y).
+        cv::Mat moved = cv::Mat::zeros(rows, cols, CV_8U);
+        const AVMotionVector* vectors = reinterpret_cast<const AVMotionVector*>(sideData->data);
+        size_t numVectors = static_cast<size_t>(sideData->size) / sizeof(AVMotionVector);
+        for (size_t i = 0; i < numVectors; i++) {
+            const AVMotionVector& vector = vectors[i];
+            
+            // The rounded src/dst positions lose any sub-pixel motion, so measure the
+            // length from the motion in units of 1 / motion_scale pixels.
+            if (vector.motion_scale <= 0) {
+                continue;
+            }
+            double motionX = static_cast<double>(vector.motion_x) / vector.motion_scale;
+            double motionY = static_cast<double>(vector.motion_y) / vector.motion_scale;
+            if (std::hypot(motionX, motionY) < this->minMotion) {
+                continue;
+            }
+            int x0 = std::max(0, vector.dst_x - vector.w / 2) / this->blockSize;
+            int y0 = std::max(0, vector.dst_y - vector.h / 2) / this->blockSize;
+            int x1 = std::min(cols - 1, std::max(0, vector.dst_x + vector.w / 2 - 1) / this->blockSize);
+            int y1 = std::min(rows - 1, std::max(0, vector.dst_y + vector.h / 2 - 1) / this->blockSize);
+            if (x0 <= x1 && y0 <= y1) {
+                moved(cv::Range(y0, y1 + 1), cv::Range(x0, x1 + 1)).setTo(cv::Scalar::all(255));
+            }
+        }
+        
+        // Grow the map by a block, so the edges of moving objects aren't cut off.
+        cv::dilate(moved, this->motion, cv::Mat());
+    }
+    
+    bool MotionVectorReader::read(cv::Mat& frame, cv::Mat& blocks) {
+        if (this->decoder == nullptr || !this->decodeNext()) {
+            return false;
+        }
+        this->updateMotion();
+        
+        int width = this->decoded->width;
+        int height = this->decoded->height;
+        this->converter = sws_getCachedContext(this->converter,
+                                               width,
+                                               height,
+                                               static_cast<AVPixelFormat>(this->decoded->format),
+                                               width,
+                                               height,
+                                               AV_PIX_FMT_BGR24,
+                                               SWS_BILINEAR,
+                                               nullptr,
+                                               nullptr,
+                                               nullptr);
+        if (this->converter == nullptr) {
+            return false;
+        }
+        frame.create(height, width, CV_8UC3);
+        uint8_t* data[1] = {frame.data};
+        int lineSize[1] = {static_cast<int>(frame.step)};
+        sws_scale(this->converter, this->decoded->data, this->decoded->linesize, 0, height, data, lineSize);
+        av_frame_unref(this->decoded);
+        
+        this->motion.copyTo(blocks);
+        return true;
+    }
+    
+    void MotionVectorReader::close() {
+        sws_freeContext(this->converter);
+        this->converter = nullptr;
+        av_frame_free(&this->decoded);
+        av_packet_free(&this->packet);
+        avcodec_free_context(&this->decoder);
+        avformat_close_input(&this->format);
+        this->streamIndex = -1;
+    }
+#else
+    bool MotionVectorReader::open(const std::string& path) {
+        std::cerr << "The tracker was built without libav, so it can't read motion vectors from "
+                  << path << std::endl;
+        return false;
+    }
+    
+    bool MotionVectorReader::decodeNext() {
+        return false;
+    }
+    
+    void MotionVectorReader::updateMotion() {
+    }
+    
+    bool MotionVectorReader::read(cv::Mat& frame, cv::Mat& blocks) {
+        return false;
+    }
+    
+    void MotionVectorReader::close() {
+    }
+#endif
+}
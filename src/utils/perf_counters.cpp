@@ -0,0 +1,105 @@
+#include "utils/perf_counters.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace OT {
+    PerfCounters::PerfCounters() {
+        for (int i = 0; i < NumEvents; i++) {
+            this->fds[i] = -1;
+        }
+    }
+    
+    PerfCounters::~PerfCounters() {
+        this->close();
+    }
+    
+    bool PerfCounters::isAvailable(Event event) const {
+        return this->fds[event] != -1;
+    }
+
+#ifdef __linux__
+    bool PerfCounters::open() {
+        this->close();
+        const uint64_t configs[NumEvents] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+        
+        // Each counter is opened on its own, so that the ones the machine lacks are skipped.
+        int error = 0;
+        bool any = false;
+        for (int i = 0; i < NumEvents; i++) {
+            perf_event_attr attributes;
+            std::memset(&attributes, 0, sizeof(attributes));
+            attributes.size = sizeof(attributes);
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = configs[i];
+            attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            this->fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (this->fds[i] == -1) {
+                error = errno;
+            } else {
+                any = true;
+            }
+        }
+        if (!any) {
+            std::cerr << "Hardware performance counters aren't available (" << std::strerror(error)
+                      << "), check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+        }
+        return any;
+    }
+    
+    void PerfCounters::read(uint64_t values[NumEvents]) const {
+        for (int i = 0; i < NumEvents; i++) {
+            values[i] = 0;
+            
+            // The count, the time the counter was enabled and the time it actually ran.
+            uint64_t data[3];
+            if (this->fds[i] == -1 || ::read(this->fds[i], data, sizeof(data)) != sizeof(data)) {
+                continue;
+            }
+            if (data[2] > 0 && data[2] < data[1]) {
+                values[i] = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+            } else {
+                values[i] = data[0];
+            }
+        }
+    }
+    
+    void PerfCounters::close() {
+        for (int i = 0; i < NumEvents; i++) {
+            if (this->fds[i] != -1) {
+                ::close(this->fds[i]);
+                this->fds[i] = -1;
+            }
+        }
+    }
+#else
+    bool PerfCounters::open() {
+        std::cerr << "Hardware performance counters are only available on Linux" << std::endl;
+        return false;
+    }
+    
+    void PerfCounters::read(uint64_t values[NumEvents]) const {
+        for (int i = 0; i < NumEvents; i++) {
+            values[i] = 0;
+        }
+    }
+    
+    void PerfCounters::close() {
+    }
+#endif
+}
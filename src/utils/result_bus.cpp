@@ -0,0 +1,228 @@
+#include "utils/result_bus.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "utils/instrumentation.hpp"
+
+namespace OT {
+    namespace {
+        int64_t nanosecondsSince(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+        
+        // Raise a maximum that only one thread writes.
+        template <typename T>
+        void raiseMaximum(std::atomic<T>& maximum, T value) {
+            if (value > maximum.load(std::memory_order_relaxed)) {
+                maximum.store(value, std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    ResultBus::ResultBus(size_t capacity) {
+        this->capacity = std::max<size_t>(1, capacity);
+        this->slots.reset(new Slot[this->capacity]);
+        for (size_t i = 0; i < this->capacity; i++) {
+            this->slots[i].sequence = -1;
+            this->slots[i].readers = 0;
+        }
+        this->published = 0;
+        this->closed = false;
+        this->sleepingSinks = 0;
+        this->producerSleeping = false;
+    }
+    
+    ResultBus::~ResultBus() {
+        this->close();
+    }
+    
+    void ResultBus::addSink(const std::string& name, Policy policy, std::function<void(const ResultBatch&)> handler) {
+        this->sinks.push_back(std::make_unique<Sink>());
+        Sink& sink = *this->sinks.back();
+        sink.name = name;
+        sink.policy = policy;
+        sink.handler = handler;
+        sink.cursor = this->published.load();
+        sink.delivered = 0;
+        sink.dropped = 0;
+        sink.maxLag = 0;
+        sink.totalLatency = 0;
+        sink.maxLatency = 0;
+        sink.stalled = 0;
+        sink.thread = std::thread([this, &sink] { this->run(sink); });
+    }
+    
+    bool ResultBus::canWrite(long sequence) const {
+        // The cursors are loaded sequentially consistent, to pair with the sinks' stores
+        // (see run()).
+        for (const auto& sink : this->sinks) {
+            if (sink->policy == Block
+                && sequence - sink->cursor.load() >= static_cast<long>(this->capacity)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    ResultBatch& ResultBus::prepare() {
+        long sequence = this->published.load(std::memory_order_relaxed);
+        if (!this->canWrite(sequence)) {
+            // Charge the wait to the sinks that are a whole ring behind.
+            std::vector<Sink*> behind;
+            for (const auto& sink : this->sinks) {
+                if (sink->policy == Block && sequence - sink->cursor.load() >= static_cast<long>(this->capacity)) {
+                    behind.push_back(sink.get());
+                }
+            }
+            OT::Instrumentation::TraceScope trace("wait for sinks");
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            this->producerSleeping = true;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->slotAvailable.wait(lock, [this, sequence] { return this->canWrite(sequence); });
+            }
+            this->producerSleeping = false;
+            int64_t stalled = nanosecondsSince(start);
+            for (Sink* sink : behind) {
+                sink->stalled += stalled;
+            }
+        }
+        
+        // Take the slot away from the dropping sinks, and wait for any that are still copying
+        // it out, which doesn't take long.
+        Slot& slot = this->slots[sequence % this->capacity];
+        slot.sequence = -1;
+        while (slot.readers.load() != 0) {
+            std::this_thread::yield();
+        }
+        return slot.batch;
+    }
+    
+    void ResultBus::publish() {
+        long sequence = this->published.load(std::memory_order_relaxed);
+        Slot& slot = this->slots[sequence % this->capacity];
+        slot.batch.published = std::chrono::steady_clock::now();
+        slot.sequence = sequence;
+        this->published = sequence + 1;
+        if (this->sleepingSinks.load() > 0) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->batchAvailable.notify_all();
+        }
+    }
+    
+    void ResultBus::run(Sink& sink) {
+        OT::Instrumentation::setThreadName(sink.name.c_str());
+        
+        // The copy of the batch being handled, reused for every batch.
+        ResultBatch batch;
+        long next = sink.cursor.load();
+        while (true) {
+            if (this->published.load() <= next) {
+                this->sleepingSinks++;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->batchAvailable.wait(lock, [this, next] {
+                        return this->published.load() > next || this->closed.load();
+                    });
+                }
+                this->sleepingSinks--;
+                if (this->published.load() <= next) {
+                    return;
+                }
+            }
+            
+            // Copy the batch out, unless the producer has already moved on to a newer one in
+            // its slot.
+            Slot& slot = this->slots[next % this->capacity];
+            slot.readers++;
+            bool isCurrent = slot.sequence.load() == next;
+            if (isCurrent) {
+                batch = slot.batch;
+            }
+            slot.readers--;
+            if (!isCurrent) {
+                // Skip to the oldest batch that the producer isn't about to overwrite.
+                long oldest = this->published.load() - static_cast<long>(this->capacity) + 1;
+                long skipTo = std::max(next + 1, oldest);
+                sink.dropped += skipTo - next;
+                next = skipTo;
+                sink.cursor.store(next);
+                continue;
+            }
+            
+            // The producer sets producerSleeping and then checks the cursors, and the sink
+            // stores its cursor and then checks producerSleeping. Both sides are sequentially
+            // consistent, so at least one of them sees the other's store and the producer
+            // can't sleep through the slot becoming free. With release and acquire, both
+            // loads could see the old values.
+            next++;
+            sink.cursor.store(next);
+            if (this->producerSleeping.load()) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->slotAvailable.notify_all();
+            }
+            raiseMaximum(sink.maxLag, this->published.load() - next);
+            
+            sink.handler(batch);
+            
+            int64_t latency = nanosecondsSince(batch.published);
+            sink.totalLatency += latency;
+            raiseMaximum(sink.maxLatency, latency);
+            sink.delivered++;
+        }
+    }
+    
+    void ResultBus::close() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->closed = true;
+            this->batchAvailable.notify_all();
+        }
+        for (auto& sink : this->sinks) {
+            if (sink->thread.joinable()) {
+                sink->thread.join();
+            }
+        }
+    }
+    
+    std::vector<ResultBus::SinkStats> ResultBus::stats() const {
+        std::vector<SinkStats> stats;
+        long published = this->published.load();
+        for (const auto& sink : this->sinks) {
+            long delivered = sink->delivered.load();
+            SinkStats sinkStats;
+            sinkStats.name = sink->name;
+            sinkStats.policy = sink->policy;
+            sinkStats.delivered = delivered;
+            sinkStats.dropped = sink->dropped.load();
+            sinkStats.lag = published - sink->cursor.load();
+            sinkStats.maxLag = sink->maxLag.load();
+            sinkStats.meanLatencyMs = delivered > 0 ? sink->totalLatency.load() / 1e6 / delivered : 0;
+            sinkStats.maxLatencyMs = sink->maxLatency.load() / 1e6;
+            sinkStats.stalledMs = sink->stalled.load() / 1e6;
+            stats.push_back(sinkStats);
+        }
+        return stats;
+    }
+    
+    void ResultBus::print(std::ostream& out) const {
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-12s %6s %10s %8s %6s %8s %10s %10s %11s",
+                      "sink", "policy", "delivered", "dropped", "lag", "max lag", "mean ms", "max ms", "stalled ms");
+        out << "Result sinks:" << std::endl << line << std::endl;
+        for (const auto& sink : this->stats()) {
+            std::snprintf(line, sizeof(line), "%-12s %6s %10ld %8ld %6ld %8ld %10.3f %10.3f %11.3f",
+                          sink.name.c_str(),
+                          sink.policy == Block ? "block" : "drop",
+                          sink.delivered,
+                          sink.dropped,
+                          sink.lag,
+                          sink.maxLag,
+                          sink.meanLatencyMs,
+                          sink.maxLatencyMs,
+                          sink.stalledMs);
+            out << line << std::endl;
+        }
+    }
+}
@@ -2,14 +2,30 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "utils/instrumentation.hpp"
+
 namespace OT {
     namespace Utils {
+        // Whether q was pressed in one of the windows. Handling the window events can take
+        // a while, so it is traced separately from the decoding.
+        bool hasQuit() {
+            Instrumentation::TraceScope trace("waitKey");
+            return ((char) cv::waitKey(1)) == 'q';
+        }
+        
         bool hasFrame(cv::VideoCapture& capture) {
-            bool hasNotQuit = ((char) cv::waitKey(1)) != 'q';
+            bool hasNotQuit = !hasQuit();
+            Instrumentation::TraceScope trace("grab");
             bool hasAnotherFrame = capture.grab();
             return hasNotQuit && hasAnotherFrame;
         }
         
+        bool hasFrame(MotionVectorReader& reader, cv::Mat& frame, cv::Mat& blocks) {
+            bool hasNotQuit = !hasQuit();
+            Instrumentation::TraceScope trace("decode");
+            return hasNotQuit && reader.read(frame, blocks);
+        }
+        
         void scale(cv::Mat& img, int maxDimension) {
             if (maxDimension == -1) {
                 return;
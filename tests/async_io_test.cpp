@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "utils/async_io.hpp"
+
+// Opens more sinks than the pool has buffers, and has each of them hold a partly filled
+// buffer while the others write, as segment writers and journals do between batches. This
+// used to wait forever for a buffer that no sink was going to give back.
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "threads") {
+        OT::AsyncIO::Service::useThreadPool(true);
+    }
+    const int numSinks = 40;
+    const int numRounds = 3;
+    std::string directory = "async_io_test." + std::to_string(getpid());
+    
+    std::vector<std::unique_ptr<OT::AsyncIO::Sink>> sinks;
+    for (int i = 0; i < numSinks; i++) {
+        sinks.push_back(std::make_unique<OT::AsyncIO::Sink>());
+        std::string path = directory + "." + std::to_string(i);
+        if (!sinks.back()->open(path)) {
+            std::cerr << "Problem opening " << path << std::endl;
+            return 1;
+        }
+    }
+    
+    // Every round leaves each sink with a partly filled buffer.
+    for (int round = 0; round < numRounds; round++) {
+        for (int i = 0; i < numSinks; i++) {
+            sinks[i]->write("round " + std::to_string(round) + " sink " + std::to_string(i) + "\n");
+        }
+    }
+    
+    int failures = 0;
+    for (int i = 0; i < numSinks; i++) {
+        if (!sinks[i]->close()) {
+            std::cerr << "Sink " << i << " failed to write" << std::endl;
+            failures++;
+        }
+    }
+    
+    for (int i = 0; i < numSinks; i++) {
+        std::string path = directory + "." + std::to_string(i);
+        std::ostringstream expected;
+        for (int round = 0; round < numRounds; round++) {
+            expected << "round " << round << " sink " << i << "\n";
+        }
+        std::ifstream file(path);
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        if (contents.str() != expected.str()) {
+            std::cerr << path << " has the wrong contents" << std::endl;
+            failures++;
+        }
+        std::remove(path.c_str());
+    }
+    
+    std::cout << numSinks << " sinks through " << OT::AsyncIO::Service::shared().backendName()
+              << ", " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}